@@ -9,7 +9,27 @@ target_link_libraries(testPoseOptimization
     ${PROJECT_NAME}
     )
 
+# Save and load map snapshots
+add_executable(testMapSnapshot
+    ${TESTS}/test_map_snapshot.cpp
+    )
+target_link_libraries(testMapSnapshot
+    gtest_main
+    ${PROJECT_NAME}
+    )
+
+# Local bundle adjustment: edge jacobians and convergence on a synthetic problem
+add_executable(testLocalBundleAdjustment
+    ${TESTS}/test_local_bundle_adjustment.cpp
+    )
+target_link_libraries(testLocalBundleAdjustment
+    gtest_main
+    ${PROJECT_NAME}
+    )
+
 
 
 include(GoogleTest)
 gtest_discover_tests(testPoseOptimization)
+gtest_discover_tests(testMapSnapshot)
+gtest_discover_tests(testLocalBundleAdjustment)
@@ -0,0 +1,112 @@
+#ifndef RGBDSLAM_FEATURES_KEYPOINTS_KEYPOINT_DESCRIPTOR_HPP
+#define RGBDSLAM_FEATURES_KEYPOINTS_KEYPOINT_DESCRIPTOR_HPP
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/xfeatures2d.hpp>
+
+namespace rgbd_slam {
+    namespace features {
+        namespace keypoints {
+
+            /**
+             * \brief A binary descriptor of fixed size, stored by value. Aligned on 32 bytes so descriptor arrays can be scanned with wide loads
+             *
+             * \tparam WordCount Number of 64 bits words in this descriptor
+             */
+            template<size_t WordCount>
+            struct alignas(32) Binary_Descriptor
+            {
+                static constexpr size_t byteSize = WordCount * sizeof(uint64_t);
+
+                Binary_Descriptor()
+                {
+                    _words.fill(0);
+                };
+
+                /**
+                 * \param[in] data A pointer to byteSize bytes of descriptor
+                 */
+                explicit Binary_Descriptor(const uchar* data)
+                {
+                    std::memcpy(_words.data(), data, byteSize);
+                };
+
+                /**
+                 * \brief Compute the Hamming distance between two descriptors
+                 */
+                uint get_distance(const Binary_Descriptor& other) const
+                {
+                    uint distance = 0;
+                    for (size_t wordIndex = 0; wordIndex < WordCount; ++wordIndex)
+                        distance += static_cast<uint>(std::popcount(_words[wordIndex] ^ other._words[wordIndex]));
+                    return distance;
+                }
+
+                std::array<uint64_t, WordCount> _words;
+            };
+
+            /**
+             * \brief Traits associating a BRIEF descriptor extractor with its descriptor type (BRIEF-32)
+             */
+            struct Brief_Extractor_Traits
+            {
+                typedef Binary_Descriptor<4> descriptor;
+
+                static cv::Ptr<cv::DescriptorExtractor> create()
+                {
+                    return cv::xfeatures2d::BriefDescriptorExtractor::create(descriptor::byteSize);
+                }
+            };
+
+            /**
+             * \brief Traits associating an ORB descriptor extractor with its descriptor type (32 bytes)
+             */
+            struct Orb_Extractor_Traits
+            {
+                typedef Binary_Descriptor<4> descriptor;
+
+                static cv::Ptr<cv::DescriptorExtractor> create()
+                {
+                    return cv::ORB::create();
+                }
+            };
+
+            // Descriptor extractor used by the program, selected at compile time
+            typedef Brief_Extractor_Traits Descriptor_Extractor_Traits;
+            typedef Descriptor_Extractor_Traits::descriptor Keypoint_Descriptor;
+            typedef std::vector<Keypoint_Descriptor> descriptor_vector;
+
+            /**
+             * \brief Copy the rows of an OpenCV descriptor matrix to fixed size descriptors
+             *
+             * \param[in] descriptorMatrix The descriptors computed by an extractor, one by row
+             * \param[out] descriptors The descriptors, in the same order as the matrix rows
+             */
+            template<class Descriptor>
+            void convert_descriptors(const cv::Mat& descriptorMatrix, std::vector<Descriptor>& descriptors)
+            {
+                descriptors.clear();
+                if (descriptorMatrix.rows <= 0)
+                    return;
+
+                // This is the only place where the extractor output size is checked
+                assert(descriptorMatrix.type() == CV_8U);
+                assert(static_cast<size_t>(descriptorMatrix.cols) == Descriptor::byteSize);
+
+                descriptors.reserve(descriptorMatrix.rows);
+                for (int row = 0; row < descriptorMatrix.rows; ++row)
+                    descriptors.emplace_back(descriptorMatrix.ptr<uchar>(row));
+            }
+
+        }
+    }
+}
+
+#endif
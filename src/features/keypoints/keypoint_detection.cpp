@@ -6,74 +6,178 @@
 // circle
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 
 namespace rgbd_slam {
     namespace features {
         namespace keypoints {
 
+            // FAST needs a 3 pixels circle around a candidate: detect in a slightly bigger area than the cell
+            const int FAST_DETECTION_BORDER = 3;
+            // Factors applied to a detection cell threshold, when it detected too few or too many keypoints
+            const double CELL_THRESHOLD_DECREASE = 0.75;
+            const double CELL_THRESHOLD_INCREASE = 1.25;
+
+            /**
+             * \brief Check if a point is closer to a tracked keypoint than the keypoint mask radius. Only the tracked keypoints of the surrounding cells are checked
+             */
+            bool is_close_to_tracked_keypoint(const cv::Point2f& point, const std::vector<std::vector<cv::Point2f>>& trackedKeypointGrid, const int cellX, const int cellY, const int cellCountX, const int cellCountY, const float squaredMaskRadius)
+            {
+                for (int y = std::max(0, cellY - 1); y < std::min(cellCountY, cellY + 2); ++y)
+                {
+                    for (int x = std::max(0, cellX - 1); x < std::min(cellCountX, cellX + 2); ++x)
+                    {
+                        for (const cv::Point2f& trackedPoint : trackedKeypointGrid[y * cellCountX + x])
+                        {
+                            const cv::Point2f& distance = trackedPoint - point;
+                            if (distance.x * distance.x + distance.y * distance.y <= squaredMaskRadius)
+                                return true;
+                        }
+                    }
+                }
+                return false;
+            }
+
+
+            /**
+             * \brief Compute the ratio of detection cells that contain at least one tracked keypoint
+             */
+            double get_tracked_cell_ratio(const std::vector<cv::Point2f>& trackedKeypoints, const cv::Size& imageSize)
+            {
+                const int cellSize = static_cast<int>(Parameters::get_keypoint_detection_cell_size());
+                const int cellCountX = static_cast<int>(std::ceil(imageSize.width / static_cast<double>(cellSize)));
+                const int cellCountY = static_cast<int>(std::ceil(imageSize.height / static_cast<double>(cellSize)));
+                const int cellCount = cellCountX * cellCountY;
+                assert(cellCount > 0);
+
+                std::vector<bool> isCellTracked(cellCount, false);
+                int trackedCellCount = 0;
+                for (const cv::Point2f& trackedPoint : trackedKeypoints)
+                {
+                    const int cellX = std::clamp(static_cast<int>(trackedPoint.x) / cellSize, 0, cellCountX - 1);
+                    const int cellY = std::clamp(static_cast<int>(trackedPoint.y) / cellSize, 0, cellCountY - 1);
+                    const int cellIndex = cellY * cellCountX + cellX;
+                    if (not isCellTracked[cellIndex])
+                    {
+                        isCellTracked[cellIndex] = true;
+                        ++trackedCellCount;
+                    }
+                }
+                return trackedCellCount / static_cast<double>(cellCount);
+            }
+
+
             /*
              * Keypoint extraction
              */
 
             Key_Point_Extraction::Key_Point_Extraction(const uint minHessian) :
-                // Create feature extractor and matcher
-                _featureDetector(cv::FastFeatureDetector::create( minHessian )),
-                _advancedFeatureDetector(cv::FastFeatureDetector::create( minHessian / 2 )),
-                _descriptorExtractor(cv::xfeatures2d::BriefDescriptorExtractor::create())
+                // Create feature extractor
+                _descriptorExtractor(Descriptor_Extractor_Traits::create()),
+                _detectorThreshold(minHessian)
             {
-                assert(not _featureDetector.empty() );
-                assert(not _advancedFeatureDetector.empty() );
                 assert(not _descriptorExtractor.empty() );
+                assert(_detectorThreshold > 0);
 
                 //profiling
                 _meanPointExtractionTime = 0.0;
+                _detectionTimeEstimate = 0.0;
             }
 
-            const std::vector<cv::Point2f> Key_Point_Extraction::detect_keypoints(const cv::Mat& grayImage, const cv::Mat& mask, const uint minimumPointsForValidity) const
+            const std::vector<cv::Point2f> Key_Point_Extraction::detect_keypoints(const cv::Mat& grayImage, const std::vector<cv::Point2f>& trackedKeypoints, const uint maximumPointCount, const bool onlyInEmptyCells)
             {
-                std::vector<cv::Point2f> framePoints;
-                std::vector<cv::KeyPoint> frameKeypoints;
-                _featureDetector->detect(grayImage, frameKeypoints, mask); 
-
-                if (frameKeypoints.size() <=  minimumPointsForValidity)
+                const int cellSize = static_cast<int>(Parameters::get_keypoint_detection_cell_size());
+                const int cellCountX = static_cast<int>(std::ceil(grayImage.cols / static_cast<double>(cellSize)));
+                const int cellCountY = static_cast<int>(std::ceil(grayImage.rows / static_cast<double>(cellSize)));
+                const int cellCount = cellCountX * cellCountY;
+                assert(cellCount > 0);
+
+                // Thresholds are kept from one call to another, and reset if the image size changes
+                if (_cellDetectorThresholds.size() != static_cast<size_t>(cellCount))
+                    _cellDetectorThresholds.assign(cellCount, _detectorThreshold);
+                const uint minimumThreshold = std::max(1u, _detectorThreshold / 4);
+                const uint maximumThreshold = _detectorThreshold * 4;
+
+                // Place the tracked keypoints in the detection grid
+                std::vector<std::vector<cv::Point2f>> trackedKeypointGrid(cellCount);
+                for (const cv::Point2f& trackedPoint : trackedKeypoints)
                 {
-                    // Not enough keypoints detected: restart with a more precise detector
-                    frameKeypoints.clear();
-                    _advancedFeatureDetector->detect(grayImage, frameKeypoints, mask); 
+                    const int cellX = std::clamp(static_cast<int>(trackedPoint.x) / cellSize, 0, cellCountX - 1);
+                    const int cellY = std::clamp(static_cast<int>(trackedPoint.y) / cellSize, 0, cellCountY - 1);
+                    trackedKeypointGrid[cellY * cellCountX + cellX].push_back(trackedPoint);
                 }
 
-                if (frameKeypoints.size() >  minimumPointsForValidity)
-                {
-                    // Refine keypoints positions
-                    cv::KeyPoint::convert(frameKeypoints, framePoints);
+                // Each cell can hold the same number of keypoints, to spread them evenly in the image
+                const uint cellQuota = std::max(1u, static_cast<uint>(std::ceil(maximumPointCount / static_cast<double>(cellCount))));
+                const float squaredMaskRadius = static_cast<float>(pow(Parameters::get_keypoint_mask_diameter(), 2.0));
+                const cv::Rect imageArea(0, 0, grayImage.cols, grayImage.rows);
 
-                    const cv::Size winSize  = cv::Size(3, 3);
-                    const cv::Size zeroZone = cv::Size(-1, -1);
-                    const cv::TermCriteria termCriteria = cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 0.01);
-                    cv::cornerSubPix(grayImage, framePoints, winSize, zeroZone, termCriteria);
-                }
+                const cv::Size winSize  = cv::Size(3, 3);
+                const cv::Size zeroZone = cv::Size(-1, -1);
+                const cv::TermCriteria termCriteria = cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER, 30, 0.01);
 
-                return framePoints;
-            }
+                std::vector<std::vector<cv::Point2f>> cellKeypoints(cellCount);
+                cv::parallel_for_(cv::Range(0, cellCount), [&](const cv::Range& cellRange) {
+                    for (int cellIndex = cellRange.start; cellIndex < cellRange.end; ++cellIndex)
+                    {
+                        const size_t trackedPointCount = trackedKeypointGrid[cellIndex].size();
+                        if (trackedPointCount >= cellQuota or (onlyInEmptyCells and trackedPointCount > 0))
+                            // This cell is already filled
+                            continue;
+                        const uint quota = cellQuota - static_cast<uint>(trackedPointCount);
+
+                        const int cellX = cellIndex % cellCountX;
+                        const int cellY = cellIndex / cellCountX;
+                        const cv::Rect cellArea = cv::Rect(cellX * cellSize, cellY * cellSize, cellSize, cellSize) & imageArea;
+                        const cv::Rect detectionArea = cv::Rect(
+                                cellArea.x - FAST_DETECTION_BORDER,
+                                cellArea.y - FAST_DETECTION_BORDER,
+                                cellArea.width + 2 * FAST_DETECTION_BORDER,
+                                cellArea.height + 2 * FAST_DETECTION_BORDER
+                                ) & imageArea;
+
+                        uint& cellThreshold = _cellDetectorThresholds[cellIndex];
+                        std::vector<cv::KeyPoint> keypoints;
+                        cv::FAST(grayImage(detectionArea), keypoints, static_cast<int>(cellThreshold), true);
+
+                        // Keep the keypoints inside this cell, away from the tracked keypoints
+                        size_t keptKeypointCount = 0;
+                        for (cv::KeyPoint& keypoint : keypoints)
+                        {
+                            keypoint.pt.x += static_cast<float>(detectionArea.x);
+                            keypoint.pt.y += static_cast<float>(detectionArea.y);
+                            if (keypoint.pt.x < cellArea.x or keypoint.pt.y < cellArea.y or keypoint.pt.x >= cellArea.x + cellArea.width or keypoint.pt.y >= cellArea.y + cellArea.height)
+                                continue;
+                            if (is_close_to_tracked_keypoint(keypoint.pt, trackedKeypointGrid, cellX, cellY, cellCountX, cellCountY, squaredMaskRadius))
+                                continue;
+                            keypoints[keptKeypointCount++] = keypoint;
+                        }
+                        keypoints.resize(keptKeypointCount);
+
+                        // Adapt the threshold of this cell for the next detection
+                        if (keptKeypointCount < quota)
+                            cellThreshold = std::max(minimumThreshold, static_cast<uint>(cellThreshold * CELL_THRESHOLD_DECREASE));
+                        else if (keptKeypointCount > 2 * quota)
+                            cellThreshold = std::min(maximumThreshold, static_cast<uint>(cellThreshold * CELL_THRESHOLD_INCREASE) + 1);
+
+                        if (keypoints.empty())
+                            continue;
+
+                        // Keep the strongest keypoints, and refine their positions
+                        cv::KeyPointsFilter::retainBest(keypoints, static_cast<int>(quota));
+                        std::vector<cv::Point2f>& framePoints = cellKeypoints[cellIndex];
+                        cv::KeyPoint::convert(keypoints, framePoints);
+                        cv::cornerSubPix(grayImage, framePoints, winSize, zeroZone, termCriteria);
+                    }
+                });
 
-            const cv::Mat Key_Point_Extraction::compute_key_point_mask(const cv::Size imageSize, const std::vector<cv::Point2f>& keypointContainer) const
-            {
-                const uint radiusOfAreaAroundPoint = Parameters::get_keypoint_mask_diameter();  // in pixels
-                const cv::Scalar fillColor(0, 0, 0);
-                cv::Mat mask = cv::Mat::ones(imageSize, CV_8UC1);
-                for (const cv::Point2f& point : keypointContainer)
-                {
-#if 1
-                    cv::circle(mask, point, radiusOfAreaAroundPoint, fillColor, -1);
-#else
-                    const int areaXmin = point.x - radiusOfAreaAroundPoint;
-                    const int areaXmax = point.x + radiusOfAreaAroundPoint;
-                    const int areaYmin = point.y - radiusOfAreaAroundPoint;
-                    const int areaYmax = point.y + radiusOfAreaAroundPoint;
-                    cv::rectangle(mask, cv::Point(areaXmin, areaYmin), cv::Point(areaXmax, areaYmax), fillColor, -1);
-#endif
-                }
-                return mask;
+                std::vector<cv::Point2f> framePoints;
+                framePoints.reserve(cellCount * cellQuota);
+                for (const std::vector<cv::Point2f>& points : cellKeypoints)
+                    framePoints.insert(framePoints.end(), points.cbegin(), points.cend());
+                return framePoints;
             }
 
             const Keypoint_Handler Key_Point_Extraction::compute_keypoints(const cv::Mat& grayImage, const cv::Mat& depthImage, const KeypointsWithIdStruct& lastKeypointsWithIds, const bool forceKeypointDetection) 
@@ -81,7 +185,7 @@ namespace rgbd_slam {
                 assert(lastKeypointsWithIds._keypoints.size() == lastKeypointsWithIds._ids.size());
 
                 KeypointsWithIdStruct newKeypointsObject;
-                cv::Mat keypointDescriptors;
+                descriptor_vector keypointDescriptors;
 
                 //detect keypoints
                 double t1 = cv::getTickCount();
@@ -125,22 +229,31 @@ namespace rgbd_slam {
 
                 /*
                  * KEY POINT DETECTION
-                 *      Use keypoint detection when low on keypoints, or when requested
+                 *      Detect in the whole image when low on keypoints or when requested,
+                 *      or only in the empty cells when the tracked keypoints do not cover enough of the image
                  */   
 
-                // detect keypoint if: it is requested OR not enough points were detected
+                const bool isTrackingInsufficient = opticalFlowTrackedPointCount < minimumPointsForOptimization;
+                const bool isCoverageInsufficient = 
+                    opticalFlowTrackedPointCount < maximumPointsForLocalMap and 
+                    get_tracked_cell_ratio(newKeypointsObject._keypoints, grayImage.size()) < Parameters::get_keypoint_minimum_cell_coverage();
+                // Optional detections are skipped if they would not fit in the remaining time of this frame
+                const double elapsedTime = (cv::getTickCount() - t1) / static_cast<double>(cv::getTickFrequency());
+                const bool isDetectionInTimeBudget = elapsedTime + _detectionTimeEstimate <= Parameters::get_keypoint_detection_time_budget();
+
                 std::vector<cv::Point2f> detectedKeypoints;
-                const bool shouldDetectKeypoints = opticalFlowTrackedPointCount < minimumPointsForOptimization and opticalFlowTrackedPointCount < maximumPointsForLocalMap;
-                if (forceKeypointDetection or shouldDetectKeypoints)
+                const double detectionStartTime = cv::getTickCount();
+                if (forceKeypointDetection or isTrackingInsufficient)
                 {
-                    // create a mask at current keypoint location
-                    const cv::Mat& keypointMask = compute_key_point_mask(grayImage.size(), newKeypointsObject._keypoints);
-
-                    // get new keypoints
-                    detectedKeypoints = detect_keypoints(grayImage, keypointMask, minimumPointsForOptimization);
+                    // get new keypoints, away from the tracked ones
+                    detectedKeypoints = detect_keypoints(grayImage, newKeypointsObject._keypoints, maximumPointsForLocalMap, false);
+                }
+                else if (isCoverageInsufficient and isDetectionInTimeBudget)
+                {
+                    // partial redetection, in the image regions without tracked keypoints
+                    detectedKeypoints = detect_keypoints(grayImage, newKeypointsObject._keypoints, maximumPointsForLocalMap, true);
                 }
 
-                cv::Mat detectedKeypointDescriptors;
                 if (detectedKeypoints.size() > 0)
                 {
                     /**
@@ -152,16 +265,19 @@ namespace rgbd_slam {
                     // Compute descriptors
                     // Caution: the frameKeypoints list is mutable by this function
                     //          The bad points will be removed by the compute descriptor function
+                    cv::Mat detectedKeypointDescriptors;
                     _descriptorExtractor->compute(grayImage, frameKeypoints, detectedKeypointDescriptors);
 
                     // convert back to keypoint list
                     detectedKeypoints.clear();
                     cv::KeyPoint::convert(frameKeypoints, detectedKeypoints);
 
-                    if (keypointDescriptors.rows > 0)
-                        cv::vconcat(detectedKeypointDescriptors, keypointDescriptors, keypointDescriptors);
-                    else
-                        keypointDescriptors = detectedKeypointDescriptors;
+                    // store the descriptors by value
+                    convert_descriptors(detectedKeypointDescriptors, keypointDescriptors);
+
+                    // Update the expected duration of a detection
+                    const double detectionTime = (cv::getTickCount() - detectionStartTime) / static_cast<double>(cv::getTickFrequency());
+                    _detectionTimeEstimate = (_detectionTimeEstimate > 0.0) ? (0.9 * _detectionTimeEstimate + 0.1 * detectionTime) : detectionTime;
                 }
 
                 _meanPointExtractionTime += (cv::getTickCount() - t1) / static_cast<double>(cv::getTickFrequency());
@@ -25,7 +25,7 @@ namespace rgbd_slam {
                      * \param[in] grayImage The input image from camera
                      * \param[in] depthImage The input depth image from camera
                      * \param[in] lastKeypointsWithIds The keypoints of the previous detection step, that will be tracked with optical flow
-                     * \param[in] forceKeypointDetection Force the detection of keypoints in the image
+                     * \param[in] forceKeypointDetection Force the detection of keypoints in the whole image, without optical flow tracking. Else, keypoints are detected when too few are tracked, or in the empty image cells when the tracked keypoints do not cover enough of the image and the frame time budget allows it
                      *
                      * \return An object that contains the detected keypoints
                      */
@@ -57,26 +57,30 @@ namespace rgbd_slam {
 
 
                     /**
-                     * \brief Compute new key point, with an optional mask to exclude detection zones
+                     * \brief Compute new key points, in the image cells that are not already filled by tracked keypoints. The cells are processed in parallel, each with its own adaptive detector threshold
                      *
-                     * \param[in] grayImage The image in which we want to detect waypoints
-                     * \param[in] mask The mask which we do not want to detect waypoints
-                     * \param[in] minimumPointsForValidity The minimum number of points under which we will use the precise detector
+                     * \param[in] grayImage The image in which we want to detect keypoints
+                     * \param[in] trackedKeypoints The keypoints tracked by optical flow. No new keypoints will be detected around them
+                     * \param[in] maximumPointCount The maximum number of keypoints (tracked and detected) for this image. It is shared evenly between the image cells
+                     * \param[in] onlyInEmptyCells If true, only detect keypoints in the cells that contain no tracked keypoints (partial redetection)
                      *
                      * \return An array of points in the input image
                      */
-                    const std::vector<cv::Point2f> detect_keypoints(const cv::Mat& grayImage, const cv::Mat& mask, const uint minimumPointsForValidity) const;
-
-                    const cv::Mat compute_key_point_mask(const cv::Size imageSize, const std::vector<cv::Point2f>& keypointContainer) const;
+                    const std::vector<cv::Point2f> detect_keypoints(const cv::Mat& grayImage, const std::vector<cv::Point2f>& trackedKeypoints, const uint maximumPointCount, const bool onlyInEmptyCells);
 
                 private:
-                    cv::Ptr<cv::FeatureDetector> _featureDetector;
-                    cv::Ptr<cv::FeatureDetector> _advancedFeatureDetector;
                     cv::Ptr<cv::DescriptorExtractor> _descriptorExtractor;
 
+                    // Base threshold of the FAST detector
+                    const uint _detectorThreshold;
+                    // Adaptive FAST threshold of each detection cell, updated after each detection
+                    std::vector<uint> _cellDetectorThresholds;
+
                     std::vector<cv::Mat> _lastFramePyramide;
 
                     double _meanPointExtractionTime;
+                    // Moving average of the keypoint detection duration, used to respect the frame time budget (seconds)
+                    double _detectionTimeEstimate;
 
             };
 
@@ -2,6 +2,9 @@
 
 #include "parameters.hpp"
 #include "logger.hpp"
+#include "depth_sampling.hpp"
+
+#include <limits>
 
 namespace rgbd_slam {
     namespace features {
@@ -17,34 +20,19 @@ namespace rgbd_slam {
                     pt.y < im.rows - BORDER_SIZE;
             } 
 
-            float get_depth_approximation(const cv::Mat& depthImage, const cv::Point2f& depthCoordinates)
-            {
-                if (is_in_border(depthCoordinates, depthImage)) 
-                {
-                    const float border = 2;
-                    const cv::Mat roi(depthImage(cv::Rect(depthCoordinates.x - border, depthCoordinates.y - border, border * 2, border * 2)));
-                    double min, max;
-                    cv::minMaxLoc(roi, &min, &max);
-                    return min;
-                }
-                return 0;
-            }
-
-
-            Keypoint_Handler::Keypoint_Handler(std::vector<cv::Point2f>& inKeypoints, cv::Mat& inDescriptors, const KeypointsWithIdStruct& lastKeypointsWithIds, const cv::Mat& depthImage, const double maxMatchDistance) :
-                _maxMatchDistance(maxMatchDistance)
+            Keypoint_Handler::Keypoint_Handler(std::vector<cv::Point2f>& inKeypoints, const descriptor_vector& inDescriptors, const KeypointsWithIdStruct& lastKeypointsWithIds, const cv::Mat& depthImage, const double maxMatchDistance) :
+                _maxMatchDistance(maxMatchDistance),
+                _depthImage(depthImage)
             {
                 if (_maxMatchDistance <= 0) {
                     utils::log_error("Maximum matching distance must be > 0");
                     exit(-1);
                 }
-                // knn matcher
-                _featuresMatcher = cv::Ptr<cv::BFMatcher>(new cv::BFMatcher(cv::NORM_HAMMING, false));
-
                 _descriptors = inDescriptors;
+                _imageWidth = depthImage.cols;
+                _imageHeight = depthImage.rows;
 
                 const float cellSize = static_cast<float>(Parameters::get_search_matches_cell_size());
-                _searchSpaceCellRadius = std::ceil(Parameters::get_search_matches_distance() / cellSize);
 
                 _cellCountX = std::ceil(depthImage.cols / cellSize);
                 _cellCountY = std::ceil(depthImage.rows / cellSize);
@@ -69,24 +57,31 @@ namespace rgbd_slam {
                     assert(searchSpaceIndex < _searchSpaceIndexContainer.size());
 
                     _searchSpaceIndexContainer[searchSpaceIndex].push_back(pointIndex);
-
-                    // Depths are in millimeters, will be 0 if coordinates are invalid
-                    _depths[pointIndex] = get_depth_approximation(depthImage, pt);
                 }
 
 
                 // Add optical flow keypoints then 
                 const size_t opticalPointSize = lastKeypointsWithIds._keypoints.size();
+
+                // Map slots are dense: size the slot table with the largest tracked slot
+                size_t slotCount = 0;
+                for (const size_t mapSlot : lastKeypointsWithIds._ids)
+                {
+                    if (mapSlot != INVALID_MAP_POINT_SLOT)
+                        slotCount = std::max(slotCount, mapSlot + 1);
+                }
+                _slotToKeypointIndex.assign(slotCount, INVALID_MATCH_INDEX);
+
                 for(size_t pointIndex = 0; pointIndex < opticalPointSize; ++pointIndex) {
                     const size_t newKeypointIndex = pointIndex + keypointIndexOffset;
 
-                    // fill in unique point index
-                    const size_t uniqueIndex = lastKeypointsWithIds._ids[pointIndex];
-                    if (uniqueIndex > 0) {
-                        _uniqueIdsToKeypointIndex[uniqueIndex] = newKeypointIndex;
+                    // fill in map slot index
+                    const size_t mapSlot = lastKeypointsWithIds._ids[pointIndex];
+                    if (mapSlot != INVALID_MAP_POINT_SLOT) {
+                        _slotToKeypointIndex[mapSlot] = static_cast<int>(newKeypointIndex);
                     }
                     else {
-                        utils::log_error("A keypoint detected by optical flow does nothave a valid keypoint id");
+                        utils::log_error("A keypoint detected by optical flow does nothave a valid map slot");
                     }
 
                     const cv::Point2f& pt = lastKeypointsWithIds._keypoints[pointIndex];;
@@ -101,10 +96,17 @@ namespace rgbd_slam {
 #endif
 
                     _keypoints[newKeypointIndex] = vectorKeypoint; 
-
-                    // Depths are in millimeters, will be 0 if coordinates are invalid
-                    _depths[newKeypointIndex] = get_depth_approximation(depthImage, pt);
                 }
+
+                // Depths are in millimeters, will be 0 if coordinates are invalid
+                const std::span<double> allDepths(_depths);
+                utils::get_depth_approximations(depthImage, inKeypoints, allDepths.first(keypointIndexOffset));
+                utils::get_depth_approximations(depthImage, lastKeypointsWithIds._keypoints, allDepths.subspan(keypointIndexOffset));
+            }
+
+            void Keypoint_Handler::get_depths(const std::vector<cv::Point2f>& points, std::span<double> depths) const
+            {
+                utils::get_depth_approximations(_depthImage, points, depths);
             }
 
 
@@ -128,114 +130,102 @@ namespace rgbd_slam {
                 return cellCoordinates;
             }
 
-            const cv::Mat Keypoint_Handler::compute_key_point_mask(const vector2& pointToSearch, const std::vector<bool>& isKeyPointMatchedContainer) const
+            int Keypoint_Handler::get_tracking_match_index(const size_t mapPointSlot) const
             {
-                const int_pair& searchSpaceCoordinates = get_search_space_coordinates(pointToSearch);
-
-                const uint startY = std::max(0, searchSpaceCoordinates.first - _searchSpaceCellRadius);
-                const uint startX = std::max(0, searchSpaceCoordinates.second - _searchSpaceCellRadius);
-
-                const uint endY = std::min(_cellCountY, searchSpaceCoordinates.first + _searchSpaceCellRadius + 1);
-                const uint endX = std::min(_cellCountX, searchSpaceCoordinates.second + _searchSpaceCellRadius + 1);
-
-                // Squared search diameter, to compare distance without sqrt
-                const float squaredSearchDiameter = pow(Parameters::get_search_matches_distance(), 2);
-
-                cv::Mat keyPointMask(cv::Mat::zeros(1, _descriptors.rows, CV_8UC1));
-                for (uint i = startY; i < endY; ++i)
-                {
-                    for (uint j = startX; j < endX; ++j)
-                    {
-                        const size_t searchSpaceIndex = get_search_space_index(j, i);
-                        assert(searchSpaceIndex < _searchSpaceIndexContainer.size());
-
-                        const index_container& keypointIndexContainer = _searchSpaceIndexContainer[searchSpaceIndex]; 
-                        for(const int keypointIndex : keypointIndexContainer)
-                        {
-                            if (not isKeyPointMatchedContainer[keypointIndex])
-                            {
-                                const vector2& keypoint = get_keypoint(keypointIndex);
-                                const double squarredDistance = 
-                                    pow(keypoint.x() - pointToSearch.x(), 2.0) + 
-                                    pow(keypoint.y() - pointToSearch.y(), 2.0);
-
-                                if (squarredDistance <= squaredSearchDiameter)
-                                    keyPointMask.at<uint8_t>(0, keypointIndex) = 1;
-                            }
-                        }
-                    }
-                }
-
-                return keyPointMask;
-            }
-
-            int Keypoint_Handler::get_tracking_match_index(const size_t mapPointId) const
-            {
-                if (_keypoints.empty())
-                    return INVALID_MATCH_INDEX;
-
-                // search if the keypoint id is in the detected points
-                if (mapPointId != INVALID_MAP_POINT_ID)
-                {
-                    // return the match if it's the case
-                    uintToUintContainer::const_iterator uniqueIndexIterator = _uniqueIdsToKeypointIndex.find(mapPointId);
-                    if (uniqueIndexIterator != _uniqueIdsToKeypointIndex.cend()) {
-                        return static_cast<int>(uniqueIndexIterator->second);
-                    }
-                }
+                // search if the map slot is in the tracked points: slots out of the table were not tracked
+                if (mapPointSlot < _slotToKeypointIndex.size())
+                    return _slotToKeypointIndex[mapPointSlot];
                 return INVALID_MATCH_INDEX;
             }
 
-            int Keypoint_Handler::get_tracking_match_index(const size_t mapPointId, const std::vector<bool>& isKeyPointMatchedContainer) const
+            int Keypoint_Handler::get_tracking_match_index(const size_t mapPointSlot, const std::vector<bool>& isKeyPointMatchedContainer) const
             {
                 assert(isKeyPointMatchedContainer.size() == _keypoints.size());
 
-                if (mapPointId != INVALID_MAP_POINT_ID) {
-                    const int trackingIndex = get_tracking_match_index(mapPointId);
+                if (mapPointSlot != INVALID_MAP_POINT_SLOT) {
+                    const int trackingIndex = get_tracking_match_index(mapPointSlot);
                     if (trackingIndex != INVALID_MATCH_INDEX)
                     {
                         if (!isKeyPointMatchedContainer[trackingIndex]) {
                             return trackingIndex;
                         }
                         else {
-                            // Somehow, this unique index is already associated with another keypoint
-                            utils::log_error("The requested point unique index is already matched");
+                            // Somehow, this map slot is already associated with another keypoint
+                            utils::log_error("The requested point map slot is already matched");
                         }
                     }
                 }
                 return INVALID_MATCH_INDEX;
             }
 
-            int Keypoint_Handler::get_match_index(const vector2& projectedMapPoint, const cv::Mat& mapPointDescriptor, const std::vector<bool>& isKeyPointMatchedContainer) const
+            int Keypoint_Handler::get_match_index(const vector2& projectedMapPoint, const Keypoint_Descriptor& mapPointDescriptor, const double searchRadius, const std::vector<bool>& isKeyPointMatchedContainer, uint& matchDistance, double& matchDistanceRatio) const
             {
+                assert(searchRadius > 0);
                 assert(isKeyPointMatchedContainer.size() == _keypoints.size());
                 // cannot compute matches without a match or descriptors
-                if (_keypoints.empty() or _descriptors.rows <= 0)
+                if (_keypoints.empty() or _descriptors.empty())
                     return INVALID_MATCH_INDEX;
 
-                // check descriptor dimensions
-                assert(mapPointDescriptor.cols == _descriptors.cols);
+                const int_pair& searchSpaceCoordinates = get_search_space_coordinates(projectedMapPoint);
+                const int searchSpaceCellRadius = static_cast<int>(std::ceil(searchRadius / Parameters::get_search_matches_cell_size()));
 
-                const cv::Mat& keyPointMask = compute_key_point_mask(projectedMapPoint, isKeyPointMatchedContainer);
+                const uint startY = std::max(0, searchSpaceCoordinates.first - searchSpaceCellRadius);
+                const uint startX = std::max(0, searchSpaceCoordinates.second - searchSpaceCellRadius);
 
-                std::vector< std::vector<cv::DMatch> > knnMatches;
-                _featuresMatcher->knnMatch(mapPointDescriptor, _descriptors, knnMatches, 2, keyPointMask);
+                const uint endY = std::min(_cellCountY, searchSpaceCoordinates.first + searchSpaceCellRadius + 1);
+                const uint endX = std::min(_cellCountX, searchSpaceCoordinates.second + searchSpaceCellRadius + 1);
 
-                assert(knnMatches.size() > 0);
-                const std::vector<cv::DMatch>& firstMatch = knnMatches[0];
+                // Squared search diameter, to compare distance without sqrt
+                const double squaredSearchDiameter = pow(searchRadius, 2);
+
+                // Find the two closest descriptors among the unmatched keypoints of the search area
+                int bestMatchIndex = INVALID_MATCH_INDEX;
+                uint bestMatchDistance = std::numeric_limits<uint>::max();
+                uint secondBestMatchDistance = std::numeric_limits<uint>::max();
+                for (uint i = startY; i < endY; ++i)
+                {
+                    for (uint j = startX; j < endX; ++j)
+                    {
+                        const size_t searchSpaceIndex = get_search_space_index(j, i);
+                        assert(searchSpaceIndex < _searchSpaceIndexContainer.size());
 
-                //check the farthest neighbors
-                if (firstMatch.size() > 1) {
-                    //check if point is a good match by checking it's distance to the second best matched point
-                    if (firstMatch[0].distance < _maxMatchDistance * firstMatch[1].distance) {
-                        int id = firstMatch[0].trainIdx;
-                        return id;   //this frame key point
+                        const index_container& keypointIndexContainer = _searchSpaceIndexContainer[searchSpaceIndex]; 
+                        for(const int keypointIndex : keypointIndexContainer)
+                        {
+                            if (isKeyPointMatchedContainer[keypointIndex] or not is_descriptor_computed(keypointIndex))
+                                continue;
+
+                            const vector2& keypoint = get_keypoint(keypointIndex);
+                            const double squarredDistance = 
+                                pow(keypoint.x() - projectedMapPoint.x(), 2.0) + 
+                                pow(keypoint.y() - projectedMapPoint.y(), 2.0);
+                            if (squarredDistance > squaredSearchDiameter)
+                                continue;
+
+                            const uint descriptorDistance = mapPointDescriptor.get_distance(_descriptors[keypointIndex]);
+                            if (descriptorDistance < bestMatchDistance)
+                            {
+                                secondBestMatchDistance = bestMatchDistance;
+                                bestMatchDistance = descriptorDistance;
+                                bestMatchIndex = keypointIndex;
+                            }
+                            else if (descriptorDistance < secondBestMatchDistance)
+                            {
+                                secondBestMatchDistance = descriptorDistance;
+                            }
+                        }
                     }
-                    return INVALID_MATCH_INDEX;
                 }
-                else if (firstMatch.size() == 1) {
-                    int id = firstMatch[0].trainIdx;
-                    return id;   //this frame key point
+
+                if (bestMatchIndex == INVALID_MATCH_INDEX)
+                    return INVALID_MATCH_INDEX;
+
+                //check if point is a good match by checking it's distance to the second best matched point
+                if (secondBestMatchDistance == std::numeric_limits<uint>::max() or bestMatchDistance < _maxMatchDistance * secondBestMatchDistance)
+                {
+                    matchDistance = bestMatchDistance;
+                    matchDistanceRatio = (secondBestMatchDistance == std::numeric_limits<uint>::max()) ? 0.0 : static_cast<double>(bestMatchDistance) / static_cast<double>(secondBestMatchDistance);
+                    return bestMatchIndex;   //this frame key point
                 }
                 return INVALID_MATCH_INDEX;
             }
@@ -3,16 +3,19 @@
 
 #include <list>
 #include <vector>
-#include <opencv2/xfeatures2d.hpp>
+#include <limits>
+#include <span>
+#include <opencv2/opencv.hpp>
 
 #include "types.hpp"
+#include "keypoint_descriptor.hpp"
 
 namespace rgbd_slam {
     namespace features {
         namespace keypoints {
 
             const float BORDER_SIZE = 1.; // Border of an image, in which points will be ignored
-            const size_t INVALID_MAP_POINT_ID = 0;  // should be the same as INVALID_POINT_UNIQ_ID in map_point.hpp
+            const size_t INVALID_MAP_POINT_SLOT = std::numeric_limits<size_t>::max();  // should be the same as INVALID_POINT_SLOT in map_point.hpp
             const int INVALID_MATCH_INDEX = -1;
 
             /**
@@ -21,16 +24,11 @@ namespace rgbd_slam {
             bool is_in_border(const cv::Point2f &pt, const cv::Mat &im);
 
             /**
-              * \brief Return the depth value in the depth image, or 0 if not depth info is found. This function approximates depth with the surrounding points to prevent invalid depth on edges
-              *
-              */
-            float get_depth_approximation(const cv::Mat& depthImage, const cv::Point2f& depthCoordinates);
-
-            /**
-             * \brief Stores a vector of keypoints, along with a vector of the unique ids associated with those keypoints in the local map
+             * \brief Stores a vector of keypoints, along with a vector of the map slots associated with those keypoints in the local map
              */
             struct KeypointsWithIdStruct {
                 std::vector<cv::Point2f> _keypoints;
+                // Dense slot index of the map point associated with each keypoint
                 std::vector<size_t> _ids;
             };
 
@@ -47,29 +45,33 @@ namespace rgbd_slam {
                      * \param[in] depthImage The depth image in which those keypoints were detected
                      * \param[in] maxMatchDistance Maximum distance to consider that a match of two points is valid
                      */
-                    Keypoint_Handler(std::vector<cv::Point2f>& inKeypoints, cv::Mat& inDescriptors, const KeypointsWithIdStruct& lastKeypointsWithIds, const cv::Mat& depthImage, const double maxMatchDistance = 0.7);
+                    Keypoint_Handler(std::vector<cv::Point2f>& inKeypoints, const descriptor_vector& inDescriptors, const KeypointsWithIdStruct& lastKeypointsWithIds, const cv::Mat& depthImage, const double maxMatchDistance = 0.7);
 
                     /**
                      * \brief Get a tracking index if it exist, or -1.
                      *
-                     * \param[in] mapPointId The unique id that we want to check
+                     * \param[in] mapPointSlot The map slot of the point that we want to check
                      * \param[in] isKeyPointMatchedContainer A vector of size _keypoints, use to flag is a keypoint is already matched 
                      *
                      * \return the index of the tracked point in _keypoints, or -1 if no match was found
                      */
-                    int get_tracking_match_index(const size_t mapPointId, const std::vector<bool>& isKeyPointMatchedContainer) const;
-                    int get_tracking_match_index(const size_t mapPointId) const;
+                    int get_tracking_match_index(const size_t mapPointSlot, const std::vector<bool>& isKeyPointMatchedContainer) const;
+                    int get_tracking_match_index(const size_t mapPointSlot) const;
 
                     /**
                      * \brief get an index corresponding to the index of the point matches.
                      *
                      * \param[in] projectedMapPoint A 2D map point to match 
                      * \param[in] mapPointDescriptor The descriptor of this map point
+                     * \param[in] searchRadius Radius around the projected map point in which the keypoints are candidates (pixels)
                      * \param[in] isKeyPointMatchedContainer A vector of size _keypoints, use to flag is a keypoint is already matched 
                      *
+                     * \param[out] matchDistance The descriptor distance of the returned match
+                     * \param[out] matchDistanceRatio The ratio between the descriptor distances of the returned match and of the second best candidate, or 0 if there is no other candidate. The lower, the more distinctive the match
+                     *
                      * \return An index >= 0 corresponding to the matched keypoint, or -1 if no match was found
                      */
-                    int get_match_index(const vector2& projectedMapPoint, const cv::Mat& mapPointDescriptor, const std::vector<bool>& isKeyPointMatchedContainer) const; 
+                    int get_match_index(const vector2& projectedMapPoint, const Keypoint_Descriptor& mapPointDescriptor, const double searchRadius, const std::vector<bool>& isKeyPointMatchedContainer, uint& matchDistance, double& matchDistanceRatio) const; 
 
                     /**
                      * \brief Return the depth associated with a certain keypoint
@@ -86,6 +88,14 @@ namespace rgbd_slam {
                         return _depths.size();
                     }
 
+                    /**
+                     * \brief Sample the depth image of these keypoints at any image points, with the same sampler as the keypoint depths
+                     *
+                     * \param[in] points The image points to sample
+                     * \param[out] depths The depth at each point, in millimeters. Will be 0 if the coordinates are invalid
+                     */
+                    void get_depths(const std::vector<cv::Point2f>& points, std::span<double> depths) const;
+
                     /**
                      * \brief return the keypoint associated with the index
                      */
@@ -97,14 +107,14 @@ namespace rgbd_slam {
 
                     bool is_descriptor_computed(const uint index) const
                     {
-                        return index < static_cast<uint>(_descriptors.rows);
+                        return index < _descriptors.size();
                     }
 
-                    const cv::Mat get_descriptor(const uint index) const
+                    const Keypoint_Descriptor& get_descriptor(const uint index) const
                     {
-                        assert(index < static_cast<uint>(_descriptors.rows));
+                        assert(index < _descriptors.size());
 
-                        return _descriptors.row(index);
+                        return _descriptors[index];
                     }
 
                     uint get_keypoint_count() const
@@ -112,17 +122,13 @@ namespace rgbd_slam {
                         return _keypoints.size();
                     }
 
-                protected:
-
                     /**
-                     * \brief Return a mask eliminating the keypoints to far from the point to match
-                     *
-                     * \param[in] pointToSearch The 2D screen coordinates of the point to match
-                     * \param[in] isKeyPointMatchedContainer A vector of size _keypoints, use to flag is a keypoint is already matched 
-                     *
-                     * \return A Mat the same size as our keypoint array, with 0 where the index is not a candidate, and 1 where it is
+                     * \brief return the size of the image in which the keypoints were detected
                      */
-                    const cv::Mat compute_key_point_mask(const vector2& pointToSearch, const std::vector<bool>& isKeyPointMatchedContainer) const;
+                    int get_image_width() const { return _imageWidth; };
+                    int get_image_height() const { return _imageHeight; };
+
+                protected:
 
                     typedef std::pair<int, int> int_pair;
                     /**
@@ -140,21 +146,23 @@ namespace rgbd_slam {
 
 
                 private:
-                    cv::Ptr<cv::DescriptorMatcher> _featuresMatcher;
-
                     const double _maxMatchDistance;
 
                     //store current frame keypoints
                     std::vector<vector2> _keypoints;
                     std::vector<double> _depths;
-                    typedef std::unordered_map<size_t, size_t> uintToUintContainer;
-                    uintToUintContainer _uniqueIdsToKeypointIndex;
-                    cv::Mat _descriptors;
+                    // Header on the depth image of the keypoints, shares its buffer
+                    cv::Mat _depthImage;
+                    // Index of the tracked keypoint of each map slot, or INVALID_MATCH_INDEX
+                    std::vector<int> _slotToKeypointIndex;
+                    descriptor_vector _descriptors;
+
+                    int _imageWidth;
+                    int _imageHeight;
 
                     // Number of image divisions (cells)
                     int _cellCountX;
                     int _cellCountY;
-                    int _searchSpaceCellRadius; 
 
                     // Corresponds to a 2D box containing index of key points in those boxes
                     typedef std::list<uint> index_container;
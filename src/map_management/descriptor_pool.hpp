@@ -0,0 +1,43 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_DESCRIPTOR_POOL_HPP
+#define RGBDSLAM_MAPMANAGEMENT_DESCRIPTOR_POOL_HPP
+
+#include <vector>
+#include <cassert>
+
+#include "keypoint_descriptor.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Contiguous storage of the map point descriptors, indexed by point slot. Descriptors are aligned on 32 bytes
+         */
+        class Descriptor_Pool
+        {
+            public:
+                /**
+                 * \brief Set the descriptor of a new point slot. Can grow the pool: must not be called while other threads read the pool
+                 */
+                void set(const size_t slot, const features::keypoints::Keypoint_Descriptor& descriptor)
+                {
+                    if (slot >= _descriptors.size())
+                        _descriptors.resize(slot + 1);
+                    _descriptors[slot] = descriptor;
+                }
+
+                /**
+                 * \brief Access the descriptor of an existing slot. Different slots can be modified concurrently
+                 */
+                features::keypoints::Keypoint_Descriptor& operator[](const size_t slot) { assert(slot < _descriptors.size()); return _descriptors[slot]; };
+                const features::keypoints::Keypoint_Descriptor& operator[](const size_t slot) const { assert(slot < _descriptors.size()); return _descriptors[slot]; };
+
+                void clear() { _descriptors.clear(); };
+
+            private:
+                std::vector<features::keypoints::Keypoint_Descriptor> _descriptors;
+        };
+
+    }
+}
+
+#endif
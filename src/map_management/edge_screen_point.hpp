@@ -0,0 +1,102 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_EDGE_SCREEN_POINT_HPP
+#define RGBDSLAM_MAPMANAGEMENT_EDGE_SCREEN_POINT_HPP
+
+#include "types.hpp"
+#include "parameters.hpp"
+
+#include <g2o/core/base_binary_edge.h>
+#include <g2o/types/sba/types_six_dof_expmap.h>
+#include <g2o/types/slam3d/vertex_pointxyz.h>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Retroprojection error of a world point observed from a keyframe, in screen space (u, v, depth).
+         * Vertex 0 is the world point, vertex 1 is the world to camera transformation of the keyframe
+         */
+        class Edge_Screen_Point
+            : public g2o::BaseBinaryEdge<3, vector3, g2o::VertexPointXYZ, g2o::VertexSE3Expmap>
+        {
+            public:
+                Edge_Screen_Point() :
+                    _focalX(Parameters::get_camera_1_focal_x()),
+                    _focalY(Parameters::get_camera_1_focal_y()),
+                    _centerX(Parameters::get_camera_1_center_x()),
+                    _centerY(Parameters::get_camera_1_center_y())
+                {}
+
+                bool read(std::istream&) override { return false; };
+                bool write(std::ostream&) const override { return false; };
+
+                void computeError() override
+                {
+                    const vector3& cameraPoint = get_camera_point();
+                    if (cameraPoint.z() <= 0)
+                    {
+                        // Point behind the camera: no usable error
+                        _error.setZero();
+                        return;
+                    }
+                    _error = _measurement - project(cameraPoint);
+                }
+
+                void linearizeOplus() override
+                {
+                    const vector3& cameraPoint = get_camera_point();
+                    if (cameraPoint.z() <= 0)
+                    {
+                        _jacobianOplusXi.setZero();
+                        _jacobianOplusXj.setZero();
+                        return;
+                    }
+
+                    // Derivative of the projection (u, v, depth) with respect to the camera point
+                    const double inverseDepth = 1.0 / cameraPoint.z();
+                    matrix33 projectionJacobian;
+                    projectionJacobian << _focalX * inverseDepth, 0, -_focalX * cameraPoint.x() * inverseDepth * inverseDepth,
+                                       0, _focalY * inverseDepth, -_focalY * cameraPoint.y() * inverseDepth * inverseDepth,
+                                       0, 0, 1;
+
+                    // The camera point moves by R * dX with a world point step
+                    const g2o::VertexSE3Expmap* pose = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+                    _jacobianOplusXi = -projectionJacobian * pose->estimate().rotation().toRotationMatrix();
+
+                    // The camera point moves by dr x cameraPoint + dt with a (rotation, translation) step on the left of the transformation
+                    matrix33 skewMatrix;
+                    skewMatrix <<                0, -cameraPoint.z(),  cameraPoint.y(),
+                                   cameraPoint.z(),                0, -cameraPoint.x(),
+                                  -cameraPoint.y(),  cameraPoint.x(),                0;
+                    _jacobianOplusXj.leftCols<3>() = projectionJacobian * skewMatrix;
+                    _jacobianOplusXj.rightCols<3>() = -projectionJacobian;
+                }
+
+                EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+            private:
+                vector3 get_camera_point() const
+                {
+                    const g2o::VertexPointXYZ* point = static_cast<const g2o::VertexPointXYZ*>(_vertices[0]);
+                    const g2o::VertexSE3Expmap* pose = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+                    return pose->estimate().map(point->estimate());
+                }
+
+                vector3 project(const vector3& cameraPoint) const
+                {
+                    return vector3(
+                            _focalX * cameraPoint.x() / cameraPoint.z() + _centerX,
+                            _focalY * cameraPoint.y() / cameraPoint.z() + _centerY,
+                            cameraPoint.z()
+                            );
+                }
+
+                const double _focalX;
+                const double _focalY;
+                const double _centerX;
+                const double _centerY;
+        };
+
+    }
+}
+
+#endif
@@ -0,0 +1,442 @@
+#include "global_map.hpp"
+
+#include "parameters.hpp"
+#include "logger.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        Global_Map::Global_Map(const uint tileSize) :
+            _directory(create_working_directory()),
+            _tileSize(tileSize),
+            _isDirectoryOwned(not _directory.empty()),
+            _isCameraTileValid(false),
+            _nextPageInFrame(std::numeric_limits<uint64_t>::max()),
+            _pointCount(0)
+        {
+            assert(_tileSize > 0);
+        }
+
+        Global_Map::Global_Map(const std::string& directory, const uint tileSize) :
+            _directory(directory),
+            _tileSize(tileSize),
+            _isDirectoryOwned(false),
+            _isCameraTileValid(false),
+            _nextPageInFrame(std::numeric_limits<uint64_t>::max()),
+            _pointCount(0)
+        {
+            assert(_tileSize > 0);
+
+            std::error_code error;
+            std::filesystem::create_directories(_directory, error);
+            if (error)
+            {
+                utils::log_error("Could not create the global map directory " + _directory + ": " + error.message());
+            }
+        }
+
+        Global_Map::~Global_Map()
+        {
+            if (not _isDirectoryOwned)
+            {
+                flush();
+                return;
+            }
+
+            // A working map is not kept between sessions
+            clear();
+            std::error_code error;
+            std::filesystem::remove(_directory, error);
+            if (error)
+            {
+                utils::log_error("Could not remove the global map directory " + _directory + ": " + error.message());
+            }
+        }
+
+        std::string Global_Map::create_working_directory()
+        {
+            std::error_code error;
+            const std::filesystem::path& temporaryDirectory = std::filesystem::temp_directory_path(error);
+            if (error)
+            {
+                utils::log_error("Could not find the temporary directory for the global map: " + error.message());
+                return std::string();
+            }
+
+            // mkdtemp replaces the X characters by a unique name
+            std::string directory = (temporaryDirectory / "rgbd_slam_global_map_XXXXXX").string();
+            if (mkdtemp(directory.data()) == nullptr)
+            {
+                utils::log_error("Could not create the global map directory " + directory + ": " + std::strerror(errno));
+                return std::string();
+            }
+            return directory;
+        }
+
+        Global_Map::tile_coordinates Global_Map::get_tile_coordinates(const vector3& position) const
+        {
+            return tile_coordinates {
+                static_cast<int>(std::floor(position.x() / _tileSize)),
+                static_cast<int>(std::floor(position.y() / _tileSize)),
+                static_cast<int>(std::floor(position.z() / _tileSize))
+            };
+        }
+
+        bool Global_Map::is_tile_in_view(const tile_coordinates& tile, const vector3& cameraPosition, const vector3& viewDirection, const double halfViewAngle) const
+        {
+            const vector3 tileCenter((tile[0] + 0.5) * _tileSize, (tile[1] + 0.5) * _tileSize, (tile[2] + 0.5) * _tileSize);
+            const vector3& cameraToTile = tileCenter - cameraPosition;
+            const double tileDistance = cameraToTile.norm();
+            const double tileRadius = 0.5 * sqrt(3.0) * _tileSize;
+            if (tileDistance <= tileRadius)
+                return true;
+
+            // Angle between the optical axis and the tile center, minus the angle covered by the tile
+            const double tileAngle = acos(std::clamp(cameraToTile.dot(viewDirection) / tileDistance, -1.0, 1.0));
+            return tileAngle - asin(tileRadius / tileDistance) <= halfViewAngle;
+        }
+
+        const std::string Global_Map::get_tile_path(const std::string& directory, const tile_coordinates& tile) const
+        {
+            return directory + "/tile_" + std::to_string(tile[0]) + "_" + std::to_string(tile[1]) + "_" + std::to_string(tile[2]) + GLOBAL_MAP_TILE_FILE_EXTENSION;
+        }
+
+        void Global_Map::add_point(const Map_Point& point, const features::keypoints::Keypoint_Descriptor& descriptor, const uint64_t pageInFrame)
+        {
+            // Value initialized, so the padding bytes written on disk are set
+            Global_Point_Record record {};
+            const matrix33& covariance = point.get_covariance_matrix();
+            for (int i = 0; i < 3; ++i)
+            {
+                record._coordinates[i] = point._coordinates[i];
+                for (int j = 0; j < 3; ++j)
+                    record._covariance[i * 3 + j] = covariance(i, j);
+            }
+            record._descriptor = descriptor;
+            record._id = point._id;
+            record._age = point.get_age();
+            record._pageInFrame = pageInFrame;
+            add_record(record);
+        }
+
+        void Global_Map::add_record(const Global_Point_Record& record)
+        {
+            const vector3 coordinates(record._coordinates[0], record._coordinates[1], record._coordinates[2]);
+            _pendingPoints[get_tile_coordinates(coordinates)].push_back(record);
+            ++_pointCount;
+        }
+
+        void Global_Map::add_primitive(const Primitive& primitive)
+        {
+            Global_Primitive_Record record {};
+            for (int i = 0; i < 4; ++i)
+                record._worldPlane[i] = primitive._worldPlane[i];
+            record._id = primitive._id;
+            record._isAxis = primitive._isAxis ? 1 : 0;
+            add_primitive(record);
+        }
+
+        void Global_Map::add_primitive(const Global_Primitive_Record& record)
+        {
+            const vector4 worldPlane(record._worldPlane[0], record._worldPlane[1], record._worldPlane[2], record._worldPlane[3]);
+            const bool isAxis = record._isAxis != 0;
+            for (Global_Primitive_Record& storedPrimitive : _primitives)
+            {
+                const vector4 storedWorldPlane(storedPrimitive._worldPlane[0], storedPrimitive._worldPlane[1], storedPrimitive._worldPlane[2], storedPrimitive._worldPlane[3]);
+                if ((storedPrimitive._isAxis != 0) == isAxis and Primitive::is_same_world_plane(worldPlane, storedWorldPlane, isAxis))
+                {
+                    // The latest observation of this plane replaces the stored one
+                    storedPrimitive = record;
+                    return;
+                }
+            }
+            _primitives.push_back(record);
+        }
+
+        bool Global_Map::take_primitive(const vector4& worldPlane, const bool isAxis, Global_Primitive_Record& record)
+        {
+            for (std::vector<Global_Primitive_Record>::iterator primitiveIterator = _primitives.begin(); primitiveIterator != _primitives.end(); ++primitiveIterator)
+            {
+                const vector4 storedWorldPlane(primitiveIterator->_worldPlane[0], primitiveIterator->_worldPlane[1], primitiveIterator->_worldPlane[2], primitiveIterator->_worldPlane[3]);
+                if ((primitiveIterator->_isAxis != 0) == isAxis and Primitive::is_same_world_plane(worldPlane, storedWorldPlane, isAxis))
+                {
+                    record = *primitiveIterator;
+                    _primitives.erase(primitiveIterator);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Global_Map::flush()
+        {
+            if (_directory.empty())
+            {
+                // The working directory could not be created: the points are lost
+                for (const auto& [tile, records] : _pendingPoints)
+                    _pointCount -= records.size();
+                _pendingPoints.clear();
+                return;
+            }
+
+            for (const auto& [tile, records] : _pendingPoints)
+            {
+                const std::string& tilePath = get_tile_path(_directory, tile);
+                std::ofstream tileFile(tilePath, std::ios_base::binary | std::ios_base::app);
+                if (not tileFile.is_open())
+                {
+                    utils::log_error("Could not open global map tile " + tilePath);
+                    _pointCount -= records.size();
+                    continue;
+                }
+                tileFile.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Global_Point_Record));
+                _storedTiles[tile]._isInWorkingDirectory = true;
+            }
+            _pendingPoints.clear();
+        }
+
+        size_t Global_Map::read_tile_file(const std::string& tilePath, std::vector<Global_Point_Record>& points)
+        {
+            const int fileDescriptor = open(tilePath.c_str(), O_RDONLY);
+            if (fileDescriptor < 0)
+            {
+                utils::log_error("Could not open global map tile " + tilePath);
+                return 0;
+            }
+
+            size_t recordCount = 0;
+            struct stat fileStatus;
+            if (fstat(fileDescriptor, &fileStatus) == 0 and fileStatus.st_size > 0)
+            {
+                const size_t fileSize = static_cast<size_t>(fileStatus.st_size);
+                void* mappedTile = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+                if (mappedTile != MAP_FAILED)
+                {
+                    recordCount = fileSize / sizeof(Global_Point_Record);
+                    const size_t firstRecord = points.size();
+                    points.resize(firstRecord + recordCount);
+                    std::memcpy(static_cast<void*>(points.data() + firstRecord), mappedTile, recordCount * sizeof(Global_Point_Record));
+                    munmap(mappedTile, fileSize);
+                }
+                else
+                {
+                    utils::log_error("Could not map global map tile " + tilePath);
+                }
+            }
+            close(fileDescriptor);
+            return recordCount;
+        }
+
+        void Global_Map::read_and_remove_tile(const tile_coordinates& tile, const Stored_Tile& storedTile, std::vector<Global_Point_Record>& points)
+        {
+            size_t recordCount = 0;
+            if (storedTile._isInSnapshot)
+            {
+                recordCount += read_tile_file(get_tile_path(_snapshotDirectory, tile), points);
+            }
+            if (storedTile._isInWorkingDirectory)
+            {
+                const std::string& tilePath = get_tile_path(_directory, tile);
+                recordCount += read_tile_file(tilePath, points);
+
+                // Those points are back in the local map
+                std::error_code error;
+                std::filesystem::remove(tilePath, error);
+            }
+
+            assert(_pointCount >= recordCount);
+            _pointCount -= std::min(_pointCount, recordCount);
+            _storedTiles.erase(tile);
+        }
+
+        void Global_Map::clear()
+        {
+            std::error_code error;
+            for (const auto& [tile, storedTile] : _storedTiles)
+            {
+                if (storedTile._isInWorkingDirectory)
+                    std::filesystem::remove(get_tile_path(_directory, tile), error);
+            }
+            _storedTiles.clear();
+            _pendingPoints.clear();
+            _primitives.clear();
+            _snapshotDirectory.clear();
+            _pointCount = 0;
+            _nextPageInFrame = std::numeric_limits<uint64_t>::max();
+            reset_camera_tile();
+        }
+
+        bool Global_Map::has_tile_files(const std::string& directory)
+        {
+            std::error_code error;
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+            {
+                if (entry.is_regular_file() and entry.path().extension() == GLOBAL_MAP_TILE_FILE_EXTENSION)
+                    return true;
+            }
+            return false;
+        }
+
+        bool Global_Map::remove_tile_files(const std::string& directory)
+        {
+            std::error_code error;
+            for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+            {
+                if (entry.is_regular_file() and entry.path().extension() == GLOBAL_MAP_TILE_FILE_EXTENSION)
+                {
+                    std::error_code removeError;
+                    std::filesystem::remove(entry.path(), removeError);
+                    if (removeError)
+                    {
+                        utils::log_error("Could not remove global map tile " + entry.path().string() + ": " + removeError.message());
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool Global_Map::load_snapshot_tiles(const std::string& snapshotDirectory)
+        {
+            std::error_code error;
+            std::filesystem::directory_iterator directoryIterator(snapshotDirectory, error);
+            if (error)
+            {
+                utils::log_error("Could not open the map snapshot directory " + snapshotDirectory + ": " + error.message());
+                return false;
+            }
+
+            _snapshotDirectory = snapshotDirectory;
+            for (const std::filesystem::directory_entry& entry : directoryIterator)
+            {
+                if (not entry.is_regular_file() or entry.path().extension() != GLOBAL_MAP_TILE_FILE_EXTENSION)
+                    continue;
+
+                tile_coordinates tile;
+                if (std::sscanf(entry.path().filename().c_str(), "tile_%d_%d_%d", &tile[0], &tile[1], &tile[2]) != 3)
+                {
+                    utils::log_error("Invalid map snapshot tile name " + entry.path().string());
+                    continue;
+                }
+                _storedTiles[tile]._isInSnapshot = true;
+                _pointCount += entry.file_size() / sizeof(Global_Point_Record);
+            }
+
+            // The camera may already be in a snapshot tile
+            reset_camera_tile();
+            return true;
+        }
+
+        void Global_Map::copy_tiles_to(Global_Map& other)
+        {
+            assert(&other != this);
+            flush();
+
+            std::vector<Global_Point_Record> points;
+            for (const auto& [tile, storedTile] : _storedTiles)
+            {
+                points.clear();
+                if (storedTile._isInSnapshot)
+                    read_tile_file(get_tile_path(_snapshotDirectory, tile), points);
+                if (storedTile._isInWorkingDirectory)
+                    read_tile_file(get_tile_path(_directory, tile), points);
+
+                // The page in frames are only valid in this session
+                for (Global_Point_Record& record : points)
+                    record._pageInFrame = 0;
+
+                // Points do not change tile between maps with the same tile size
+                assert(other._tileSize == _tileSize);
+                std::vector<Global_Point_Record>& otherPoints = other._pendingPoints[tile];
+                otherPoints.insert(otherPoints.end(), points.begin(), points.end());
+                other._pointCount += points.size();
+
+                // Write one tile at a time, to keep the memory use bounded
+                other.flush();
+            }
+
+            for (const Global_Primitive_Record& record : _primitives)
+                other.add_primitive(record);
+        }
+
+        bool Global_Map::page_in_points_around(const vector3& cameraPosition, const vector3& viewDirection, const double halfViewAngle, const uint64_t frameIndex, const size_t maximumPointCount, std::vector<Global_Point_Record>& points)
+        {
+            points.clear();
+
+            // Only check the tiles again when the camera changed tile, turned to look at other neighbor tiles, or when the points left on disk can be paged in
+            const tile_coordinates& cameraTile = get_tile_coordinates(cameraPosition);
+            if (_isCameraTileValid and cameraTile == _cameraTile and viewDirection.dot(_cameraViewDirection) >= cos(halfViewAngle) and frameIndex < _nextPageInFrame)
+                return false;
+            _cameraTile = cameraTile;
+            _cameraViewDirection = viewDirection;
+            _isCameraTileValid = true;
+            _nextPageInFrame = std::numeric_limits<uint64_t>::max();
+
+            if (maximumPointCount == 0)
+            {
+                // No budget: check again later, without reading the tiles
+                _nextPageInFrame = frameIndex + Parameters::get_global_map_page_in_delay();
+                return false;
+            }
+
+            flush();
+
+            // Load the camera tile and its neighbors in view: the other tiles stay on disk until the camera looks at them
+            for (int x = -1; x <= 1; ++x)
+            {
+                for (int y = -1; y <= 1; ++y)
+                {
+                    for (int z = -1; z <= 1; ++z)
+                    {
+                        const tile_coordinates tile {cameraTile[0] + x, cameraTile[1] + y, cameraTile[2] + z};
+                        const auto storedTileIterator = _storedTiles.find(tile);
+                        if (storedTileIterator != _storedTiles.end() and is_tile_in_view(tile, cameraPosition, viewDirection, halfViewAngle))
+                            read_and_remove_tile(tile, storedTileIterator->second, points);
+                    }
+                }
+            }
+
+            // The points that cannot be paged in yet go back to the global map
+            const auto firstWaitingPoint = std::partition(points.begin(), points.end(), [frameIndex](const Global_Point_Record& record) { return record._pageInFrame <= frameIndex; });
+            for (auto recordIterator = firstWaitingPoint; recordIterator != points.end(); ++recordIterator)
+            {
+                _nextPageInFrame = std::min(_nextPageInFrame, recordIterator->_pageInFrame);
+                add_record(*recordIterator);
+            }
+            points.erase(firstWaitingPoint, points.end());
+
+            // Keep the points closest to the camera in the budget: the others go back to the global map, and are checked again later
+            if (points.size() > maximumPointCount)
+            {
+                const auto get_distance = [&cameraPosition](const Global_Point_Record& record) {
+                    return (vector3(record._coordinates[0], record._coordinates[1], record._coordinates[2]) - cameraPosition).squaredNorm();
+                };
+                std::nth_element(points.begin(), points.begin() + maximumPointCount, points.end(), [&get_distance](const Global_Point_Record& record, const Global_Point_Record& other) {
+                        return get_distance(record) < get_distance(other);
+                        });
+                for (auto recordIterator = points.begin() + maximumPointCount; recordIterator != points.end(); ++recordIterator)
+                    add_record(*recordIterator);
+                points.resize(maximumPointCount);
+                _nextPageInFrame = std::min<uint64_t>(_nextPageInFrame, frameIndex + Parameters::get_global_map_page_in_delay());
+            }
+            return not points.empty();
+        }
+
+    }
+}
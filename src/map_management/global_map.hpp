@@ -0,0 +1,251 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_GLOBAL_MAP_HPP
+#define RGBDSLAM_MAPMANAGEMENT_GLOBAL_MAP_HPP
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+#include "types.hpp"
+#include "map_point.hpp"
+#include "map_primitive.hpp"
+#include "keypoint_descriptor.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        const std::string GLOBAL_MAP_TILE_FILE_EXTENSION = ".tile";
+
+        /**
+         * \brief Binary record of a point stored in the global map tiles
+         */
+        struct Global_Point_Record
+        {
+            double _coordinates[3];
+            double _covariance[9];
+            features::keypoints::Keypoint_Descriptor _descriptor;
+            uint64_t _id;
+            // Successful matches count, so a paged in point keeps its confidence
+            int32_t _age;
+            // Frame index from which this point can be paged in again. Always 0 in the snapshots
+            uint64_t _pageInFrame;
+        };
+        static_assert(std::is_trivially_copyable_v<Global_Point_Record>, "Global point records are copied to and from the disk as raw bytes");
+
+        /**
+         * \brief Record of a primitive stored in the global map
+         */
+        struct Global_Primitive_Record
+        {
+            // Parameters (normal, d) in world space
+            double _worldPlane[4];
+            uint64_t _id;
+            // Nonzero if this primitive only constrains an orientation (cylinder axis)
+            uint32_t _isAxis;
+        };
+        static_assert(std::is_trivially_copyable_v<Global_Primitive_Record>, "Global primitive records are copied to and from the disk as raw bytes");
+
+        /**
+         * \brief Store the points that left the local map on disk, in spatially tiled files. The tiles around the camera are paged back in when it returns to a known area, so the memory use does not depend on the session length
+         */
+        class Global_Map
+        {
+            public:
+                /**
+                 * \brief Create a working global map, in a new directory of the temporary directory. This directory and its tiles are removed with the map
+                 *
+                 * \param[in] tileSize Size of the tile edges, in millimeters. An integer, so maps and snapshots compare their tile sizes exactly
+                 */
+                explicit Global_Map(const uint tileSize);
+
+                /**
+                 * \brief Create a global map that writes its tiles in a given directory, and keeps them on disk. No file of this directory is removed, except the tiles written by this map when it is cleared
+                 *
+                 * \param[in] directory The directory where the tile files are stored. It is created if needed
+                 * \param[in] tileSize Size of the tile edges, in millimeters
+                 */
+                Global_Map(const std::string& directory, const uint tileSize);
+                ~Global_Map();
+
+                /**
+                 * \brief Add a point to the global map. It is written on disk on the next flush
+                 *
+                 * \param[in] point The point to add
+                 * \param[in] descriptor The descriptor of this point
+                 * \param[in] pageInFrame The frame index from which this point can be paged in again
+                 */
+                void add_point(const Map_Point& point, const features::keypoints::Keypoint_Descriptor& descriptor, const uint64_t pageInFrame = 0);
+
+                /**
+                 * \brief Keep a primitive that left the local map. A stored primitive with the same world plane is replaced, so each plane of the scene is stored once.
+                 * Primitives are few and stay in memory
+                 */
+                void add_primitive(const Primitive& primitive);
+
+                /**
+                 * \brief Keep a primitive record, like a primitive that left the local map
+                 */
+                void add_primitive(const Global_Primitive_Record& record);
+
+                /**
+                 * \brief Find a stored primitive with the same world plane as a new primitive, and remove it from the global map
+                 *
+                 * \param[in] worldPlane The parameters (normal, d) of the new primitive in world space
+                 * \param[in] isAxis True if the new primitive only constrains an orientation
+                 * \param[out] record The stored primitive
+                 *
+                 * \return True if a stored primitive was found
+                 */
+                bool take_primitive(const vector4& worldPlane, const bool isAxis, Global_Primitive_Record& record);
+
+                /**
+                 * \brief Write the pending points to their tiles
+                 */
+                void flush();
+
+                /**
+                 * \brief When the camera enters a new tile or turns, or when the points left on disk by the last call can be paged in, load the points of its tile and of the neighbor tiles in the view cone of the camera.
+                 * Only the points closest to the camera that fit in the point budget are paged in, and the points waiting for their page in frame stay in the global map
+                 *
+                 * \param[in] cameraPosition Position of the camera, in world coordinates
+                 * \param[in] viewDirection Unit vector of the optical axis of the camera, in world coordinates
+                 * \param[in] halfViewAngle Angle between the optical axis and the border of the view cone, in radians
+                 * \param[in] frameIndex Index of the current frame
+                 * \param[in] maximumPointCount Maximum number of points to page in
+                 * \param[out] points The paged in points. They are not in the global map anymore
+                 *
+                 * \return True if some points were paged in
+                 */
+                bool page_in_points_around(const vector3& cameraPosition, const vector3& viewDirection, const double halfViewAngle, const uint64_t frameIndex, const size_t maximumPointCount, std::vector<Global_Point_Record>& points);
+
+                /**
+                 * \brief Remove all the points and primitives: the pending points, the tile files written by this map, and the snapshot tiles in use. The snapshot files are left untouched
+                 */
+                void clear();
+
+                /**
+                 * \return True if the directory contains global map tile files
+                 */
+                static bool has_tile_files(const std::string& directory);
+
+                /**
+                 * \brief Remove the global map tile files of a directory. Other files are left untouched
+                 *
+                 * \return True if no tile file is left
+                 */
+                static bool remove_tile_files(const std::string& directory);
+
+                /**
+                 * \brief Use the tiles of a map snapshot as a read only source of points. They are paged in like the other tiles, and the snapshot files are never modified
+                 *
+                 * \param[in] snapshotDirectory The directory of the snapshot tiles
+                 *
+                 * \return True if the snapshot tiles were found
+                 */
+                bool load_snapshot_tiles(const std::string& snapshotDirectory);
+
+                /**
+                 * \brief Append all the points of this global map to the tiles of another global map, one tile at a time, and add its primitives to the other global map
+                 */
+                void copy_tiles_to(Global_Map& other);
+
+                /**
+                 * \brief Forget the camera tile, so the next call to page_in_points_around loads the tiles in view
+                 */
+                void reset_camera_tile() { _isCameraTileValid = false; };
+
+                const std::string& get_directory() const { return _directory; };
+                const std::string& get_snapshot_directory() const { return _snapshotDirectory; };
+                uint get_tile_size() const { return _tileSize; };
+
+                /**
+                 * \return The number of points stored in the global map
+                 */
+                size_t get_point_count() const { return _pointCount; };
+
+                /**
+                 * \return The number of primitives stored in the global map
+                 */
+                size_t get_primitive_count() const { return _primitives.size(); };
+
+                const std::vector<Global_Primitive_Record>& get_primitives() const { return _primitives; };
+
+            private:
+                typedef std::array<int, 3> tile_coordinates;
+
+                /**
+                 * \brief Location of the files of a tile
+                 */
+                struct Stored_Tile
+                {
+                    bool _isInWorkingDirectory = false;
+                    bool _isInSnapshot = false;
+                };
+
+                /**
+                 * \brief Create a directory with a unique name in the temporary directory
+                 *
+                 * \return The path of the new directory, or an empty string on failure
+                 */
+                static std::string create_working_directory();
+
+                /**
+                 * \brief Add a point record to the points waiting to be written
+                 */
+                void add_record(const Global_Point_Record& record);
+
+                tile_coordinates get_tile_coordinates(const vector3& position) const;
+
+                /**
+                 * \return True if a part of the tile can be in the view cone of the camera, approximating the tile by its bounding sphere
+                 */
+                bool is_tile_in_view(const tile_coordinates& tile, const vector3& cameraPosition, const vector3& viewDirection, const double halfViewAngle) const;
+
+                const std::string get_tile_path(const std::string& directory, const tile_coordinates& tile) const;
+
+                /**
+                 * \brief Read a tile file through a memory mapping, and append its points to the given container
+                 *
+                 * \return The number of points read
+                 */
+                static size_t read_tile_file(const std::string& tilePath, std::vector<Global_Point_Record>& points);
+
+                /**
+                 * \brief Read all the files of a tile, and remove this tile from the global map. Snapshot files are left untouched
+                 */
+                void read_and_remove_tile(const tile_coordinates& tile, const Stored_Tile& storedTile, std::vector<Global_Point_Record>& points);
+
+                const std::string _directory;
+                const uint _tileSize;
+                // The working directory was created by this map, and is removed with it
+                const bool _isDirectoryOwned;
+
+                // Directory of the read only snapshot tiles, or empty
+                std::string _snapshotDirectory;
+
+                // Tiles with a file on disk
+                std::map<tile_coordinates, Stored_Tile> _storedTiles;
+                // Points waiting to be written, by tile
+                std::map<tile_coordinates, std::vector<Global_Point_Record>> _pendingPoints;
+                // Primitives that left the local map
+                std::vector<Global_Primitive_Record> _primitives;
+                // Tile and view direction of the camera in the last call to page_in_points_around that checked the tiles
+                tile_coordinates _cameraTile;
+                vector3 _cameraViewDirection;
+                bool _isCameraTileValid;
+                // Frame from which the points left on disk by the last tile check can be paged in
+                uint64_t _nextPageInFrame;
+
+                size_t _pointCount;
+
+                // Remove copy operators
+                Global_Map(const Global_Map& map) = delete;
+                void operator=(const Global_Map& map) = delete;
+        };
+
+    }
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_KEYFRAME_HPP
+#define RGBDSLAM_MAPMANAGEMENT_KEYFRAME_HPP
+
+#include "types.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        const size_t INVALID_KEYFRAME_ID = std::numeric_limits<size_t>::max(); // Id of a map point not anchored to a keyframe
+
+        /**
+         * \brief Observation of a point from a keyframe, used by the local bundle adjustment
+         */
+        struct Keyframe_Observation
+        {
+            // Unique id of the observed point
+            size_t _pointId;
+            // Screen coordinates of the observation (u, v, depth), with a null depth for 2D observations
+            vector3 _screenCoordinates;
+        };
+
+        /**
+         * \brief A frame selected to anchor the local map points. The local map keeps the points of a window of keyframes
+         */
+        struct Keyframe
+        {
+            Keyframe(const size_t id, const vector3& position, const quaternion& orientation) :
+                _id(id),
+                _position(position),
+                _orientation(orientation),
+                _anchoredPointCount(0),
+                _matchedPointCount(0)
+            {};
+
+            size_t _id;
+
+            // Pose of the camera when this keyframe was created
+            vector3 _position;
+            quaternion _orientation;
+
+            // Number of local map points anchored to this keyframe, and how many of them were matched in the last frame
+            size_t _anchoredPointCount;
+            size_t _matchedPointCount;
+
+            // Points matched when this keyframe was created
+            std::vector<Keyframe_Observation> _observations;
+
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        };
+
+    }
+}
+
+#endif
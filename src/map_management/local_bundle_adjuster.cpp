@@ -0,0 +1,205 @@
+#include "local_bundle_adjuster.hpp"
+
+#include "edge_screen_point.hpp"
+#include "parameters.hpp"
+#include "camera_transformation.hpp"
+#include "covariances.hpp"
+#include "logger.hpp"
+
+#include <cmath>
+#include <memory>
+
+#include <g2o/core/block_solver.h>
+#include <g2o/core/optimization_algorithm_levenberg.h>
+#include <g2o/core/robust_kernel_impl.h>
+#include <g2o/core/sparse_optimizer.h>
+#include <g2o/solvers/pcg/linear_solver_pcg.h>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * LOCAL BUNDLE ADJUSTER MEMBERS
+         */
+
+        Local_Bundle_Adjuster::Local_Bundle_Adjuster() :
+            _hasProblem(false),
+            _isAdjusting(false),
+            _hasResult(false),
+            _shouldStop(false),
+            _generation(0),
+            _thread(&Local_Bundle_Adjuster::run, this)
+        {
+        }
+
+        Local_Bundle_Adjuster::~Local_Bundle_Adjuster()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _shouldStop = true;
+            }
+            _condition.notify_one();
+            _thread.join();
+        }
+
+        bool Local_Bundle_Adjuster::request_adjustment(Bundle_Adjustment_Problem& problem)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_hasProblem or _isAdjusting or _hasResult)
+                    return false;
+
+                _problem = std::move(problem);
+                _hasProblem = true;
+            }
+            _condition.notify_one();
+            return true;
+        }
+
+        bool Local_Bundle_Adjuster::get_adjustment_result(Bundle_Adjustment_Result& result)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (not _hasResult)
+                return false;
+
+            result = std::move(_result);
+            _hasResult = false;
+            return true;
+        }
+
+        void Local_Bundle_Adjuster::cancel()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _hasProblem = false;
+            _hasResult = false;
+            ++_generation;
+        }
+
+        void Local_Bundle_Adjuster::run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _condition.wait(lock, [this]() { return _shouldStop or _hasProblem; });
+                if (_shouldStop)
+                    return;
+
+                const Bundle_Adjustment_Problem problem = std::move(_problem);
+                const size_t generation = _generation;
+                _hasProblem = false;
+                _isAdjusting = true;
+
+                // Adjust without holding the lock, so the tracking thread never waits for it
+                lock.unlock();
+                Bundle_Adjustment_Result result;
+                const bool isAdjusted = adjust(problem, result);
+                lock.lock();
+
+                _isAdjusting = false;
+                if (isAdjusted and generation == _generation)
+                {
+                    _result = std::move(result);
+                    _hasResult = true;
+                }
+            }
+        }
+
+        bool Local_Bundle_Adjuster::adjust(const Bundle_Adjustment_Problem& problem, Bundle_Adjustment_Result& result)
+        {
+            const size_t keyframeCount = problem._keyframes.size();
+            if (keyframeCount < 2 or problem._points.empty())
+                return false;
+
+            // Sparse Levenberg-Marquardt, with a Schur complement on the points and a preconditioned conjugate gradient on the keyframes
+            typedef g2o::BlockSolver_6_3 Block_Solver;
+            g2o::SparseOptimizer optimizer;
+            optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(
+                        std::make_unique<Block_Solver>(std::make_unique<g2o::LinearSolverPCG<Block_Solver::PoseMatrixType>>())
+                        ));
+
+            // Keyframes, as world to camera transformations
+            for (size_t keyframeIndex = 0; keyframeIndex < keyframeCount; ++keyframeIndex)
+            {
+                const Bundle_Adjustment_Problem::Keyframe_Pose& keyframe = problem._keyframes[keyframeIndex];
+                const quaternion& worldToCameraRotation = keyframe._orientation.conjugate();
+
+                g2o::VertexSE3Expmap* keyframeVertex = new g2o::VertexSE3Expmap();
+                keyframeVertex->setId(static_cast<int>(keyframeIndex));
+                keyframeVertex->setEstimate(g2o::SE3Quat(worldToCameraRotation, -(worldToCameraRotation * keyframe._position)));
+                keyframeVertex->setFixed(keyframeIndex == 0);
+                optimizer.addVertex(keyframeVertex);
+            }
+
+            // Points, marginalized by the Schur complement
+            for (size_t pointIndex = 0; pointIndex < problem._points.size(); ++pointIndex)
+            {
+                g2o::VertexPointXYZ* pointVertex = new g2o::VertexPointXYZ();
+                pointVertex->setId(static_cast<int>(keyframeCount + pointIndex));
+                pointVertex->setEstimate(problem._points[pointIndex]._coordinates);
+                pointVertex->setMarginalized(true);
+                optimizer.addVertex(pointVertex);
+            }
+
+            // Retroprojection errors in pixels and millimeters, weighted by the keypoint and depth sensor noises in the same units.
+            // 95% of the inlier errors are under the chi2 value of 3 degrees of freedom, or 2 without depth
+            const double pixelInformation = 1.0 / pow(Parameters::get_bundle_adjustment_pixel_standard_deviation(), 2.0);
+            const double huberDelta = sqrt(7.815);
+            const double huberDeltaWithoutDepth = sqrt(5.991);
+            for (const Bundle_Adjustment_Problem::Observation& observation : problem._observations)
+            {
+                const vector3& screenCoordinates = observation._screenCoordinates;
+                const bool hasDepth = utils::is_depth_valid(screenCoordinates.z());
+                // 2D observation: the depth error is ignored
+                const double depthInformation = hasDepth ? 1.0 / pow(utils::get_depth_standard_deviation(screenCoordinates.z()), 2.0) : 0.0;
+                const matrix33 information = vector3(pixelInformation, pixelInformation, depthInformation).asDiagonal();
+
+                Edge_Screen_Point* edge = new Edge_Screen_Point();
+                edge->setVertex(0, optimizer.vertex(static_cast<int>(keyframeCount + observation._pointIndex)));
+                edge->setVertex(1, optimizer.vertex(static_cast<int>(observation._keyframeIndex)));
+                edge->setMeasurement(screenCoordinates);
+                edge->setInformation(information);
+
+                g2o::RobustKernelHuber* robustKernel = new g2o::RobustKernelHuber();
+                robustKernel->setDelta(hasDepth ? huberDelta : huberDeltaWithoutDepth);
+                edge->setRobustKernel(robustKernel);
+                optimizer.addEdge(edge);
+            }
+
+            optimizer.initializeOptimization();
+            if (optimizer.optimize(static_cast<int>(Parameters::get_bundle_adjustment_maximum_iterations())) <= 0)
+            {
+                utils::log("Local bundle adjustment failed to converge");
+                return false;
+            }
+
+            result._keyframes.clear();
+            result._keyframes.reserve(keyframeCount);
+            for (size_t keyframeIndex = 0; keyframeIndex < keyframeCount; ++keyframeIndex)
+            {
+                const g2o::VertexSE3Expmap* keyframeVertex = static_cast<const g2o::VertexSE3Expmap*>(optimizer.vertex(static_cast<int>(keyframeIndex)));
+                const g2o::SE3Quat& worldToCamera = keyframeVertex->estimate();
+
+                Bundle_Adjustment_Problem::Keyframe_Pose keyframe;
+                keyframe._id = problem._keyframes[keyframeIndex]._id;
+                keyframe._orientation = worldToCamera.rotation().conjugate();
+                keyframe._position = -(keyframe._orientation * worldToCamera.translation());
+                if (keyframe._position.allFinite() and keyframe._orientation.coeffs().allFinite())
+                    result._keyframes.push_back(keyframe);
+            }
+
+            result._points.clear();
+            result._points.reserve(problem._points.size());
+            for (size_t pointIndex = 0; pointIndex < problem._points.size(); ++pointIndex)
+            {
+                const Bundle_Adjustment_Problem::Point& point = problem._points[pointIndex];
+                const g2o::VertexPointXYZ* pointVertex = static_cast<const g2o::VertexPointXYZ*>(optimizer.vertex(static_cast<int>(keyframeCount + pointIndex)));
+
+                const vector3& correction = pointVertex->estimate() - point._coordinates;
+                if (correction.allFinite())
+                    result._points.push_back({point._id, point._slot, correction});
+            }
+            return true;
+        }
+
+    }
+}
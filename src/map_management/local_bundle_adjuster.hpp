@@ -0,0 +1,148 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_LOCAL_BUNDLE_ADJUSTER_HPP
+#define RGBDSLAM_MAPMANAGEMENT_LOCAL_BUNDLE_ADJUSTER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Copy of the keyframes and points of the local map, optimized by the local bundle adjustment
+         */
+        struct Bundle_Adjustment_Problem
+        {
+            struct Keyframe_Pose
+            {
+                size_t _id;
+                vector3 _position;
+                quaternion _orientation;
+
+                EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            };
+
+            struct Point
+            {
+                size_t _id;
+                // Slot of the point in the local map when the problem was created
+                size_t _slot;
+                vector3 _coordinates;
+            };
+
+            struct Observation
+            {
+                // Indexes of the keyframe and of the point in this problem
+                size_t _keyframeIndex;
+                size_t _pointIndex;
+                // Screen coordinates of the observation (u, v, depth), with a null depth for 2D observations
+                vector3 _screenCoordinates;
+            };
+
+            // The first keyframe is fixed, to anchor the solution in the world
+            std::vector<Keyframe_Pose, Eigen::aligned_allocator<Keyframe_Pose>> _keyframes;
+            std::vector<Point> _points;
+            std::vector<Observation> _observations;
+        };
+
+        /**
+         * \brief Keyframes and points adjusted by the local bundle adjustment
+         */
+        struct Bundle_Adjustment_Result
+        {
+            struct Point
+            {
+                size_t _id;
+                size_t _slot;
+                // Correction of the point coordinates: the map can update the point while it is adjusted, so only the correction is merged
+                vector3 _correction;
+            };
+
+            std::vector<Bundle_Adjustment_Problem::Keyframe_Pose, Eigen::aligned_allocator<Bundle_Adjustment_Problem::Keyframe_Pose>> _keyframes;
+            std::vector<Point> _points;
+        };
+
+        /**
+         * \brief Run the local bundle adjustments on a background thread, so they never block the tracking.
+         * The local map posts a problem when it creates a keyframe, and merges the result when it is ready. At most one problem is adjusted at a time: the problems posted while the thread is busy are dropped
+         */
+        class Local_Bundle_Adjuster
+        {
+            public:
+                /**
+                 * \brief Start the adjustment thread
+                 */
+                Local_Bundle_Adjuster();
+
+                /**
+                 * \brief Stop the adjustment thread. A running adjustment is finished first
+                 */
+                ~Local_Bundle_Adjuster();
+
+                /**
+                 * \brief Post a problem to the adjustment thread, without blocking
+                 *
+                 * \param[in, out] problem The problem to adjust. It is moved to the adjustment thread if the function returned true
+                 *
+                 * \return False if the thread is busy with another problem, or if a result is waiting to be merged
+                 */
+                bool request_adjustment(Bundle_Adjustment_Problem& problem);
+
+                /**
+                 * \brief Take the result of the last adjustment, without blocking
+                 *
+                 * \param[out] result The adjusted keyframes and points, if the function returned true
+                 *
+                 * \return True if a new result was available
+                 */
+                bool get_adjustment_result(Bundle_Adjustment_Result& result);
+
+                /**
+                 * \brief Drop the pending problem and result, and the result of the running adjustment. Used when the local map is reset
+                 */
+                void cancel();
+
+                /**
+                 * \brief Adjust the keyframe poses and point coordinates of a problem, by minimizing their retroprojection errors with g2o
+                 *
+                 * \param[in] problem The keyframes, points and observations to adjust
+                 * \param[out] result The adjusted keyframes and the point corrections, if the function returned true
+                 *
+                 * \return True if the adjustment succeeded
+                 */
+                static bool adjust(const Bundle_Adjustment_Problem& problem, Bundle_Adjustment_Result& result);
+
+            private:
+                /**
+                 * \brief Main loop of the adjustment thread
+                 */
+                void run();
+
+                std::mutex _mutex;
+                std::condition_variable _condition;
+
+                // State shared with the adjustment thread, guarded by _mutex
+                Bundle_Adjustment_Problem _problem;
+                Bundle_Adjustment_Result _result;
+                bool _hasProblem;
+                bool _isAdjusting;
+                bool _hasResult;
+                bool _shouldStop;
+                // Incremented by cancel, so the result of a cancelled adjustment is dropped
+                size_t _generation;
+
+                // Started last, once the shared state is initialized
+                std::thread _thread;
+
+                // Remove copy operators
+                Local_Bundle_Adjuster(const Local_Bundle_Adjuster&) = delete;
+                void operator=(const Local_Bundle_Adjuster&) = delete;
+        };
+
+    }
+}
+
+#endif
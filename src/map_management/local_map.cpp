@@ -1,11 +1,19 @@
 #include "local_map.hpp"
 
+#include "map_snapshot.hpp"
 #include "parameters.hpp"
 #include "triangulation.hpp"
 #include "camera_transformation.hpp"
 #include "covariances.hpp"
 #include "logger.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
 namespace rgbd_slam {
     namespace map_management {
 
@@ -14,35 +22,146 @@ namespace rgbd_slam {
          */
 
         /**
-         * \brief My add a point to the tracked feature object, used to add optical flow tracking
+         * \brief Compute the radius of the area in which a map point is searched in the image, from the uncertainty of its projection
          */
-        void add_point_to_tracked_features(const IMap_Point_With_Tracking& mapPoint, features::keypoints::KeypointsWithIdStruct& keypointsWithIds)
+        double get_search_radius(const IMap_Point_With_Tracking& mapPoint, const utils::Pose& currentPose)
         {
-            const vector3& coordinates = mapPoint._coordinates;
-            assert(not std::isnan(coordinates.x()) and not std::isnan(coordinates.y()) and not std::isnan(coordinates.z()));
-            if (mapPoint._matchedScreenPoint.is_matched())
-            {
-                // use previously known screen coordinates
-                keypointsWithIds._keypoints.push_back(cv::Point2f(mapPoint._matchedScreenPoint._screenCoordinates.x(), mapPoint._matchedScreenPoint._screenCoordinates.y()));
-                keypointsWithIds._ids.push_back(mapPoint._id);
-            }
+            // Search in a 3 sigmas area
+            const double searchAreaSigmas = 3.0;
+
+            const matrix22& projectedCovariance = utils::get_projected_point_covariance(mapPoint._coordinates, mapPoint.get_covariance_matrix(), currentPose);
+            // Largest eigen value of the symmetric projected covariance
+            const double halfTrace = (projectedCovariance(0, 0) + projectedCovariance(1, 1)) / 2.0;
+            const double halfDifference = (projectedCovariance(0, 0) - projectedCovariance(1, 1)) / 2.0;
+            const double maximumVariance = halfTrace + sqrt(halfDifference * halfDifference + projectedCovariance(0, 1) * projectedCovariance(1, 0));
+
+            return std::clamp(searchAreaSigmas * sqrt(std::max(0.0, maximumVariance)), Parameters::get_search_matches_minimum_distance(), Parameters::get_search_matches_distance());
+        }
+
+        /**
+         * \brief Maximum number of local map and staged points in the memory budget: a point, its descriptor, and its entries in the slot tables
+         */
+        size_t get_memory_budget_point_count()
+        {
+            const size_t bytesPerPoint = sizeof(Map_Point) + sizeof(features::keypoints::Keypoint_Descriptor) + 4 * sizeof(size_t);
+            return Parameters::get_local_map_memory_budget() / bytesPerPoint;
+        }
+
+        /**
+         * \brief Maximum number of local map points, in the count and memory budgets
+         */
+        size_t get_maximum_map_point_count()
+        {
+            return std::min<size_t>(Parameters::get_maximum_local_map_point_count(), get_memory_budget_point_count());
+        }
+
+        /**
+         * \brief Check if a map point is hidden behind the surface measured at its projection, with a 3 sigmas margin on the point and measured depths
+         *
+         * \param[in] measuredDepth The depth sampled at the projection of the point, in millimeters
+         */
+        bool is_occluded(const IMap_Point_With_Tracking& mapPoint, const matrix44& worldToCameraMatrix, const double measuredDepth)
+        {
+            // No measure: the point may be visible
+            if (not utils::is_depth_valid(measuredDepth))
+                return false;
+
+            const double occlusionSigmas = 3.0;
+
+            const vector3& opticalAxis = worldToCameraMatrix.block<1, 3>(2, 0).transpose();
+            const double pointDepth = opticalAxis.dot(mapPoint._coordinates) + worldToCameraMatrix(2, 3);
+            const double pointDepthVariance = opticalAxis.dot(mapPoint.get_covariance_matrix() * opticalAxis);
+            const double measuredDepthStandardDeviation = utils::get_depth_standard_deviation(measuredDepth);
+
+            return pointDepth - measuredDepth > occlusionSigmas * sqrt(std::max(0.0, pointDepthVariance) + measuredDepthStandardDeviation * measuredDepthStandardDeviation);
+        }
+
+        /**
+         * \brief A potential match between an untracked point and a detected keypoint, before the one to one assignment
+         */
+        struct Match_Candidate
+        {
+            IMap_Point_With_Tracking* _point = nullptr;
+            // Index of the point in the projected candidates, to search again if its keypoint is taken
+            size_t _projectionIndex = 0;
+            int _matchIndex = features::keypoints::INVALID_MATCH_INDEX;
+            uint _descriptorDistance = std::numeric_limits<uint>::max();
+            double _descriptorDistanceRatio = 1.0;
+        };
+
+        /**
+         * \brief Order the match candidates by descriptor distance, then by point slot, so the assignment does not depend on the map order
+         */
+        bool is_better_candidate(const Match_Candidate& candidate, const Match_Candidate& other)
+        {
+            if (candidate._descriptorDistance != other._descriptorDistance)
+                return candidate._descriptorDistance < other._descriptorDistance;
+            return candidate._point->_slot < other._point->_slot;
+        }
+
+        /**
+         * \brief Score the usefulness of a point for the eviction policy: confident, currently observed and isolated points score higher
+         *
+         * \param[in] point The point to score
+         * \param[in] voxelPointCount The number of points in the voxel of this point
+         */
+        double get_eviction_score(const IMap_Point_With_Tracking& point, const size_t voxelPointCount)
+        {
+            // Grows with the age and match count of the point (-1, 1)
+            const double confidence = point.get_confidence();
+            // Points observed in the last frame are the most useful for tracking
+            const double observationScore = point._matchedScreenPoint.is_matched() ? 1.0 : 0.0;
+            // Points sharing their voxel with many others are redundant [0, 1)
+            const double redundancyPenalty = 1.0 - 1.0 / static_cast<double>(std::max<size_t>(1, voxelPointCount));
+            return confidence + observationScore - redundancyPenalty;
+        }
+
+        /**
+         * \brief Select the least useful points of a container, so that it fits in maximumPointCount
+         *
+         * \param[in] points The point container
+         * \param[in] maximumPointCount Number of points to keep
+         * \param[in] pointIndex The spatial index of the points, to measure the redundancy
+         * \param[out] slots The slots of the points to evict
+         */
+        template<class Point_Container_Type>
+        void get_slots_to_evict(const Point_Container_Type& points, const size_t maximumPointCount, const Point_Voxel_Index& pointIndex, std::vector<size_t>& slots)
+        {
+            slots.clear();
+            if (points.size() <= maximumPointCount)
+                return;
+
+            std::vector<std::pair<double, size_t>> scoredSlots;
+            scoredSlots.reserve(points.size());
+            for (const IMap_Point_With_Tracking& point : points)
+                scoredSlots.emplace_back(get_eviction_score(point, pointIndex.get_voxel_point_count(point._slot)), point._slot);
+
+            // Lowest scores first, ties broken by slot so the eviction is deterministic
+            const size_t evictedCount = points.size() - maximumPointCount;
+            std::nth_element(scoredSlots.begin(), scoredSlots.begin() + evictedCount, scoredSlots.end());
+            for (size_t i = 0; i < evictedCount; ++i)
+                slots.push_back(scoredSlots[i].second);
         }
 
         /**
          * LOCAL MAP MEMBERS
          */
 
-        Local_Map::Local_Map()
+        Local_Map::Local_Map() :
+            _pointIndex(Parameters::get_map_point_voxel_size()),
+            _nextKeyframeId(0),
+            _frameIndex(0),
+            _globalMap(Parameters::get_global_map_tile_size())
         {
             // Check constants
-            assert(features::keypoints::INVALID_MAP_POINT_ID == INVALID_POINT_UNIQ_ID);
+            assert(features::keypoints::INVALID_MAP_POINT_SLOT == INVALID_POINT_SLOT);
 
             _mapWriter = new utils::XYZ_Map_Writer("out");
         }
 
         Local_Map::~Local_Map()
         {
-            for (const auto& [pointId, mapPoint] : _localPointMap) 
+            for (const Map_Point& mapPoint : _localPointMap) 
             {
                 _mapWriter->add_point(mapPoint._coordinates);
             }
@@ -50,51 +169,37 @@ namespace rgbd_slam {
             delete _mapWriter;
         }
 
-        bool Local_Map::find_match(IMap_Point_With_Tracking& point, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, const matrix44& worldToCamMatrix, matches_containers::match_point_container& matchedPoints)
+        void Local_Map::add_match(IMap_Point_With_Tracking& point, const int matchIndex, const double matchQuality, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints)
         {
-            int matchIndex = detectedKeypointsObject.get_tracking_match_index(point._id, _isPointMatched);
-            if (matchIndex == features::keypoints::INVALID_MATCH_INDEX)
-            {
-                vector2 projectedMapPoint;
-                const bool isScreenCoordinatesValid = utils::world_to_screen_coordinates(point._coordinates, worldToCamMatrix, projectedMapPoint);
-                if (isScreenCoordinatesValid)
-                    matchIndex = detectedKeypointsObject.get_match_index(projectedMapPoint, point._descriptor, _isPointMatched);
-            }
-
-            if (matchIndex == features::keypoints::INVALID_MATCH_INDEX) {
-                //unmatched point
-                point._matchedScreenPoint.mark_unmatched();
-                return false;
-            }
+            assert(matchIndex != features::keypoints::INVALID_MATCH_INDEX);
+            _isPointMatched[matchIndex] = true;
 
+            // 2D points are matched with a null depth
             const double screenPointDepth = detectedKeypointsObject.get_depth(matchIndex);
-            if (utils::is_depth_valid(screenPointDepth) ) {
-                // points with depth measurement
-                _isPointMatched[matchIndex] = true;
 
-                // update index and screen coordinates 
-                MatchedScreenPoint match;
-                match._screenCoordinates << detectedKeypointsObject.get_keypoint(matchIndex), screenPointDepth;
-                match._matchIndex = matchIndex;
-                point._matchedScreenPoint = match;
+            // update index and screen coordinates 
+            MatchedScreenPoint match;
+            match._screenCoordinates << detectedKeypointsObject.get_keypoint(matchIndex), (utils::is_depth_valid(screenPointDepth) ? screenPointDepth : 0);
+            match._matchIndex = matchIndex;
+            point._matchedScreenPoint = match;
+            _trackedKeypoints.set(point._slot, match._screenCoordinates.head<2>());
 
-                matchedPoints.emplace(matchedPoints.end(), match._screenCoordinates, point._coordinates, point._id);
-                return true;
-            }
-            else {
-                // 2D point
-                _isPointMatched[matchIndex] = true;
+            // Confident points with a distinctive association are the likely inliers
+            matchedPoints.add(match._screenCoordinates, point._coordinates, point._slot, point.get_confidence() + matchQuality);
+        }
 
-                // update index and screen coordinates 
-                MatchedScreenPoint match;
-                match._screenCoordinates << detectedKeypointsObject.get_keypoint(matchIndex), 0;
-                match._matchIndex = matchIndex;
-                point._matchedScreenPoint = match;
+        bool Local_Map::find_tracking_match(IMap_Point_With_Tracking& point, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints)
+        {
+            point._matchedScreenPoint.mark_unmatched();
+            _trackedKeypoints.remove(point._slot);
 
-                matchedPoints.emplace(matchedPoints.end(), match._screenCoordinates, point._coordinates, point._id);
-                return true;
-            }
-            return false;
+            const int matchIndex = detectedKeypointsObject.get_tracking_match_index(point._slot, _isPointMatched);
+            if (matchIndex == features::keypoints::INVALID_MATCH_INDEX)
+                return false;
+
+            // A keypoint tracked by optical flow is the most reliable association
+            add_match(point, matchIndex, 1.0, detectedKeypointsObject, matchedPoints);
+            return true;
         }
 
         bool Local_Map::find_match(Primitive& mapPrimitive, const features::primitives::primitive_container& detectedPrimitives, const matrix44& worldToCameraMatrix, matches_containers::match_primitive_container& matchedPrimitives)
@@ -113,7 +218,7 @@ namespace rgbd_slam {
                 if(mapPrimitive._primitive->is_similar(shapePrimitive)) 
                 {
                     mapPrimitive._matchedPrimitive._matchId = primitiveId;
-                    matchedPrimitives.emplace(matchedPrimitives.end(), shapePrimitive->_normal, mapPrimitive._primitive->_normal);
+                    matchedPrimitives.push_back({Primitive::get_camera_plane(shapePrimitive), mapPrimitive._worldPlane, mapPrimitive._isAxis});
 
                     _unmatchedPrimitiveIds.erase(primitiveId);
                     return true;
@@ -123,29 +228,99 @@ namespace rgbd_slam {
             return false;
         }
 
-        matches_containers::match_point_container Local_Map::find_keypoint_matches(const utils::Pose& currentPose, const features::keypoints::Keypoint_Handler& detectedKeypointsObject)
+        void Local_Map::find_keypoint_matches(const utils::Pose& currentPose, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints)
         {
             // will be used to detect new keypoints for the stagged map
             _isPointMatched.assign(detectedKeypointsObject.get_keypoint_count(), false);
-            matches_containers::match_point_container matchedPoints; 
+            matchedPoints.clear();
 
             const matrix44& worldToCamMatrix = utils::compute_world_to_camera_transform(currentPose.get_orientation_quaternion(), currentPose.get_position());
 
-            // Try to find matches in local map
-            for (auto& [pointId, mapPoint] : _localPointMap) 
+            // Associate the tracked points first: this is a direct lookup by slot, without projection
+            for (Map_Point& mapPoint : _localPointMap) 
+            {
+                find_tracking_match(mapPoint, detectedKeypointsObject, matchedPoints);
+            }
+            for(Staged_Point& stagedPoint : _stagedPoints)
+            {
+                find_tracking_match(stagedPoint, detectedKeypointsObject, matchedPoints);
+            }
+
+            // Only the untracked points in the camera frustum can be matched by descriptor
+            std::vector<size_t> visibleSlots;
+            _pointIndex.get_visible_slots(worldToCamMatrix, detectedKeypointsObject.get_image_width(), detectedKeypointsObject.get_image_height(), visibleSlots);
+
+            std::vector<IMap_Point_With_Tracking*> candidatePoints;
+            vector3_vector candidateCoordinates;
+            candidatePoints.reserve(visibleSlots.size());
+            candidateCoordinates.reserve(visibleSlots.size());
+            for (const size_t slot : visibleSlots)
+            {
+                IMap_Point_With_Tracking* point = _localPointMap.find(slot);
+                if (point == nullptr)
+                    point = _stagedPoints.find(slot);
+                assert(point != nullptr);
+
+                if (not point->_matchedScreenPoint.is_matched())
+                {
+                    candidatePoints.push_back(point);
+                    candidateCoordinates.push_back(point->_coordinates);
+                }
+            }
+
+            // Project all the candidates at once
+            vector2_vector projectedPoints;
+            std::vector<bool> isProjectionValid;
+            utils::world_to_screen_coordinates(candidateCoordinates, worldToCamMatrix, projectedPoints, isProjectionValid);
+
+            // Sample the measured depth at all the projections at once, with the same sampler as the keypoint depths
+            std::vector<cv::Point2f> projectedImagePoints;
+            projectedImagePoints.reserve(projectedPoints.size());
+            for (const vector2& projectedPoint : projectedPoints)
             {
-                assert(pointId == mapPoint._id);
-                find_match(mapPoint, detectedKeypointsObject, worldToCamMatrix, matchedPoints);
+                projectedImagePoints.emplace_back(static_cast<float>(projectedPoint.x()), static_cast<float>(projectedPoint.y()));
             }
+            std::vector<double> measuredDepths(projectedImagePoints.size(), 0.0);
+            detectedKeypointsObject.get_depths(projectedImagePoints, measuredDepths);
 
-            // Try to find matches in staged points
-            for(auto& [pointId, stagedPoint] : _stagedPoints)
+            // Points hidden behind the measured surface cannot be seen, and would only steal the keypoint of the occluding surface
+            std::vector<Match_Candidate> matchCandidates;
+            matchCandidates.reserve(candidatePoints.size());
+            for (size_t candidateIndex = 0; candidateIndex < candidatePoints.size(); ++candidateIndex)
             {
-                assert(pointId == stagedPoint._id);
-                find_match(stagedPoint, detectedKeypointsObject, worldToCamMatrix, matchedPoints);
+                if (isProjectionValid[candidateIndex] and not is_occluded(*candidatePoints[candidateIndex], worldToCamMatrix, measuredDepths[candidateIndex]))
+                    matchCandidates.push_back({candidatePoints[candidateIndex], candidateIndex});
             }
 
-            return matchedPoints;
+            // Search the best keypoint of each candidate in parallel, then resolve the conflicts: the best candidate of each keypoint wins.
+            // The losers search again among the keypoints left, as they would in a sequential search, until every candidate is matched or has no keypoint left
+            std::vector<Match_Candidate> losingCandidates;
+            while (not matchCandidates.empty())
+            {
+                // The matched keypoints are already flagged, and no flag is changed during this search
+                cv::parallel_for_(cv::Range(0, static_cast<int>(matchCandidates.size())), [&](const cv::Range& candidateRange) {
+                        for (int candidateIndex = candidateRange.start; candidateIndex < candidateRange.end; ++candidateIndex)
+                        {
+                            Match_Candidate& candidate = matchCandidates[candidateIndex];
+                            const IMap_Point_With_Tracking& point = *candidate._point;
+                            candidate._matchIndex = detectedKeypointsObject.get_match_index(projectedPoints[candidate._projectionIndex], _descriptorPool[point._slot], get_search_radius(point, currentPose), _isPointMatched, candidate._descriptorDistance, candidate._descriptorDistanceRatio);
+                        }
+                        });
+
+                std::erase_if(matchCandidates, [](const Match_Candidate& candidate) { return candidate._matchIndex == features::keypoints::INVALID_MATCH_INDEX; });
+                std::sort(matchCandidates.begin(), matchCandidates.end(), is_better_candidate);
+
+                // The best candidate always wins its keypoint, so each pass adds a match
+                losingCandidates.clear();
+                for (const Match_Candidate& candidate : matchCandidates)
+                {
+                    if (not _isPointMatched[candidate._matchIndex])
+                        add_match(*candidate._point, candidate._matchIndex, 1.0 - candidate._descriptorDistanceRatio, detectedKeypointsObject, matchedPoints);
+                    else
+                        losingCandidates.push_back(candidate);
+                }
+                matchCandidates.swap(losingCandidates);
+            }
         }
 
         matches_containers::match_primitive_container Local_Map::find_primitive_matches(const utils::Pose& currentPose, const features::primitives::primitive_container& detectedPrimitives)
@@ -168,6 +343,7 @@ namespace rgbd_slam {
 
             // Search for matches
             matches_containers::match_primitive_container matchedPrimitiveContainer;
+            matchedPrimitiveContainer.reserve(_localPrimitiveMap.size());
             for(auto& [primitiveId, mapPrimitive] : _localPrimitiveMap)
             {
                 if (not find_match(mapPrimitive, detectedPrimitives, worldToCameraMatrix, matchedPrimitiveContainer))
@@ -180,23 +356,30 @@ namespace rgbd_slam {
             return matchedPrimitiveContainer;
         }
 
-        void Local_Map::update(const utils::Pose& previousPose, const utils::Pose& optimizedPose, const features::keypoints::Keypoint_Handler& keypointObject, const features::primitives::primitive_container& detectedPrimitives, const matches_containers::match_point_container& outlierMatchedPoints)
+        void Local_Map::update(const utils::Pose& previousPose, const utils::Pose& optimizedPose, const features::keypoints::Keypoint_Handler& keypointObject, const features::primitives::primitive_container& detectedPrimitives, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_container& outlierIndexes)
         {
             // TODO find a better way to display trajectory than just a new map point
             _mapWriter->add_point(optimizedPose.get_position());
+            ++_frameIndex;
 
             // Unmatch detected outliers
-            mark_outliers_as_unmatched(outlierMatchedPoints);
+            mark_outliers_as_unmatched(matchedPoints, outlierIndexes);
 
             const matrix33& poseCovariance = utils::compute_pose_covariance(optimizedPose);
             const matrix44& previousCameraToWorldMatrix = utils::compute_camera_to_world_transform(previousPose.get_orientation_quaternion(), previousPose.get_position());
             const matrix44& cameraToWorldMatrix = utils::compute_camera_to_world_transform(optimizedPose.get_orientation_quaternion(), optimizedPose.get_position());
 
-            // add local map points
-            update_local_keypoint_map(poseCovariance, previousCameraToWorldMatrix, cameraToWorldMatrix, keypointObject);
+            // update the matched/unmatched status of all points at once
+            update_point_match_statuses(poseCovariance, previousCameraToWorldMatrix, cameraToWorldMatrix, keypointObject);
+
+            // remove lost local map points
+            update_local_keypoint_map();
+
+            // select keyframes, before anchoring the new map points
+            update_keyframes(optimizedPose);
 
             // add staged points to local map
-            update_staged_keypoints_map(poseCovariance, previousCameraToWorldMatrix, cameraToWorldMatrix, keypointObject);
+            update_staged_keypoints_map();
 
             // Add unmatched poins to the staged map, to unsure tracking of new features
             add_umatched_keypoints_to_staged_map(poseCovariance, cameraToWorldMatrix, keypointObject);
@@ -205,7 +388,10 @@ namespace rgbd_slam {
             update_local_primitive_map(cameraToWorldMatrix, cameraToWorldMatrix, detectedPrimitives);
 
             // add local map points to global map
-            update_local_to_global();
+            update_local_to_global(optimizedPose);
+
+            // evict the least useful points if the map is over budget
+            enforce_point_budgets();
         }
 
         void Local_Map::update_local_primitive_map(const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::primitives::primitive_container& detectedPrimitives)
@@ -231,9 +417,12 @@ namespace rgbd_slam {
                 }   
             }
 
-            // Remove umatched
+            // Move umatched primitives to the global map: they are restored if they are detected again
             for(const size_t primitiveId : primitivesToRemove)
+            {
+                _globalMap.add_primitive(_localPrimitiveMap.at(primitiveId));
                 _localPrimitiveMap.erase(primitiveId);
+            }
 
             // add unmatched primitives to local map
             for(const uchar& unmatchedDetectedPrimitiveId : _unmatchedPrimitiveIds)
@@ -241,9 +430,20 @@ namespace rgbd_slam {
                 assert(detectedPrimitives.contains(unmatchedDetectedPrimitiveId));
 
                 const features::primitives::primitive_uniq_ptr& detectedPrimitive = detectedPrimitives.at(unmatchedDetectedPrimitiveId);
-                Primitive newMapPrimitive(detectedPrimitive);
+                const bool isAxis = detectedPrimitive->get_primitive_type() == features::primitives::PrimitiveType::Cylinder;
 
-                _localPrimitiveMap.emplace(newMapPrimitive._id, newMapPrimitive);
+                // A plane of the global map keeps its identifier and its world parameters, so it constrains the pose like before it left the local map
+                Global_Primitive_Record storedPrimitive;
+                if (_globalMap.take_primitive(Primitive::get_world_plane(detectedPrimitive, cameraToWorldMatrix), isAxis, storedPrimitive))
+                {
+                    const vector4 storedWorldPlane(storedPrimitive._worldPlane[0], storedPrimitive._worldPlane[1], storedPrimitive._worldPlane[2], storedPrimitive._worldPlane[3]);
+                    _localPrimitiveMap.emplace(storedPrimitive._id, Primitive(detectedPrimitive, storedPrimitive._id, storedWorldPlane));
+                }
+                else
+                {
+                    Primitive newMapPrimitive(detectedPrimitive, cameraToWorldMatrix);
+                    _localPrimitiveMap.emplace(newMapPrimitive._id, newMapPrimitive);
+                }
             }
 
             _unmatchedPrimitiveIds.clear();
@@ -274,7 +474,7 @@ namespace rgbd_slam {
 
                     // If a new descriptor is available, update it
                     if (keypointObject.is_descriptor_computed(matchedPointIndex))
-                        mapPoint._descriptor = keypointObject.get_descriptor(matchedPointIndex);
+                        _descriptorPool[mapPoint._slot] = keypointObject.get_descriptor(matchedPointIndex);
 
                     // End of the function
                     return;
@@ -303,7 +503,7 @@ namespace rgbd_slam {
 
                             // If a new descriptor is available, update it
                             if (keypointObject.is_descriptor_computed(matchedPointIndex))
-                                mapPoint._descriptor = keypointObject.get_descriptor(matchedPointIndex);
+                                _descriptorPool[mapPoint._slot] = keypointObject.get_descriptor(matchedPointIndex);
                             return;
                         }
                     }
@@ -315,64 +515,82 @@ namespace rgbd_slam {
             mapPoint.update_unmatched();
         }
 
-        void Local_Map::update_local_keypoint_map(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject)
+        void Local_Map::update_point_match_statuses(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject)
         {
-            point_map_container::iterator pointMapIterator = _localPointMap.begin();
-            while(pointMapIterator != _localPointMap.end())
-            {
-                // Update the matched/unmatched status
-                Map_Point& mapPoint = pointMapIterator->second;
-                assert(pointMapIterator->first == mapPoint._id);
-
-                update_point_match_status(mapPoint, poseCovariance, keypointObject, previousCameraToWorldMatrix, cameraToWorldMatrix);
+            // Gather all the tracked points, to update them as a single batch
+            std::vector<IMap_Point_With_Tracking*> points;
+            points.reserve(_localPointMap.size() + _stagedPoints.size());
+            for (Map_Point& mapPoint : _localPointMap)
+                points.push_back(&mapPoint);
+            for (Staged_Point& stagedPoint : _stagedPoints)
+                points.push_back(&stagedPoint);
+
+            // Each point update only modifies this point: they can run in parallel
+            cv::parallel_for_(cv::Range(0, static_cast<int>(points.size())), [&](const cv::Range& pointRange) {
+                    for (int pointIndex = pointRange.start; pointIndex < pointRange.end; ++pointIndex)
+                    {
+                        update_point_match_status(*points[pointIndex], poseCovariance, keypointObject, previousCameraToWorldMatrix, cameraToWorldMatrix);
+                    }
+                    });
+        }
 
+        void Local_Map::update_local_keypoint_map()
+        {
+            size_t pointIndex = 0;
+            while(pointIndex < _localPointMap.size())
+            {
+                Map_Point& mapPoint = _localPointMap[pointIndex];
                 if (mapPoint.is_lost()) {
-                    // write to file
+                    // write to file, and keep it in the global map: it can be paged in again when the camera looks at it, after a delay so a point lost in view is not paged in right away
                     _mapWriter->add_point(mapPoint._coordinates);
+                    _globalMap.add_point(mapPoint, _descriptorPool[mapPoint._slot], _frameIndex + Parameters::get_global_map_page_in_delay());
 
-                    // Remove useless point
-                    pointMapIterator = _localPointMap.erase(pointMapIterator);
+                    // Remove useless point: the last point takes its place
+                    release_point_slot(mapPoint._slot);
+                    _localPointMap.erase(pointIndex);
                 }
                 else
                 {
-                    ++pointMapIterator;
+                    _pointIndex.update(mapPoint._slot, mapPoint._coordinates);
+                    ++pointIndex;
                 }
             }
         }
 
-        void Local_Map::update_staged_keypoints_map(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject)
+        void Local_Map::update_staged_keypoints_map()
         {
             // Add correct staged points to local map
-            staged_point_container::iterator stagedPointIterator = _stagedPoints.begin();
-            while(stagedPointIterator != _stagedPoints.end())
+            size_t pointIndex = 0;
+            while(pointIndex < _stagedPoints.size())
             {
-                Staged_Point& stagedPoint = stagedPointIterator->second;
-                assert(stagedPointIterator->first == stagedPoint._id);
-
-                // Update the matched/unmatched status
-                update_point_match_status(stagedPoint, poseCovariance, keypointObject, previousCameraToWorldMatrix, cameraToWorldMatrix);
+                Staged_Point& stagedPoint = _stagedPoints[pointIndex];
+                _pointIndex.update(stagedPoint._slot, stagedPoint._coordinates);
 
                 if (stagedPoint.should_add_to_local_map())
                 {
                     const vector3& stagedPointCoordinates = stagedPoint._coordinates;
                     assert(not std::isnan(stagedPointCoordinates.x()) and not std::isnan(stagedPointCoordinates.y()) and not std::isnan(stagedPointCoordinates.z()));
-                    // Add to local map, remove from staged points, with a copy of the id affected to the local map
-                    _localPointMap.emplace(
-                            stagedPoint._id,
-                            Map_Point(stagedPointCoordinates, stagedPoint.get_covariance_matrix(), stagedPoint._descriptor, stagedPoint._id)
+                    // Add to local map, remove from staged points, with a copy of the id and slot affected to the local map
+                    Map_Point& newMapPoint = _localPointMap.insert(
+                            Map_Point(stagedPointCoordinates, stagedPoint.get_covariance_matrix(), stagedPoint._slot, stagedPoint._id)
                             );
-                    _localPointMap.at(stagedPoint._id)._matchedScreenPoint = stagedPoint._matchedScreenPoint;
-                    stagedPointIterator = _stagedPoints.erase(stagedPointIterator);
+                    newMapPoint._matchedScreenPoint = stagedPoint._matchedScreenPoint;
+                    // Anchor to the current keyframe
+                    assert(not _keyframes.empty());
+                    newMapPoint._keyframeId = _keyframes.back()._id;
+                    ++_keyframes.back()._anchoredPointCount;
+                    _stagedPoints.erase(pointIndex);
                 }
                 else if (stagedPoint.should_remove_from_staged())
                 {
                     // Remove from staged points
-                    stagedPointIterator = _stagedPoints.erase(stagedPointIterator);
+                    release_point_slot(stagedPoint._slot);
+                    _stagedPoints.erase(pointIndex);
                 }
                 else
                 {
                     // Increment
-                    ++stagedPointIterator;
+                    ++pointIndex;
                 }
             }
         }
@@ -402,58 +620,453 @@ namespace rgbd_slam {
 
                     const matrix33& worldPointCovariance = utils::get_world_point_covariance(screenPoint, depth, utils::get_screen_point_covariance(screenPoint, depth));
 
-                    Staged_Point newStagedPoint(worldPoint, worldPointCovariance + poseCovariance, keypointObject.get_descriptor(i));
-                    _stagedPoints.emplace(
-                            newStagedPoint._id,
-                            newStagedPoint);
+                    Staged_Point& newStagedPoint = _stagedPoints.insert(
+                            Staged_Point(worldPoint, worldPointCovariance + poseCovariance, _pointSlots.allocate())
+                            );
+                    _descriptorPool.set(newStagedPoint._slot, keypointObject.get_descriptor(i));
+                    _pointIndex.insert(newStagedPoint._slot, newStagedPoint._coordinates);
 
                     MatchedScreenPoint match;
                     match._screenCoordinates << screenPoint, depth;
                     // This id is to unsure the tracking of this staged point for it's first detection
                     match._matchIndex = 0;
-                    _stagedPoints.at(newStagedPoint._id)._matchedScreenPoint = match;
+                    newStagedPoint._matchedScreenPoint = match;
+                    _trackedKeypoints.set(newStagedPoint._slot, screenPoint);
                 }
             }
 
         }
 
 
-        const features::keypoints::KeypointsWithIdStruct Local_Map::get_tracked_keypoints_features() const
+        const features::keypoints::KeypointsWithIdStruct& Local_Map::get_tracked_keypoints_features() const
+        {
+            return _trackedKeypoints.get_keypoints();
+        }
+
+        Keyframe* Local_Map::find_keyframe(const size_t keyframeId)
+        {
+            for (Keyframe& keyframe : _keyframes)
+            {
+                if (keyframe._id == keyframeId)
+                    return &keyframe;
+            }
+            return nullptr;
+        }
+
+        bool Local_Map::should_create_keyframe(const utils::Pose& optimizedPose) const
+        {
+            if (_keyframes.empty())
+                return true;
+
+            const Keyframe& lastKeyframe = _keyframes.back();
+            if ((optimizedPose.get_position() - lastKeyframe._position).norm() > Parameters::get_keyframe_maximum_translation())
+                return true;
+            if (optimizedPose.get_orientation_quaternion().angularDistance(lastKeyframe._orientation) > Parameters::get_keyframe_maximum_rotation())
+                return true;
+
+            // Too few points of the last keyframe are still observed
+            return lastKeyframe._anchoredPointCount > 0 and 
+                static_cast<double>(lastKeyframe._matchedPointCount) < Parameters::get_keyframe_minimum_overlap() * static_cast<double>(lastKeyframe._anchoredPointCount);
+        }
+
+        void Local_Map::update_keyframes(const utils::Pose& optimizedPose)
+        {
+            for (Keyframe& keyframe : _keyframes)
+            {
+                keyframe._anchoredPointCount = 0;
+                keyframe._matchedPointCount = 0;
+            }
+            for (const Map_Point& mapPoint : _localPointMap)
+            {
+                Keyframe* keyframe = find_keyframe(mapPoint._keyframeId);
+                assert(keyframe != nullptr);
+                ++keyframe->_anchoredPointCount;
+                if (mapPoint._matchedScreenPoint.is_matched())
+                    ++keyframe->_matchedPointCount;
+            }
+
+            if (not should_create_keyframe(optimizedPose))
+                return;
+
+            _keyframes.emplace_back(_nextKeyframeId, optimizedPose.get_position(), optimizedPose.get_orientation_quaternion());
+            ++_nextKeyframeId;
+
+            // The matched points are observed from the new keyframe: anchor them to it
+            Keyframe& newKeyframe = _keyframes.back();
+            for (Map_Point& mapPoint : _localPointMap)
+            {
+                if (not mapPoint._matchedScreenPoint.is_matched())
+                    continue;
+
+                Keyframe* previousKeyframe = find_keyframe(mapPoint._keyframeId);
+                assert(previousKeyframe != nullptr);
+                --previousKeyframe->_anchoredPointCount;
+                --previousKeyframe->_matchedPointCount;
+
+                mapPoint._keyframeId = newKeyframe._id;
+                ++newKeyframe._anchoredPointCount;
+                ++newKeyframe._matchedPointCount;
+                newKeyframe._observations.push_back({mapPoint._id, mapPoint._matchedScreenPoint._screenCoordinates});
+            }
+            // Staged points keep their id in the local map: their observations are used once they are added to it
+            for (const Staged_Point& stagedPoint : _stagedPoints)
+            {
+                if (stagedPoint._matchedScreenPoint.is_matched())
+                    newKeyframe._observations.push_back({stagedPoint._id, stagedPoint._matchedScreenPoint._screenCoordinates});
+            }
+
+            request_bundle_adjustment();
+        }
+
+        void Local_Map::request_bundle_adjustment()
+        {
+            if (Parameters::get_bundle_adjustment_maximum_iterations() == 0 or _keyframes.size() < 2)
+                return;
+
+            Bundle_Adjustment_Problem problem;
+            problem._keyframes.reserve(_keyframes.size());
+            std::unordered_map<size_t, size_t> observationCounts;
+            for (const Keyframe& keyframe : _keyframes)
+            {
+                problem._keyframes.push_back({keyframe._id, keyframe._position, keyframe._orientation});
+                for (const Keyframe_Observation& observation : keyframe._observations)
+                    ++observationCounts[observation._pointId];
+            }
+
+            // A point observed from a single keyframe does not constrain the keyframe poses
+            std::unordered_map<size_t, size_t> pointIndexes;
+            for (const Map_Point& mapPoint : _localPointMap)
+            {
+                const auto countIterator = observationCounts.find(mapPoint._id);
+                if (countIterator == observationCounts.end() or countIterator->second < 2)
+                    continue;
+
+                pointIndexes.emplace(mapPoint._id, problem._points.size());
+                problem._points.push_back({mapPoint._id, mapPoint._slot, mapPoint._coordinates});
+            }
+            if (problem._points.empty())
+                return;
+
+            for (size_t keyframeIndex = 0; keyframeIndex < _keyframes.size(); ++keyframeIndex)
+            {
+                for (const Keyframe_Observation& observation : _keyframes[keyframeIndex]._observations)
+                {
+                    const auto pointIterator = pointIndexes.find(observation._pointId);
+                    if (pointIterator != pointIndexes.end())
+                        problem._observations.push_back({keyframeIndex, pointIterator->second, observation._screenCoordinates});
+                }
+            }
+
+            // Dropped if the last adjustment is not done: the next keyframe will post a new one
+            _bundleAdjuster.request_adjustment(problem);
+        }
+
+        bool Local_Map::merge_bundle_adjustment(quaternion& rotationCorrection, vector3& translationCorrection)
         {
-            const size_t numberOfNewKeypoints = _localPointMap.size() + _stagedPoints.size();
+            Bundle_Adjustment_Result result;
+            if (not _bundleAdjuster.get_adjustment_result(result))
+                return false;
+
+            // Correction of each keyframe, as a rigid transformation of the world: corrected pose = correction * pose
+            struct Keyframe_Correction
+            {
+                quaternion _rotation;
+                vector3 _translation;
+
+                EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            };
+            std::vector<Keyframe_Correction, Eigen::aligned_allocator<Keyframe_Correction>> corrections;
+            std::unordered_map<size_t, size_t> keyframeCorrectionIndexes;
+
+            // The keyframes may have left the local map during the adjustment. They are in the window order, so the last one found is the newest
+            for (const Bundle_Adjustment_Problem::Keyframe_Pose& adjustedKeyframe : result._keyframes)
+            {
+                Keyframe* keyframe = find_keyframe(adjustedKeyframe._id);
+                if (keyframe == nullptr)
+                    continue;
+
+                const quaternion& rotation = (adjustedKeyframe._orientation * keyframe->_orientation.conjugate()).normalized();
+                keyframeCorrectionIndexes.emplace(keyframe->_id, corrections.size());
+                corrections.push_back({rotation, adjustedKeyframe._position - rotation * keyframe->_position});
+
+                keyframe->_position = adjustedKeyframe._position;
+                keyframe->_orientation = adjustedKeyframe._orientation;
+            }
+            if (corrections.empty())
+                return false;
+            rotationCorrection = corrections.back()._rotation;
+            translationCorrection = corrections.back()._translation;
+
+            // The keyframes created after the adjustment request were tracked from the newest adjusted keyframe
+            for (Keyframe& keyframe : _keyframes)
+            {
+                if (keyframeCorrectionIndexes.emplace(keyframe._id, corrections.size() - 1).second)
+                {
+                    keyframe._position = rotationCorrection * keyframe._position + translationCorrection;
+                    keyframe._orientation = (rotationCorrection * keyframe._orientation).normalized();
+                }
+            }
+
+            std::unordered_set<size_t> adjustedSlots;
+            for (const Bundle_Adjustment_Result::Point& adjustedPoint : result._points)
+            {
+                // The slot of a removed point can be used by another point
+                Map_Point* mapPoint = _localPointMap.find(adjustedPoint._slot);
+                if (mapPoint == nullptr or mapPoint->_id != adjustedPoint._id)
+                    continue;
+
+                mapPoint->_coordinates += adjustedPoint._correction;
+                _pointIndex.update(mapPoint->_slot, mapPoint->_coordinates);
+                adjustedSlots.insert(mapPoint->_slot);
+            }
+
+            // The other points move with their keyframe, so they stay consistent with the adjusted ones
+            for (Map_Point& mapPoint : _localPointMap)
+            {
+                if (adjustedSlots.contains(mapPoint._slot))
+                    continue;
 
-            // initialize output structure
-            features::keypoints::KeypointsWithIdStruct keypointsWithIds; 
+                const auto correctionIterator = keyframeCorrectionIndexes.find(mapPoint._keyframeId);
+                assert(correctionIterator != keyframeCorrectionIndexes.end());
+                const Keyframe_Correction& correction = corrections[correctionIterator->second];
+                mapPoint._coordinates = correction._rotation * mapPoint._coordinates + correction._translation;
+                _pointIndex.update(mapPoint._slot, mapPoint._coordinates);
+            }
+            for (Staged_Point& stagedPoint : _stagedPoints)
+            {
+                stagedPoint._coordinates = rotationCorrection * stagedPoint._coordinates + translationCorrection;
+                _pointIndex.update(stagedPoint._slot, stagedPoint._coordinates);
+            }
+            return true;
+        }
 
-            // TODO: check the efficiency gain of those reserve calls
-            keypointsWithIds._ids.reserve(numberOfNewKeypoints);
-            keypointsWithIds._keypoints.reserve(numberOfNewKeypoints);
+        void Local_Map::page_in_global_points(const utils::Pose& pose)
+        {
+            // The optical axis is the z axis of the camera, and the view cone contains the image corners
+            const vector3& viewDirection = pose.get_orientation_matrix().col(2);
+            const double halfViewAngle = atan(std::hypot(
+                        Parameters::get_camera_1_center_x() / Parameters::get_camera_1_focal_x(),
+                        Parameters::get_camera_1_center_y() / Parameters::get_camera_1_focal_y()
+                        ));
+
+            // Paged in points do not push the local map over its budget, or they would be evicted back right away
+            const size_t maximumMapPointCount = get_maximum_map_point_count();
+            const size_t pageInPointCount = maximumMapPointCount - std::min(maximumMapPointCount, _localPointMap.size());
+
+            std::vector<Global_Point_Record> pagedInPoints;
+            if (not _globalMap.page_in_points_around(pose.get_position(), viewDirection, halfViewAngle, _frameIndex, pageInPointCount, pagedInPoints))
+                return;
 
-            // add map points with valid retroprojected coordinates
-            for (const auto& [pointId, point]  : _localPointMap)
+            assert(not _keyframes.empty());
+            Keyframe& lastKeyframe = _keyframes.back();
+            for (const Global_Point_Record& record : pagedInPoints)
             {
-                assert(pointId == point._id);
-                add_point_to_tracked_features(point, keypointsWithIds);
+                const vector3 coordinates(record._coordinates[0], record._coordinates[1], record._coordinates[2]);
+                const matrix33 covariance = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(record._covariance);
+
+                Map_Point& mapPoint = _localPointMap.insert(
+                        Map_Point(coordinates, covariance, _pointSlots.allocate(), record._id, record._age)
+                        );
+                _descriptorPool.set(mapPoint._slot, record._descriptor);
+                mapPoint._keyframeId = lastKeyframe._id;
+                ++lastKeyframe._anchoredPointCount;
+                _pointIndex.insert(mapPoint._slot, mapPoint._coordinates);
             }
-            // add staged points with valid retroprojected coordinates
-            for (const auto& [pointId, point] : _stagedPoints)
+        }
+
+        void Local_Map::update_local_to_global(const utils::Pose& optimizedPose) 
+        {
+            assert(not _keyframes.empty());
+
+            // The camera came back in a known area: move the global points around it to the local map
+            page_in_global_points(optimizedPose);
+
+            const size_t windowSize = Parameters::get_keyframe_window_size();
+            while (_keyframes.size() > windowSize)
             {
-                assert(pointId == point._id);
-                add_point_to_tracked_features(point, keypointsWithIds);
+                // The least relevant keyframe has the fewest matched points, the oldest first. The last keyframe is always kept
+                keyframe_container::iterator leastRelevantKeyframe = _keyframes.begin();
+                for (keyframe_container::iterator keyframeIterator = _keyframes.begin(); keyframeIterator != std::prev(_keyframes.end()); ++keyframeIterator)
+                {
+                    if (keyframeIterator->_matchedPointCount < leastRelevantKeyframe->_matchedPointCount)
+                        leastRelevantKeyframe = keyframeIterator;
+                }
+                const size_t keyframeId = leastRelevantKeyframe->_id;
+                _keyframes.erase(leastRelevantKeyframe);
+
+                // Move the points of this keyframe out of the local map. The points matched in the current frame are still in view: anchor them to the newest keyframe instead
+                Keyframe& newestKeyframe = _keyframes.back();
+                size_t pointIndex = 0;
+                while(pointIndex < _localPointMap.size())
+                {
+                    Map_Point& mapPoint = _localPointMap[pointIndex];
+                    if (mapPoint._keyframeId == keyframeId and mapPoint._matchedScreenPoint.is_matched())
+                    {
+                        mapPoint._keyframeId = newestKeyframe._id;
+                        ++newestKeyframe._anchoredPointCount;
+                        ++newestKeyframe._matchedPointCount;
+                        ++pointIndex;
+                    }
+                    else if (mapPoint._keyframeId == keyframeId)
+                    {
+                        _mapWriter->add_point(mapPoint._coordinates);
+                        _globalMap.add_point(mapPoint, _descriptorPool[mapPoint._slot]);
+
+                        release_point_slot(mapPoint._slot);
+                        _localPointMap.erase(pointIndex);
+                    }
+                    else
+                    {
+                        ++pointIndex;
+                    }
+                }
             }
-            return keypointsWithIds;
+            _globalMap.flush();
         }
 
-        void Local_Map::update_local_to_global() 
+        void Local_Map::release_point_slot(const size_t slot)
         {
-            // TODO when we have a global map
+            _pointIndex.erase(slot);
+            _trackedKeypoints.remove(slot);
+            _pointSlots.release(slot);
+        }
+
+        void Local_Map::enforce_point_budgets()
+        {
+            const size_t maximumPointCount = get_memory_budget_point_count();
+            const size_t maximumMapPointCount = get_maximum_map_point_count();
+            // Staged points only get the memory left by the map points
+            const size_t maximumStagedPointCount = std::min<size_t>(Parameters::get_maximum_staged_point_count(), maximumPointCount - std::min(maximumMapPointCount, _localPointMap.size()));
+
+            std::vector<size_t> evictedSlots;
+            get_slots_to_evict(_localPointMap, maximumMapPointCount, _pointIndex, evictedSlots);
+            for (const size_t slot : evictedSlots)
+            {
+                // Evicted map points are kept in the global map, like the points of a dropped keyframe
+                const Map_Point* mapPoint = _localPointMap.find(slot);
+                assert(mapPoint != nullptr);
+                _mapWriter->add_point(mapPoint->_coordinates);
+                _globalMap.add_point(*mapPoint, _descriptorPool[slot]);
+
+                release_point_slot(slot);
+                _localPointMap.erase_slot(slot);
+            }
 
+            get_slots_to_evict(_stagedPoints, maximumStagedPointCount, _pointIndex, evictedSlots);
+            for (const size_t slot : evictedSlots)
+            {
+                release_point_slot(slot);
+                _stagedPoints.erase_slot(slot);
+            }
         }
 
         void Local_Map::reset()
         {
             _localPointMap.clear();
             _stagedPoints.clear();
+            _pointSlots.reset();
+            _pointIndex.clear();
+            _trackedKeypoints.clear();
+            _descriptorPool.clear();
+            _keyframes.clear();
+            _localPrimitiveMap.clear();
+            _unmatchedPrimitiveIds.clear();
+            _bundleAdjuster.cancel();
+        }
+
+        bool Local_Map::save_snapshot(const std::string& directory, const utils::Pose& pose, const utils::Motion_Model& motionModel)
+        {
+            // The previous snapshot of the directory is removed first: it cannot be a source of points
+            std::error_code error;
+            if (std::filesystem::equivalent(directory, _globalMap.get_directory(), error) or 
+                    (not _globalMap.get_snapshot_directory().empty() and std::filesystem::equivalent(directory, _globalMap.get_snapshot_directory(), error)))
+            {
+                utils::log_error("Cannot save a map snapshot in the directory it is loaded from: " + directory);
+                return false;
+            }
+
+            // The header of an overwritten snapshot would validate the partially written tiles, and its old tiles would be mixed with the new ones
+            if (not remove_map_snapshot(directory))
+                return false;
+
+            {
+                Global_Map snapshotMap(directory, _globalMap.get_tile_size());
+                _globalMap.copy_tiles_to(snapshotMap);
+                for (const Map_Point& mapPoint : _localPointMap)
+                    snapshotMap.add_point(mapPoint, _descriptorPool[mapPoint._slot]);
+                snapshotMap.flush();
+
+                // The local primitives are saved like retired primitives, by their world plane
+                for (const auto& [primitiveId, mapPrimitive] : _localPrimitiveMap)
+                    snapshotMap.add_primitive(mapPrimitive);
+                if (not write_map_snapshot_primitives(directory, snapshotMap.get_primitives()))
+                    return false;
+            }
+
+            Map_Snapshot_Header header;
+            header._tileSize = _globalMap.get_tile_size();
+            header._nextPointId = Point::get_next_id();
+            header._nextPrimitiveId = Primitive::get_next_id();
+
+            const vector3& position = pose.get_position();
+            const quaternion& orientation = pose.get_orientation_quaternion();
+            std::copy(position.data(), position.data() + 3, header._position);
+            std::copy(orientation.coeffs().data(), orientation.coeffs().data() + 4, header._orientation);
+
+            quaternion lastRotation, angularVelocity;
+            vector3 lastPosition, linearVelocity;
+            motionModel.get_state(lastRotation, angularVelocity, lastPosition, linearVelocity);
+            std::copy(lastRotation.coeffs().data(), lastRotation.coeffs().data() + 4, header._motionModelLastOrientation);
+            std::copy(angularVelocity.coeffs().data(), angularVelocity.coeffs().data() + 4, header._motionModelAngularVelocity);
+            std::copy(lastPosition.data(), lastPosition.data() + 3, header._motionModelLastPosition);
+            std::copy(linearVelocity.data(), linearVelocity.data() + 3, header._motionModelLinearVelocity);
+
+            // Written last, and the previous header was removed: an interrupted save has no valid header
+            return write_map_snapshot_header(directory, header);
+        }
+
+        bool Local_Map::load_snapshot(const std::string& directory, utils::Pose& pose, utils::Motion_Model& motionModel)
+        {
+            Map_Snapshot_Header header;
+            if (not read_map_snapshot_header(directory, header))
+                return false;
+            if (header._tileSize != _globalMap.get_tile_size())
+            {
+                utils::log_error("The map snapshot tile size does not match the global map tile size parameter");
+                return false;
+            }
+
+            std::vector<Global_Primitive_Record> primitives;
+            if (not read_map_snapshot_primitives(directory, primitives))
+                return false;
+
+            // The points and primitives of the current session and of a previous snapshot are replaced by the snapshot ones
+            reset();
+            _globalMap.clear();
+            if (not _globalMap.load_snapshot_tiles(directory))
+                return false;
+            Point::reserve_ids(header._nextPointId);
+
+            // The primitives wait in the global map until they are detected again
+            for (const Global_Primitive_Record& record : primitives)
+                _globalMap.add_primitive(record);
+            Primitive::reserve_ids(header._nextPrimitiveId);
+
+            const vector3 position(header._position[0], header._position[1], header._position[2]);
+            const quaternion orientation(header._orientation[3], header._orientation[0], header._orientation[1], header._orientation[2]);
+            pose = utils::Pose(position, orientation);
+            motionModel.set_state(
+                    quaternion(header._motionModelLastOrientation[3], header._motionModelLastOrientation[0], header._motionModelLastOrientation[1], header._motionModelLastOrientation[2]),
+                    quaternion(header._motionModelAngularVelocity[3], header._motionModelAngularVelocity[0], header._motionModelAngularVelocity[1], header._motionModelAngularVelocity[2]),
+                    vector3(header._motionModelLastPosition[0], header._motionModelLastPosition[1], header._motionModelLastPosition[2]),
+                    vector3(header._motionModelLinearVelocity[0], header._motionModelLinearVelocity[1], header._motionModelLinearVelocity[2])
+                    );
+
+            // Anchor the points around the observer to a first keyframe
+            _keyframes.emplace_back(_nextKeyframeId, pose.get_position(), pose.get_orientation_quaternion());
+            ++_nextKeyframeId;
+            page_in_global_points(pose);
+            return true;
         }
 
         void Local_Map::draw_point_on_image(const IMap_Point_With_Tracking& mapPoint, const matrix44& worldToCameraMatrix, const cv::Scalar& pointColor, cv::Mat& debugImage)
@@ -562,65 +1175,68 @@ namespace rgbd_slam {
             if (shouldDisplayPrimitiveMasks)
                 draw_primitives_on_image(worldToCamMatrix, debugImage);
 
-            // Display keypoints
-            for (const auto& [pointId, mapPoint] : _localPointMap) {
-                assert(pointId == mapPoint._id);
-                draw_point_on_image(mapPoint, worldToCamMatrix, cv::Scalar(0, 255, 0), debugImage);
-            }
-            if (shouldDisplayStaged)
+            // Display the keypoints in the camera frustum
+            std::vector<size_t> visibleSlots;
+            _pointIndex.get_visible_slots(worldToCamMatrix, debugImage.cols, debugImage.rows, visibleSlots);
+            for (const size_t slot : visibleSlots)
             {
-                for (const auto& [pointId, stagedPoint] : _stagedPoints) {
-                    assert(pointId == stagedPoint._id);
-                    draw_point_on_image(stagedPoint, worldToCamMatrix, cv::Scalar(0, 200, 255), debugImage);
+                const Map_Point* mapPoint = _localPointMap.find(slot);
+                if (mapPoint != nullptr)
+                {
+                    draw_point_on_image(*mapPoint, worldToCamMatrix, cv::Scalar(0, 255, 0), debugImage);
+                }
+                else if (shouldDisplayStaged)
+                {
+                    const Staged_Point* stagedPoint = _stagedPoints.find(slot);
+                    assert(stagedPoint != nullptr);
+                    draw_point_on_image(*stagedPoint, worldToCamMatrix, cv::Scalar(0, 200, 255), debugImage);
                 }
             }
         }
 
-        void Local_Map::mark_outliers_as_unmatched(const matches_containers::match_point_container& outlierMatchedPoints)
+        void Local_Map::mark_outliers_as_unmatched(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_container& outlierIndexes)
         {
             // Mark outliers as unmatched
-            for (const matches_containers::Match& match : outlierMatchedPoints)
+            for (const size_t outlierIndex : outlierIndexes)
             {
-                const bool isOutlierRemoved = mark_point_with_id_as_unmatched(match._mapPointId);
+                const bool isOutlierRemoved = mark_point_with_slot_as_unmatched(matchedPoints.get_map_point_slot(outlierIndex));
                 // If no points were found, this is bad. A match marked as outliers must be in the local map or staged points
                 assert(isOutlierRemoved == true);
             }
         }
 
-        bool Local_Map::mark_point_with_id_as_unmatched(const size_t pointId)
+        bool Local_Map::mark_point_with_slot_as_unmatched(const size_t pointSlot)
         {
-            // Check if id is in local map
-            point_map_container::iterator pointMapIterator = _localPointMap.find(pointId);
-            if (pointMapIterator != _localPointMap.end())
+            // Check if slot is in local map
+            Map_Point* mapPoint = _localPointMap.find(pointSlot);
+            if (mapPoint != nullptr)
             {
-                Map_Point& mapPoint = pointMapIterator->second;
-                assert(mapPoint._id == pointId);
-                mark_point_with_id_as_unmatched(pointId, mapPoint);
+                assert(mapPoint->_slot == pointSlot);
+                mark_point_as_unmatched(*mapPoint);
                 return true;
             }
 
-            // Check if id is in staged points
-            staged_point_container::iterator stagedPointIterator = _stagedPoints.find(pointId);
-            if (stagedPointIterator != _stagedPoints.end())
+            // Check if slot is in staged points
+            Staged_Point* stagedPoint = _stagedPoints.find(pointSlot);
+            if (stagedPoint != nullptr)
             {
-                Staged_Point& stagedPoint = stagedPointIterator->second;
-                assert(stagedPoint._id == pointId);
-                mark_point_with_id_as_unmatched(pointId, stagedPoint);
+                assert(stagedPoint->_slot == pointSlot);
+                mark_point_as_unmatched(*stagedPoint);
                 return true;
             }
 
-            // point associated with id was not find
+            // point associated with slot was not find
             return false;
         }
 
-        void Local_Map::mark_point_with_id_as_unmatched(const size_t pointId, IMap_Point_With_Tracking& point)
+        void Local_Map::mark_point_as_unmatched(IMap_Point_With_Tracking& point)
         {
-            assert(pointId == point._id);
             assert(point._matchedScreenPoint._matchIndex < static_cast<int>(_isPointMatched.size()));
 
             // Mark point as unmatched
             _isPointMatched[point._matchedScreenPoint._matchIndex] = false;
             point._matchedScreenPoint.mark_unmatched();
+            _trackedKeypoints.remove(point._slot);
         }
 
     }   /* map_management */
@@ -3,6 +3,7 @@
 
 #include <list>
 #include <vector>
+#include <deque>
 #include <opencv2/opencv.hpp>
 #include <opencv2/xfeatures2d.hpp>
 
@@ -11,8 +12,17 @@
 #include "keypoint_detection.hpp"
 #include "primitive_detection.hpp"
 #include "pose.hpp"
+#include "motion_model.hpp"
 
 #include "map_point.hpp"
+#include "point_slot_allocator.hpp"
+#include "point_container.hpp"
+#include "point_voxel_index.hpp"
+#include "keyframe.hpp"
+#include "local_bundle_adjuster.hpp"
+#include "tracked_keypoint_list.hpp"
+#include "descriptor_pool.hpp"
+#include "global_map.hpp"
 #include "map_primitive.hpp"
 
 #include "map_writer.hpp"
@@ -22,7 +32,8 @@ namespace rgbd_slam {
     namespace map_management {
 
         /**
-         * \brief Maintain a local map around the camera. Can return matched features, and update the global map when features are estimated to be reliable. For now we dont have a global map
+         * \brief Maintain a local map around the camera. Can return matched features, and update the global map when features are estimated to be reliable.
+         * The local map only contains the points of a sliding window of keyframes, so its size does not grow with the session length
          */
         class Local_Map {
             public:
@@ -30,14 +41,14 @@ namespace rgbd_slam {
                 ~Local_Map();
 
                 /**
-                 * \brief Compute the point feature matches between the local map and a given set of points. Update the staged point list matched points
+                 * \brief Compute the point feature matches between the local map and a given set of points. Update the staged point list matched points.
+                 * The descriptor search runs in parallel, and the result does not depend on the map order. The points hidden behind the measured depth at their projection are not searched
                  *
                  * \param[in] currentPose The current observer pose.
                  * \param[in] detectedKeypointsObject An object containing the detected key points in the rgbd frame
-                 *
-                 * \return A container associating the map/staged points to detected key points
+                 * \param[out] matchedPoints A container associating the map/staged points to detected key points. It is cleared first, so its reserved memory can be reused between frames
                  */
-                matches_containers::match_point_container find_keypoint_matches(const utils::Pose& currentPose, const features::keypoints::Keypoint_Handler& detectedKeypointsObject); 
+                void find_keypoint_matches(const utils::Pose& currentPose, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints); 
 
                 /**
                  * \brief Compute the primitive matches
@@ -57,22 +68,64 @@ namespace rgbd_slam {
                  * \param[in] optimizedPose The clean true pose of the observer, after optimization
                  * \param[in] keypointObject An object containing the detected key points in the rgbd frame. Must be the same as in find_keypoint_matches
                  * \param[in] detectedPrimitives A container for all detected primitives in the depth image
-                 * \param[in] outlierMatchedPoints A container for all the wrongly associated points detected in the pose optimization process. They should be marked as invalid matches
+                 * \param[in] matchedPoints The point matches returned by find_keypoint_matches
+                 * \param[in] outlierIndexes The indexes of the wrongly associated matches detected in the pose optimization process. They should be marked as invalid matches
                  */
-                void update(const utils::Pose& previousPose, const utils::Pose& optimizedPose, const features::keypoints::Keypoint_Handler& keypointObject, const features::primitives::primitive_container& detectedPrimitives, const matches_containers::match_point_container& outlierMatchedPoints);
+                void update(const utils::Pose& previousPose, const utils::Pose& optimizedPose, const features::keypoints::Keypoint_Handler& keypointObject, const features::primitives::primitive_container& detectedPrimitives, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_container& outlierIndexes);
 
                 /**
-                 * \brief Return an object containing the tracked keypoint features in screen space (2D), with the associated global ids 
+                 * \brief Merge the result of the last local bundle adjustment, if it is ready: the keyframe poses are replaced, and the point corrections are added to the current point coordinates.
+                 * The other points and keyframes move with the keyframe they are anchored to, and the staged points and the keyframes created since the adjustment move with the newest adjusted keyframe
+                 *
+                 * \param[out] rotationCorrection The rotation of the world correction of the newest adjusted keyframe, if the function returned true
+                 * \param[out] translationCorrection The translation of this correction, applied after the rotation. The observer pose must move by this correction, to track against the corrected map
                  *
-                 * \param[in] pose The current pose of the observer
+                 * \return True if an adjustment was merged
+                 */
+                bool merge_bundle_adjustment(quaternion& rotationCorrection, vector3& translationCorrection);
+
+                /**
+                 * \brief Return an object containing the tracked keypoint features in screen space (2D), with the associated map slots.
+                 * It is maintained when the matches are set and cleared, and stays valid until the next map update
+                 */
+                const features::keypoints::KeypointsWithIdStruct& get_tracked_keypoints_features() const;
+
+                /**
+                 * \return True if the local map has no map point, staged point or primitive to match: the pose cannot be optimized against it
                  */
-                const features::keypoints::KeypointsWithIdStruct get_tracked_keypoints_features() const;
+                bool is_empty() const
+                {
+                    return _localPointMap.empty() and _stagedPoints.empty() and _localPrimitiveMap.empty();
+                }
 
                 /**
                  * \brief Hard clean the local and staged map
                  */
                 void reset();
 
+                /**
+                 * \brief Save the local and global map points in the tiles of a snapshot directory, the local and global map primitives by their world planes, then its header with the observer state. Staged points are not saved
+                 *
+                 * \param[in] directory The snapshot directory. Its previous snapshot is removed first. A directory with tile files but no snapshot header is not overwritten
+                 * \param[in] pose The pose of the observer
+                 * \param[in] motionModel The motion model of the observer
+                 *
+                 * \return True if the snapshot was saved
+                 */
+                bool save_snapshot(const std::string& directory, const utils::Pose& pose, const utils::Motion_Model& motionModel);
+
+                /**
+                 * \brief Reset the local and global maps, and use the points and primitives of a snapshot as global map points and primitives. Only the points in view of the saved pose are loaded now, the others are paged in when the camera looks at them.
+                 * The primitives come back in the local map when they are detected again. The saved point and primitive ids are reserved, so the new points and primitives do not reuse them
+                 *
+                 * \param[in] directory The snapshot directory
+                 * \param[out] pose The saved pose of the observer
+                 * \param[out] motionModel Set to the saved motion model state
+                 *
+                 * \return True if the snapshot was loaded. The pose and motion model are only set in this case
+                 */
+                bool load_snapshot(const std::string& directory, utils::Pose& pose, utils::Motion_Model& motionModel);
+
 
                 /**
                  * \brief Compute a debug image to display the keypoints & primitives
@@ -89,24 +142,36 @@ namespace rgbd_slam {
                 // Define types
 
                 // local map point container
-                typedef std::map<size_t, Map_Point> point_map_container;
+                typedef Point_Container<Map_Point> point_map_container;
                 // staged points container
-                typedef std::map<size_t, Staged_Point> staged_point_container;
+                typedef Point_Container<Staged_Point> staged_point_container;
+                // keyframes of the local map window, oldest first
+                typedef std::deque<Keyframe, Eigen::aligned_allocator<Keyframe>> keyframe_container;
                 // local shape primitive map container
                 typedef std::map<size_t, Primitive> primitive_map_container; 
 
 
                 /**
-                 * \brief Compute a match for a given point, and update this point match index. It will update the _isPointMatched object if a point is matched
+                 * \brief Record the match between a point and a detected keypoint, and update the _isPointMatched object
+                 *
+                 * \param[in, out] point A map point matched to a detected point
+                 * \param[in] matchIndex The index of the detected point
+                 * \param[in] matchQuality Quality of the association in [0, 1]: 1 for a keypoint tracked by optical flow, 1 - descriptor distance ratio for a descriptor match
+                 * \param[in] detectedKeypointsObject An object to handle all detected points in an image
+                 * \param[in, out] matchedPoints A container associating the detected to the map points
+                 */
+                void add_match(IMap_Point_With_Tracking& point, const int matchIndex, const double matchQuality, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints);
+
+                /**
+                 * \brief Reset the match of a given point, and match it to its tracked keypoint if it has one. It will update the _isPointMatched object if a point is matched
                  *
                  * \param[in, out] point A map point that we want to match to detected points
                  * \param[in] detectedKeypointsObject An object to handle all detected points in an image
-                 * \param[in] worldToCamMatrix A matrix to transform a world point to a camera point
                  * \param[in, out] matchedPoints A container associating the detected to the map points
                  *
                  * \return A boolean indicating if this point was matched or not
                  */
-                bool find_match(IMap_Point_With_Tracking& point, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, const matrix44& worldToCamMatrix, matches_containers::match_point_container& matchedPoints);
+                bool find_tracking_match(IMap_Point_With_Tracking& point, const features::keypoints::Keypoint_Handler& detectedKeypointsObject, matches_containers::match_point_container& matchedPoints);
 
                 /**
                  * \brief Compute a match for a given primitive, and update this primitive match status.
@@ -121,7 +186,7 @@ namespace rgbd_slam {
                 bool find_match(Primitive& mapPrimitive, const features::primitives::primitive_container& detectedPrimitives, const matrix44& worldToCameraMatrix, matches_containers::match_primitive_container& matchedPrimitives);
 
                 /**
-                 * \brief Update the Matched/Unmatched status of a map point
+                 * \brief Update the Matched/Unmatched status of a map point. Only modifies this point, so it can be called concurrently on different points
                  *
                  * \param[in, out] mapPoint the map point to update
                  * \param[in] poseCovariance The covariance matrix of the optimized position of the observer
@@ -132,17 +197,22 @@ namespace rgbd_slam {
                 void update_point_match_status(IMap_Point_With_Tracking& mapPoint, const matrix33& poseCovariance, const features::keypoints::Keypoint_Handler& keypointObject, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix);
 
                 /**
-                 * \brief Update local keypoint map features 
+                 * \brief Update the Matched/Unmatched status of all the local map and staged points, in parallel
                  *
                  * \param[in] poseCovariance The covariance matrix of the optimized position of the observer
                  * \param[in] previousCameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz). It represents the last pose after optimization 
                  * \param[in] cameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz) It represent the current pose after optimization
                  * \param[in] keypointObject An object containing the detected key points in the rgbd frame. Must be the same as in find_matches
                  */
-                void update_local_keypoint_map(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject);
+                void update_point_match_statuses(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject);
 
                 /**
-                 * \brief Update the local primitive map features
+                 * \brief Move the lost local map points to the global map. Must be called after update_point_match_statuses
+                 */
+                void update_local_keypoint_map();
+
+                /**
+                 * \brief Update the local primitive map features. Unmatched primitives move to the global map, and the new primitives on a plane of the global map are restored from it
                  *
                  * \param[in] previousCameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz). It represents the last pose after optimization 
                  * \param[in] cameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz) It represent the current pose after optimization
@@ -151,14 +221,9 @@ namespace rgbd_slam {
                 void update_local_primitive_map(const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::primitives::primitive_container& detectedPrimitives);
 
                 /**
-                 * \brief Add previously uncertain keypoint features to the local map
-                 *
-                 * \param[in] poseCovariance The covariance matrix of the optimized position of the observer
-                 * \param[in] previousCameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz). It represent the last pose after optimization
-                 * \param[in] cameraToWorldMatrix A transformation matrix to go from a screen point (UVD) to a 3D world point (xyz). It represent the current pose after optimization
-                 * \param[in] keypointObject An object containing the detected key points in the rgbd frame. Must be the same as in find_matches
+                 * \brief Add previously uncertain keypoint features to the local map, and remove the unreliable ones. Must be called after update_point_match_statuses
                  */
-                void update_staged_keypoints_map(const matrix33& poseCovariance, const matrix44& previousCameraToWorldMatrix, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject);
+                void update_staged_keypoints_map();
 
                 /**
                  * \brief Add unmatched detected points to the staged map
@@ -170,9 +235,55 @@ namespace rgbd_slam {
                 void add_umatched_keypoints_to_staged_map(const matrix33& poseCovariance, const matrix44& cameraToWorldMatrix, const features::keypoints::Keypoint_Handler& keypointObject);
 
                 /**
-                 * \brief Clean the local map so it stays local, and update the global map with the good features
+                 * \brief Count the anchored and matched points of each keyframe, and create a new keyframe if the camera moved away from the last one. The matched points are anchored to the new keyframe, and their observations start a local bundle adjustment
+                 *
+                 * \param[in] optimizedPose The pose of the observer after optimization
+                 */
+                void update_keyframes(const utils::Pose& optimizedPose);
+
+                /**
+                 * \brief Check if a new keyframe should be created: the camera moved or rotated too far from the last keyframe, or too few of its points are still matched
+                 *
+                 * \param[in] optimizedPose The pose of the observer after optimization
+                 */
+                bool should_create_keyframe(const utils::Pose& optimizedPose) const;
+
+                /**
+                 * \brief Post the keyframe window to the local bundle adjustment thread, with the local map points observed from two keyframes at least. Does nothing if the thread is busy
+                 */
+                void request_bundle_adjustment();
+
+
+                /**
+                 * \return The keyframe with this id, or nullptr if it is not in the window
+                 */
+                Keyframe* find_keyframe(const size_t keyframeId);
+
+                /**
+                 * \brief Remove a point slot from the spatial index and tracked keypoints, and free it. The point itself must be removed from its container by the caller
+                 */
+                void release_point_slot(const size_t slot);
+
+                /**
+                 * \brief Evict the least useful local map and staged points, until they fit in the count and memory budgets.
+                 * The eviction score favors confident points, points observed in the last frame, and points in sparse areas. Evicted map points move to the global map, evicted staged points are dropped
+                 */
+                void enforce_point_budgets();
+
+                /**
+                 * \brief Move the global map points in view of the camera to the local map, anchored to the last keyframe. Only the closest points that fit in the local map point budget are moved
+                 *
+                 * \param[in] pose Pose of the observer, in world coordinates
+                 */
+                void page_in_global_points(const utils::Pose& pose);
+
+                /**
+                 * \brief Clean the local map so it stays local: remove the least relevant keyframes of the window, and move their points to the global map. Their points matched in the current frame are anchored to the newest keyframe instead.
+                 * When the camera returns to a known area, the global map points around it are moved back to the local map
+                 *
+                 * \param[in] optimizedPose The pose of the observer after optimization
                  */
-                void update_local_to_global();
+                void update_local_to_global(const utils::Pose& optimizedPose);
 
 
                 /**
@@ -191,27 +302,44 @@ namespace rgbd_slam {
                 /**
                  * \brief Mark all the outliers detected during optimization as unmatched
                  */
-                void mark_outliers_as_unmatched(const matches_containers::match_point_container& outlierMatchedPoints);
+                void mark_outliers_as_unmatched(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_container& outlierIndexes);
 
                 /**
-                 * \brief Mark a point with the id pointId as unmatched. Will search the staged and local map.
+                 * \brief Mark a point with the slot pointSlot as unmatched. Will search the staged and local map.
                  *
-                 * \param[in] pointId The uniq id of the point to unmatch
+                 * \param[in] pointSlot The map slot of the point to unmatch
                  * 
                  * \return true if the point was found and updated
                  */
-                bool mark_point_with_id_as_unmatched(const size_t pointId);
+                bool mark_point_with_slot_as_unmatched(const size_t pointSlot);
 
                 /**
                  * \brief mark a point as unmatched
                  */
-                void mark_point_with_id_as_unmatched(const size_t pointId, IMap_Point_With_Tracking& point);
+                void mark_point_as_unmatched(IMap_Point_With_Tracking& point);
 
             private:
                 // Local map contains world points with a good confidence
                 point_map_container _localPointMap;
                 // Staged points are potential new map points, waiting to confirm confidence
                 staged_point_container _stagedPoints;
+                // Dense slots of the local map and staged points
+                Point_Slot_Allocator _pointSlots;
+                // Spatial index of the local map and staged point slots
+                Point_Voxel_Index _pointIndex;
+                // Descriptors of the local map and staged points, by slot
+                Descriptor_Pool _descriptorPool;
+                // Screen coordinates of the matched points, for optical flow tracking
+                Tracked_Keypoint_List _trackedKeypoints;
+                // Keyframes anchoring the local map points
+                keyframe_container _keyframes;
+                size_t _nextKeyframeId;
+                // Index of the current frame, to delay the page in of the lost points
+                uint64_t _frameIndex;
+                // Adjusts the keyframe window on a background thread
+                Local_Bundle_Adjuster _bundleAdjuster;
+                // Points of the keyframes that left the window, stored on disk
+                Global_Map _globalMap;
                 // Hold unmatched detected point indexes, to add in the staged point container
                 std::vector<bool> _isPointMatched;
                 // Hold unmatched primitive ids
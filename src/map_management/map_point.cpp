@@ -6,17 +6,17 @@
 namespace rgbd_slam {
     namespace map_management {
 
-        Point::Point (const vector3& coordinates, const cv::Mat& descriptor) :
+        Point::Point (const vector3& coordinates, const size_t slot) :
             _coordinates(coordinates), 
-            _descriptor(descriptor),
+            _slot(slot),
             _id(Point::_currentPointId)
         {
             Point::_currentPointId += 1;
         }
 
-        Point::Point (const vector3& coordinates, const cv::Mat& descriptor, const size_t id) :
+        Point::Point (const vector3& coordinates, const size_t slot, const size_t id) :
             _coordinates(coordinates), 
-            _descriptor(descriptor),
+            _slot(slot),
             _id(id)
         {
             assert(id != INVALID_POINT_UNIQ_ID);
@@ -26,14 +26,14 @@ namespace rgbd_slam {
          *     Tracked point
          */
 
-        IMap_Point_With_Tracking::IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor)
-            : Point(coordinates, descriptor),
+        IMap_Point_With_Tracking::IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const size_t slot)
+            : Point(coordinates, slot),
             _covariance(covariance)
         {
             _matchedScreenPoint.mark_unmatched();
         }
-        IMap_Point_With_Tracking::IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id)
-            : Point(coordinates, descriptor, id),
+        IMap_Point_With_Tracking::IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id)
+            : Point(coordinates, slot, id),
             _covariance(covariance)
         {
             _matchedScreenPoint.mark_unmatched();
@@ -63,15 +63,15 @@ namespace rgbd_slam {
          *      Staged_Point
          */
 
-        Staged_Point::Staged_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor) :
-            IMap_Point_With_Tracking(coordinates, covariance, descriptor),
+        Staged_Point::Staged_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot) :
+            IMap_Point_With_Tracking(coordinates, covariance, slot),
 
             _matchesCount(0)
             {
             }
 
-        Staged_Point::Staged_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id) :
-            IMap_Point_With_Tracking(coordinates, covariance, descriptor, id),
+        Staged_Point::Staged_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id) :
+            IMap_Point_With_Tracking(coordinates, covariance, slot, id),
 
             _matchesCount(0)
             {
@@ -111,19 +111,19 @@ namespace rgbd_slam {
          */
 
 
-        Map_Point::Map_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor) :
-            IMap_Point_With_Tracking(coordinates, covariance, descriptor),
+        Map_Point::Map_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot) :
+            IMap_Point_With_Tracking(coordinates, covariance, slot),
 
             _failTrackingCount(0),
             _age(0)
         {
         }
 
-        Map_Point::Map_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id) :
-            IMap_Point_With_Tracking(coordinates, covariance, descriptor, id),
+        Map_Point::Map_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id, const int age) :
+            IMap_Point_With_Tracking(coordinates, covariance, slot, id),
 
             _failTrackingCount(0),
-            _age(0)
+            _age(age)
         {
         }
 
@@ -2,8 +2,11 @@
 #define RGBDSLAM_MAPMANAGEMENT_MAPPOINT_HPP
 
 #include "types.hpp"
+#include "keyframe.hpp"
 
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <limits>
 
 
 
@@ -11,6 +14,7 @@ namespace rgbd_slam {
     namespace map_management {
 
         const size_t INVALID_POINT_UNIQ_ID = 0; // This id indicates an invalid unique id for a map point
+        const size_t INVALID_POINT_SLOT = std::numeric_limits<size_t>::max(); // This slot indicates a point without a map slot
         const int UNMATCHED_POINT_INDEX = -1;      // Id of a unmatched point
 
         struct MatchedScreenPoint
@@ -52,16 +56,27 @@ namespace rgbd_slam {
             // world coordinates
             vector3 _coordinates;
 
-            // 3D descriptor (SURF)
-            cv::Mat _descriptor;
+            // dense index of this point in the map, reused after the point removal. Used to find the tracked keypoint of this point
+            // Not const, so points can be moved in the contiguous map containers
+            size_t _slot;
 
             // unique identifier, to match this point without using descriptors
-            const size_t _id;
+            size_t _id;
+
+            /**
+             * \brief Return the id of the next created point
+             */
+            static size_t get_next_id() { return _currentPointId; };
+
+            /**
+             * \brief Make sure the ids of the next points are at least nextId, so they do not collide with the ids of loaded points
+             */
+            static void reserve_ids(const size_t nextId) { _currentPointId = std::max(_currentPointId, nextId); };
 
             protected:
-            Point (const vector3& coordinates, const cv::Mat& descriptor);
+            Point (const vector3& coordinates, const size_t slot);
             // copy constructor
-            Point (const vector3& coordinates, const cv::Mat& descriptor, const size_t id);
+            Point (const vector3& coordinates, const size_t slot, const size_t id);
 
             inline static size_t _currentPointId = 1;   // 0 is invalid
         };
@@ -72,8 +87,8 @@ namespace rgbd_slam {
         struct IMap_Point_With_Tracking
             : public Point
         {
-            IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor);
-            IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id);
+            IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const size_t slot);
+            IMap_Point_With_Tracking(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id);
             /**
              * \brief Compute a confidence in this point (-1, 1)
              */
@@ -114,8 +129,8 @@ namespace rgbd_slam {
             : public IMap_Point_With_Tracking
         {
             public:
-                Staged_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor);
-                Staged_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id);
+                Staged_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot);
+                Staged_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id);
 
                 // Count the number of times his points was matched
                 int _matchesCount;
@@ -156,8 +171,11 @@ namespace rgbd_slam {
         {
 
             public:
-                Map_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor);
-                Map_Point(const vector3& coordinates, const matrix33& covariance, const cv::Mat& descriptor, const size_t id);
+                Map_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot);
+                /**
+                 * \param[in] age The successful matches count of the point, when it comes back from the global map
+                 */
+                Map_Point(const vector3& coordinates, const matrix33& covariance, const size_t slot, const size_t id, const int age = 0);
 
 
                 /**
@@ -179,6 +197,9 @@ namespace rgbd_slam {
                     return _age;
                 }
 
+                // Id of the last keyframe that observed this point. The point leaves the local map with this keyframe
+                size_t _keyframeId = INVALID_KEYFRAME_ID;
+
             protected:
                 /**
                  * \brief Compute a confidence score (-1, 1)
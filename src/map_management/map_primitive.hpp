@@ -2,6 +2,12 @@
 #define RGBDSLAM_MAPMANAGEMENT_MAPRIMITIVE_HPP
 
 #include "shape_primitives.hpp"
+#include "types.hpp"
+#include "parameters.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 namespace rgbd_slam {
     namespace map_management {
@@ -29,27 +35,118 @@ namespace rgbd_slam {
 
         struct Primitive 
         {
-            Primitive(features::primitives::primitive_uniq_ptr primitive): 
+            /**
+             * \brief Add a detected primitive to the map
+             *
+             * \param[in] primitive The detected primitive, in camera space
+             * \param[in] cameraToWorldMatrix The transformation of the camera that detected this primitive
+             */
+            Primitive(features::primitives::primitive_uniq_ptr primitive, const matrix44& cameraToWorldMatrix): 
                 _id(_currentPrimitiveId++),
-                _primitive(std::move(primitive))
-            {
-                cv::Vec3b color;
-                color[0] = rand() % 255;
-                color[1] = rand() % 255;
-                color[2] = rand() % 255;
-                _color = color;
-            };
+                _primitive(std::move(primitive)),
+                _worldPlane(get_world_plane(_primitive, cameraToWorldMatrix)),
+                _isAxis(_primitive->get_primitive_type() == features::primitives::PrimitiveType::Cylinder),
+                _color(get_random_color())
+            {};
+
+            /**
+             * \brief Restore a primitive of the global map that was detected again
+             *
+             * \param[in] primitive The detected primitive, in camera space
+             * \param[in] id The identifier of the stored primitive
+             * \param[in] worldPlane The parameters of the stored primitive in world space
+             */
+            Primitive(features::primitives::primitive_uniq_ptr primitive, const size_t id, const vector4& worldPlane): 
+                _id(id),
+                _primitive(std::move(primitive)),
+                _worldPlane(worldPlane),
+                _isAxis(_primitive->get_primitive_type() == features::primitives::PrimitiveType::Cylinder),
+                _color(get_random_color())
+            {};
 
             // Unique identifier of this primitive in map
             const size_t _id;
 
+            /**
+             * \brief Return the parameters (normal, d) of a primitive in its camera space. Cylinders do not have a plane distance, and return their axis with a null d
+             */
+            static vector4 get_camera_plane(const features::primitives::primitive_uniq_ptr& primitive)
+            {
+                vector4 cameraPlane;
+                cameraPlane << primitive->_normal, 0.0;
+                if (primitive->get_primitive_type() == features::primitives::PrimitiveType::Plane)
+                {
+                    const features::primitives::Plane* plane = dynamic_cast<const features::primitives::Plane*>(primitive.get());
+                    if (plane != nullptr)
+                        cameraPlane(3) = plane->_d;
+                    else
+                        utils::log_error("Failed attempt to convert a primitive indicated as a plane to a plane");
+                }
+                return cameraPlane;
+            }
+
+            /**
+             * \brief Return the parameters (normal, d) of a primitive in world space: the normal is rotated, and the plane distance is shifted by the camera position
+             */
+            static vector4 get_world_plane(const features::primitives::primitive_uniq_ptr& primitive, const matrix44& cameraToWorldMatrix)
+            {
+                const vector4& cameraPlane = get_camera_plane(primitive);
+                const bool isAxis = primitive->get_primitive_type() == features::primitives::PrimitiveType::Cylinder;
+                const vector3& worldNormal = cameraToWorldMatrix.block<3, 3>(0, 0) * cameraPlane.head<3>();
+                const double worldD = isAxis ? 0.0 : cameraPlane(3) - worldNormal.dot(cameraToWorldMatrix.block<3, 1>(0, 3));
+
+                vector4 worldPlane;
+                worldPlane << worldNormal, worldD;
+                return worldPlane;
+            }
+
+            /**
+             * \brief Check if two world planes are the same plane of the scene: close normals (of any sign) and plane distances. Axes only compare their directions
+             */
+            static bool is_same_world_plane(const vector4& worldPlane, const vector4& otherWorldPlane, const bool isAxis)
+            {
+                const double normalDot = worldPlane.head<3>().dot(otherWorldPlane.head<3>());
+                if (std::abs(normalDot) < Parameters::get_maximum_plane_match_angle())
+                    return false;
+                if (isAxis)
+                    return true;
+
+                // Opposite normals describe the same plane with opposite distances
+                const double otherD = normalDot < 0 ? -otherWorldPlane(3) : otherWorldPlane(3);
+                return std::abs(worldPlane(3) - otherD) <= Parameters::get_maximum_merge_distance();
+            }
+
+            /**
+             * \brief Return the id of the next created primitive
+             */
+            static size_t get_next_id() { return _currentPrimitiveId; };
+
+            /**
+             * \brief Make sure the ids of the next primitives are at least nextId, so they do not collide with the ids of loaded primitives
+             */
+            static void reserve_ids(const size_t nextId) { _currentPrimitiveId = std::max(_currentPrimitiveId, nextId); };
+
             const features::primitives::primitive_uniq_ptr _primitive;
             MatchedPrimitive _matchedPrimitive;
 
+            // Parameters (normal, d) of this primitive in world space, with normal.dot(point) + d = 0
+            vector4 _worldPlane;
+            // True if this primitive only constrains an orientation (cylinder axis)
+            const bool _isAxis;
+
             cv::Scalar _color;  // display color of this primitive
 
 
             private:
+            static cv::Scalar get_random_color()
+            {
+                cv::Vec3b color;
+                color[0] = rand() % 255;
+                color[1] = rand() % 255;
+                color[2] = rand() % 255;
+                return color;
+            }
+
             inline static size_t _currentPrimitiveId = 1;   // 0 is invalid
         };
 
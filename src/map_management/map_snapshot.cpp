@@ -0,0 +1,143 @@
+#include "map_snapshot.hpp"
+
+#include "logger.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        const char MAP_SNAPSHOT_MAGIC[8] = {'R', 'G', 'B', 'D', 'M', 'A', 'P', '\0'};
+        const std::string MAP_SNAPSHOT_HEADER_FILE = "/snapshot.header";
+        const std::string MAP_SNAPSHOT_PRIMITIVE_FILE = "/snapshot.primitives";
+
+        bool write_map_snapshot_header(const std::string& directory, Map_Snapshot_Header& header)
+        {
+            std::memcpy(header._magic, MAP_SNAPSHOT_MAGIC, sizeof(header._magic));
+            header._version = MAP_SNAPSHOT_VERSION;
+            header._pointRecordSize = sizeof(Global_Point_Record);
+            header._primitiveRecordSize = sizeof(Global_Primitive_Record);
+
+            const std::string& headerPath = directory + MAP_SNAPSHOT_HEADER_FILE;
+            std::ofstream headerFile(headerPath, std::ios_base::binary | std::ios_base::trunc);
+            if (not headerFile.is_open())
+            {
+                utils::log_error("Could not open map snapshot header " + headerPath);
+                return false;
+            }
+            headerFile.write(reinterpret_cast<const char*>(&header), sizeof(Map_Snapshot_Header));
+            return headerFile.good();
+        }
+
+        bool write_map_snapshot_primitives(const std::string& directory, const std::vector<Global_Primitive_Record>& primitives)
+        {
+            const std::string& primitivePath = directory + MAP_SNAPSHOT_PRIMITIVE_FILE;
+            std::ofstream primitiveFile(primitivePath, std::ios_base::binary | std::ios_base::trunc);
+            if (not primitiveFile.is_open())
+            {
+                utils::log_error("Could not open map snapshot primitives " + primitivePath);
+                return false;
+            }
+            primitiveFile.write(reinterpret_cast<const char*>(primitives.data()), primitives.size() * sizeof(Global_Primitive_Record));
+            return primitiveFile.good();
+        }
+
+        bool read_map_snapshot_primitives(const std::string& directory, std::vector<Global_Primitive_Record>& primitives)
+        {
+            primitives.clear();
+
+            const std::string& primitivePath = directory + MAP_SNAPSHOT_PRIMITIVE_FILE;
+            std::error_code error;
+            const uintmax_t fileSize = std::filesystem::file_size(primitivePath, error);
+            if (error)
+            {
+                utils::log_error("Could not open map snapshot primitives " + primitivePath + ": " + error.message());
+                return false;
+            }
+            if (fileSize % sizeof(Global_Primitive_Record) != 0)
+            {
+                utils::log_error("Map snapshot primitives are truncated: " + primitivePath);
+                return false;
+            }
+
+            std::ifstream primitiveFile(primitivePath, std::ios_base::binary);
+            if (not primitiveFile.is_open())
+            {
+                utils::log_error("Could not open map snapshot primitives " + primitivePath);
+                return false;
+            }
+            primitives.resize(fileSize / sizeof(Global_Primitive_Record));
+            primitiveFile.read(reinterpret_cast<char*>(primitives.data()), fileSize);
+            if (not primitiveFile.good())
+            {
+                utils::log_error("Could not read map snapshot primitives " + primitivePath);
+                primitives.clear();
+                return false;
+            }
+            return true;
+        }
+
+        bool remove_map_snapshot(const std::string& directory)
+        {
+            const std::string& headerPath = directory + MAP_SNAPSHOT_HEADER_FILE;
+            std::error_code error;
+            if (not std::filesystem::exists(headerPath, error))
+            {
+                if (Global_Map::has_tile_files(directory))
+                {
+                    utils::log_error("The directory " + directory + " contains map tiles, but no map snapshot: they are not overwritten");
+                    return false;
+                }
+                return true;
+            }
+
+            std::filesystem::remove(headerPath, error);
+            if (error)
+            {
+                utils::log_error("Could not remove map snapshot header " + headerPath + ": " + error.message());
+                return false;
+            }
+            // Snapshots of older versions have no primitive file
+            const std::string& primitivePath = directory + MAP_SNAPSHOT_PRIMITIVE_FILE;
+            std::filesystem::remove(primitivePath, error);
+            if (error)
+            {
+                utils::log_error("Could not remove map snapshot primitives " + primitivePath + ": " + error.message());
+                return false;
+            }
+            return Global_Map::remove_tile_files(directory);
+        }
+
+        bool read_map_snapshot_header(const std::string& directory, Map_Snapshot_Header& header)
+        {
+            const std::string& headerPath = directory + MAP_SNAPSHOT_HEADER_FILE;
+            std::ifstream headerFile(headerPath, std::ios_base::binary);
+            if (not headerFile.is_open())
+            {
+                utils::log_error("Could not open map snapshot header " + headerPath);
+                return false;
+            }
+            headerFile.read(reinterpret_cast<char*>(&header), sizeof(Map_Snapshot_Header));
+            if (not headerFile.good())
+            {
+                utils::log_error("Map snapshot header is truncated: " + headerPath);
+                return false;
+            }
+
+            if (std::memcmp(header._magic, MAP_SNAPSHOT_MAGIC, sizeof(header._magic)) != 0)
+            {
+                utils::log_error("Not a map snapshot: " + headerPath);
+                return false;
+            }
+            if (header._version != MAP_SNAPSHOT_VERSION or header._pointRecordSize != sizeof(Global_Point_Record) or header._primitiveRecordSize != sizeof(Global_Primitive_Record))
+            {
+                utils::log_error("Map snapshot version " + std::to_string(header._version) + " is not supported (expected " + std::to_string(MAP_SNAPSHOT_VERSION) + ")");
+                return false;
+            }
+            return true;
+        }
+
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_MAP_SNAPSHOT_HPP
+#define RGBDSLAM_MAPMANAGEMENT_MAP_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+#include "global_map.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        // Increment when the header, the point record or the primitive record layout changes
+        const uint32_t MAP_SNAPSHOT_VERSION = 6;
+
+        /**
+         * \brief Header of a map snapshot directory. The map points are stored next to it, in the global map tile files, and the world space primitives in a primitive file
+         */
+        struct Map_Snapshot_Header
+        {
+            char _magic[8];
+            uint32_t _version;
+            // Size of a point record in the tile files, to detect a layout change without a version change
+            uint32_t _pointRecordSize;
+            // Size of a primitive record in the primitive file
+            uint32_t _primitiveRecordSize;
+            // Size of the tile edges, in millimeters
+            uint32_t _tileSize;
+            // Next unique point and primitive ids, so new points and primitives do not reuse the saved ids
+            uint64_t _nextPointId;
+            uint64_t _nextPrimitiveId;
+
+            // Last pose of the observer
+            double _position[3];
+            double _orientation[4];     // x, y, z, w
+
+            // Motion model state
+            double _motionModelLastOrientation[4];
+            double _motionModelAngularVelocity[4];
+            double _motionModelLastPosition[3];
+            double _motionModelLinearVelocity[3];
+        };
+        static_assert(std::is_trivially_copyable_v<Map_Snapshot_Header>, "Map snapshot headers are written as raw bytes");
+
+        /**
+         * \brief Write a snapshot header in a snapshot directory. Sets the magic, version and record size fields
+         *
+         * \return True if the header was written
+         */
+        bool write_map_snapshot_header(const std::string& directory, Map_Snapshot_Header& header);
+
+        /**
+         * \brief Write the world space primitives of a snapshot in its directory
+         *
+         * \return True if the primitives were written
+         */
+        bool write_map_snapshot_primitives(const std::string& directory, const std::vector<Global_Primitive_Record>& primitives);
+
+        /**
+         * \brief Read the world space primitives of a snapshot directory
+         *
+         * \return True if the primitive file was read entirely
+         */
+        bool read_map_snapshot_primitives(const std::string& directory, std::vector<Global_Primitive_Record>& primitives);
+
+        /**
+         * \brief Remove the files of a snapshot directory, if any: the header first, so an interrupted removal leaves no valid header, then the primitives and the tiles.
+         * Called before overwriting a snapshot. The tiles of a directory without a snapshot header were not written by a snapshot, and are never removed
+         *
+         * \return True if the directory contains no snapshot file anymore, and can receive a new snapshot
+         */
+        bool remove_map_snapshot(const std::string& directory);
+
+        /**
+         * \brief Read and check the header of a snapshot directory
+         *
+         * \return True if the header is valid and compatible with this program
+         */
+        bool read_map_snapshot_header(const std::string& directory, Map_Snapshot_Header& header);
+
+    }
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_POINT_CONTAINER_HPP
+#define RGBDSLAM_MAPMANAGEMENT_POINT_CONTAINER_HPP
+
+#include <vector>
+#include <limits>
+#include <cassert>
+
+#include "map_point.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Store points contiguously, with their map slot as a stable handle. Deletion moves the last point in the place of the deleted one, so the iteration order is not stable
+         *
+         * \tparam PointType A point type with a _slot member (a slot is used by at most one point of the container)
+         */
+        template<class PointType>
+        class Point_Container
+        {
+            public:
+                typedef typename std::vector<PointType>::iterator iterator;
+                typedef typename std::vector<PointType>::const_iterator const_iterator;
+
+                /**
+                 * \brief Add a point to this container
+                 *
+                 * \return A reference to the inserted point, valid until the next insertion or deletion
+                 */
+                PointType& insert(const PointType& point)
+                {
+                    const size_t slot = point._slot;
+                    assert(slot != INVALID_POINT_SLOT);
+                    if (slot >= _slotToIndex.size())
+                        _slotToIndex.resize(slot + 1, INVALID_INDEX);
+                    assert(_slotToIndex[slot] == INVALID_INDEX);
+
+                    _slotToIndex[slot] = _points.size();
+                    _points.push_back(point);
+                    return _points.back();
+                }
+
+                /**
+                 * \brief Remove the point at the given dense index, by moving the last point in its place
+                 */
+                void erase(const size_t index)
+                {
+                    assert(index < _points.size());
+                    _slotToIndex[_points[index]._slot] = INVALID_INDEX;
+
+                    const size_t lastIndex = _points.size() - 1;
+                    if (index != lastIndex)
+                    {
+                        _points[index] = std::move(_points[lastIndex]);
+                        _slotToIndex[_points[index]._slot] = index;
+                    }
+                    _points.pop_back();
+                }
+
+                /**
+                 * \brief Remove the point in this slot, if it is in this container
+                 */
+                void erase_slot(const size_t slot)
+                {
+                    if (slot < _slotToIndex.size() and _slotToIndex[slot] != INVALID_INDEX)
+                        erase(_slotToIndex[slot]);
+                }
+
+                /**
+                 * \brief Return the point in this slot, or nullptr if this slot is not in this container
+                 */
+                PointType* find(const size_t slot)
+                {
+                    if (slot < _slotToIndex.size() and _slotToIndex[slot] != INVALID_INDEX)
+                        return &_points[_slotToIndex[slot]];
+                    return nullptr;
+                }
+                const PointType* find(const size_t slot) const
+                {
+                    if (slot < _slotToIndex.size() and _slotToIndex[slot] != INVALID_INDEX)
+                        return &_points[_slotToIndex[slot]];
+                    return nullptr;
+                }
+
+                void clear()
+                {
+                    _points.clear();
+                    _slotToIndex.clear();
+                }
+
+                size_t size() const { return _points.size(); };
+                bool empty() const { return _points.empty(); };
+
+                PointType& operator[](const size_t index) { assert(index < _points.size()); return _points[index]; };
+                const PointType& operator[](const size_t index) const { assert(index < _points.size()); return _points[index]; };
+
+                iterator begin() { return _points.begin(); };
+                iterator end() { return _points.end(); };
+                const_iterator begin() const { return _points.cbegin(); };
+                const_iterator end() const { return _points.cend(); };
+
+            private:
+                static constexpr size_t INVALID_INDEX = std::numeric_limits<size_t>::max();
+
+                // Points, stored contiguously
+                std::vector<PointType> _points;
+                // Dense index of the point in each map slot, or INVALID_INDEX
+                std::vector<size_t> _slotToIndex;
+        };
+
+    }
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include "point_slot_allocator.hpp"
+
+#include <cassert>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        Point_Slot_Allocator::Point_Slot_Allocator() :
+            _slotCount(0)
+        {
+        }
+
+        size_t Point_Slot_Allocator::allocate()
+        {
+            if (_freeSlots.empty())
+                return _slotCount++;
+
+            const size_t slot = _freeSlots.back();
+            _freeSlots.pop_back();
+            return slot;
+        }
+
+        void Point_Slot_Allocator::release(const size_t slot)
+        {
+            assert(slot < _slotCount);
+            _freeSlots.push_back(slot);
+        }
+
+        void Point_Slot_Allocator::reset()
+        {
+            _freeSlots.clear();
+            _slotCount = 0;
+        }
+
+    }
+}
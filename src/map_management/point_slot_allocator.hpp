@@ -0,0 +1,46 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_POINT_SLOT_ALLOCATOR_HPP
+#define RGBDSLAM_MAPMANAGEMENT_POINT_SLOT_ALLOCATOR_HPP
+
+#include <vector>
+#include <cstddef>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Hands out dense slot indexes to the map points. Slots of removed points are reused, so the slots stay compact and can index arrays directly
+         */
+        class Point_Slot_Allocator
+        {
+            public:
+                Point_Slot_Allocator();
+
+                /**
+                 * \brief Return a free slot, reusing a released one if possible
+                 */
+                size_t allocate();
+
+                /**
+                 * \brief Mark a slot as free, so it can be given to another point
+                 */
+                void release(const size_t slot);
+
+                /**
+                 * \brief Release all slots
+                 */
+                void reset();
+
+                /**
+                 * \brief Return the number of slots ever allocated: all slots are smaller than this value
+                 */
+                size_t get_capacity() const { return _slotCount; };
+
+            private:
+                std::vector<size_t> _freeSlots;
+                size_t _slotCount;
+        };
+
+    }
+}
+
+#endif
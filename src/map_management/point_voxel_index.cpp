@@ -0,0 +1,150 @@
+#include "point_voxel_index.hpp"
+
+#include "parameters.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        // Voxel coordinates are stored on 21 bits each in the voxel keys
+        const int VOXEL_COORDINATE_BITS = 21;
+        const int64_t VOXEL_COORDINATE_OFFSET = int64_t(1) << (VOXEL_COORDINATE_BITS - 1);
+        const uint64_t VOXEL_COORDINATE_MASK = (uint64_t(1) << VOXEL_COORDINATE_BITS) - 1;
+        const uint64_t INVALID_VOXEL_KEY = std::numeric_limits<uint64_t>::max();
+
+        Point_Voxel_Index::Point_Voxel_Index(const double voxelSize) :
+            _voxelSize(voxelSize)
+        {
+            assert(_voxelSize > 0);
+        }
+
+        Point_Voxel_Index::voxel_key Point_Voxel_Index::get_voxel_key(const vector3& coordinates) const
+        {
+            voxel_key key = 0;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const int64_t voxelCoordinate = static_cast<int64_t>(std::floor(coordinates[axis] / _voxelSize)) + VOXEL_COORDINATE_OFFSET;
+                assert(voxelCoordinate >= 0 and static_cast<uint64_t>(voxelCoordinate) <= VOXEL_COORDINATE_MASK);
+                key |= (static_cast<uint64_t>(voxelCoordinate) & VOXEL_COORDINATE_MASK) << (axis * VOXEL_COORDINATE_BITS);
+            }
+            return key;
+        }
+
+        const vector3 Point_Voxel_Index::get_voxel_center(const voxel_key key) const
+        {
+            vector3 center;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const int64_t voxelCoordinate = static_cast<int64_t>((key >> (axis * VOXEL_COORDINATE_BITS)) & VOXEL_COORDINATE_MASK) - VOXEL_COORDINATE_OFFSET;
+                center[axis] = (static_cast<double>(voxelCoordinate) + 0.5) * _voxelSize;
+            }
+            return center;
+        }
+
+        void Point_Voxel_Index::insert(const size_t slot, const vector3& coordinates)
+        {
+            if (slot >= _slotVoxels.size())
+                _slotVoxels.resize(slot + 1, INVALID_VOXEL_KEY);
+            assert(_slotVoxels[slot] == INVALID_VOXEL_KEY);
+
+            const voxel_key key = get_voxel_key(coordinates);
+            _slotVoxels[slot] = key;
+            _voxels[key].push_back(slot);
+        }
+
+        void Point_Voxel_Index::update(const size_t slot, const vector3& coordinates)
+        {
+            assert(slot < _slotVoxels.size() and _slotVoxels[slot] != INVALID_VOXEL_KEY);
+
+            const voxel_key key = get_voxel_key(coordinates);
+            const voxel_key previousKey = _slotVoxels[slot];
+            if (key == previousKey)
+                return;
+
+            remove_from_voxel(slot, previousKey);
+            _slotVoxels[slot] = key;
+            _voxels[key].push_back(slot);
+        }
+
+        void Point_Voxel_Index::erase(const size_t slot)
+        {
+            assert(slot < _slotVoxels.size() and _slotVoxels[slot] != INVALID_VOXEL_KEY);
+
+            remove_from_voxel(slot, _slotVoxels[slot]);
+            _slotVoxels[slot] = INVALID_VOXEL_KEY;
+        }
+
+        size_t Point_Voxel_Index::get_voxel_point_count(const size_t slot) const
+        {
+            assert(slot < _slotVoxels.size() and _slotVoxels[slot] != INVALID_VOXEL_KEY);
+            return _voxels.at(_slotVoxels[slot]).size();
+        }
+
+        void Point_Voxel_Index::clear()
+        {
+            _voxels.clear();
+            _slotVoxels.clear();
+        }
+
+        void Point_Voxel_Index::remove_from_voxel(const size_t slot, const voxel_key key)
+        {
+            std::unordered_map<voxel_key, std::vector<size_t>>::iterator voxelIterator = _voxels.find(key);
+            assert(voxelIterator != _voxels.end());
+
+            std::vector<size_t>& voxelSlots = voxelIterator->second;
+            std::vector<size_t>::iterator slotIterator = std::find(voxelSlots.begin(), voxelSlots.end(), slot);
+            assert(slotIterator != voxelSlots.end());
+
+            // Swap remove, the order of the slots in a voxel is not important
+            *slotIterator = voxelSlots.back();
+            voxelSlots.pop_back();
+            if (voxelSlots.empty())
+                _voxels.erase(voxelIterator);
+        }
+
+        void Point_Voxel_Index::get_visible_slots(const matrix44& worldToCameraMatrix, const double imageWidth, const double imageHeight, std::vector<size_t>& slots) const
+        {
+            const double cameraFX = Parameters::get_camera_1_focal_x();
+            const double cameraFY = Parameters::get_camera_1_focal_y();
+            const double cameraCX = Parameters::get_camera_1_center_x();
+            const double cameraCY = Parameters::get_camera_1_center_y();
+
+            // Frustum planes in camera space, all going through the camera center, with normals pointing inside the frustum
+            const vector3 frustumNormals[] = {
+                vector3(0.0, 0.0, 1.0),                                     // near plane
+                vector3(cameraFX, 0.0, cameraCX).normalized(),              // left plane (u >= 0)
+                vector3(-cameraFX, 0.0, imageWidth - cameraCX).normalized(),// right plane (u <= width)
+                vector3(0.0, cameraFY, cameraCY).normalized(),              // top plane (v >= 0)
+                vector3(0.0, -cameraFY, imageHeight - cameraCY).normalized()// bottom plane (v <= height)
+            };
+
+            // Radius of the sphere containing a voxel
+            const double voxelRadius = _voxelSize * sqrt(3.0) / 2.0;
+            const matrix33& rotation = worldToCameraMatrix.block<3, 3>(0, 0);
+            const vector3& translation = worldToCameraMatrix.block<3, 1>(0, 3);
+
+            slots.clear();
+            for (const auto& [key, voxelSlots] : _voxels)
+            {
+                const vector3& voxelCenter = rotation * get_voxel_center(key) + translation;
+
+                bool isVisible = true;
+                for (const vector3& frustumNormal : frustumNormals)
+                {
+                    if (frustumNormal.dot(voxelCenter) < -voxelRadius)
+                    {
+                        isVisible = false;
+                        break;
+                    }
+                }
+                if (isVisible)
+                    slots.insert(slots.end(), voxelSlots.cbegin(), voxelSlots.cend());
+            }
+        }
+
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_POINT_VOXEL_INDEX_HPP
+#define RGBDSLAM_MAPMANAGEMENT_POINT_VOXEL_INDEX_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "types.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Spatial index of the map point slots, in a hash of voxels. Only occupied voxels are stored, so it can be queried in time proportional to the occupied space instead of the point count
+         */
+        class Point_Voxel_Index
+        {
+            public:
+                /**
+                 * \param[in] voxelSize Size of the voxel edges, in millimeters
+                 */
+                Point_Voxel_Index(const double voxelSize);
+
+                /**
+                 * \brief Add a point slot at the given coordinates
+                 */
+                void insert(const size_t slot, const vector3& coordinates);
+
+                /**
+                 * \brief Move a point slot to new coordinates. Does nothing if the point stays in the same voxel
+                 */
+                void update(const size_t slot, const vector3& coordinates);
+
+                /**
+                 * \brief Remove a point slot from the index
+                 */
+                void erase(const size_t slot);
+
+                /**
+                 * \brief Return the number of points in the voxel of this slot, including itself
+                 */
+                size_t get_voxel_point_count(const size_t slot) const;
+
+                /**
+                 * \brief Remove all the point slots
+                 */
+                void clear();
+
+                /**
+                 * \brief Get the slots of the points in the voxels that intersect the camera frustum
+                 *
+                 * \param[in] worldToCameraMatrix A matrix to transform a world point to a camera point
+                 * \param[in] imageWidth The image width, in pixels
+                 * \param[in] imageHeight The image height, in pixels
+                 * \param[out] slots The slots of the points that can be visible. Some of them can be slightly out of the frustum
+                 */
+                void get_visible_slots(const matrix44& worldToCameraMatrix, const double imageWidth, const double imageHeight, std::vector<size_t>& slots) const;
+
+            private:
+                typedef uint64_t voxel_key;
+
+                /**
+                 * \brief Compute the key of the voxel containing those coordinates
+                 */
+                voxel_key get_voxel_key(const vector3& coordinates) const;
+
+                /**
+                 * \brief Compute the world coordinates of the center of a voxel
+                 */
+                const vector3 get_voxel_center(const voxel_key key) const;
+
+                void remove_from_voxel(const size_t slot, const voxel_key key);
+
+                const double _voxelSize;
+
+                // Slots of the points in each occupied voxel
+                std::unordered_map<voxel_key, std::vector<size_t>> _voxels;
+                // Voxel key of each slot, or INVALID_VOXEL_KEY
+                std::vector<voxel_key> _slotVoxels;
+        };
+
+    }
+}
+
+#endif
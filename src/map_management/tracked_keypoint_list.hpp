@@ -0,0 +1,81 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_TRACKED_KEYPOINT_LIST_HPP
+#define RGBDSLAM_MAPMANAGEMENT_TRACKED_KEYPOINT_LIST_HPP
+
+#include <vector>
+#include <limits>
+#include <cassert>
+
+#include "types.hpp"
+#include "keypoint_handler.hpp"
+
+namespace rgbd_slam {
+    namespace map_management {
+
+        /**
+         * \brief Screen coordinates of the matched map points, maintained when the matches are set and cleared, to be tracked by optical flow in the next frame
+         */
+        class Tracked_Keypoint_List
+        {
+            public:
+                /**
+                 * \brief Set the tracked screen coordinates of the point in this slot
+                 */
+                void set(const size_t slot, const vector2& screenCoordinates)
+                {
+                    const cv::Point2f keypoint(static_cast<float>(screenCoordinates.x()), static_cast<float>(screenCoordinates.y()));
+                    if (slot >= _slotToIndex.size())
+                        _slotToIndex.resize(slot + 1, INVALID_INDEX);
+
+                    const size_t index = _slotToIndex[slot];
+                    if (index != INVALID_INDEX)
+                    {
+                        _trackedKeypoints._keypoints[index] = keypoint;
+                        return;
+                    }
+                    _slotToIndex[slot] = _trackedKeypoints._ids.size();
+                    _trackedKeypoints._keypoints.push_back(keypoint);
+                    _trackedKeypoints._ids.push_back(slot);
+                }
+
+                /**
+                 * \brief Stop tracking the point in this slot, if it was tracked. The last tracked point takes its place
+                 */
+                void remove(const size_t slot)
+                {
+                    if (slot >= _slotToIndex.size() or _slotToIndex[slot] == INVALID_INDEX)
+                        return;
+
+                    const size_t index = _slotToIndex[slot];
+                    const size_t lastIndex = _trackedKeypoints._ids.size() - 1;
+                    if (index != lastIndex)
+                    {
+                        _trackedKeypoints._keypoints[index] = _trackedKeypoints._keypoints[lastIndex];
+                        _trackedKeypoints._ids[index] = _trackedKeypoints._ids[lastIndex];
+                        _slotToIndex[_trackedKeypoints._ids[index]] = index;
+                    }
+                    _trackedKeypoints._keypoints.pop_back();
+                    _trackedKeypoints._ids.pop_back();
+                    _slotToIndex[slot] = INVALID_INDEX;
+                }
+
+                void clear()
+                {
+                    _trackedKeypoints._keypoints.clear();
+                    _trackedKeypoints._ids.clear();
+                    _slotToIndex.clear();
+                }
+
+                const features::keypoints::KeypointsWithIdStruct& get_keypoints() const { return _trackedKeypoints; };
+
+            private:
+                static constexpr size_t INVALID_INDEX = std::numeric_limits<size_t>::max();
+
+                features::keypoints::KeypointsWithIdStruct _trackedKeypoints;
+                // Index of each slot in _trackedKeypoints, or INVALID_INDEX
+                std::vector<size_t> _slotToIndex;
+        };
+
+    }
+}
+
+#endif
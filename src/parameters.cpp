@@ -93,26 +93,30 @@ namespace rgbd_slam {
     void Parameters::set_parameters()
     {
         // Point detection/Matching
-        _matchSearchRadius = 30;
+        _matchSearchRadius = 60;        // Search radius used when the projected point uncertainty is high (fast motion)
+        _matchSearchMinimumRadius = 10; // Search radius used when the projected point uncertainty is low (steady camera)
+        _mapPointVoxelSize = 500;       // Map points are indexed in voxels of this size (millimeters), to find the points in the camera frustum
         _matchSearchCellSize = 50;
         _maximumMatchDistance = 0.7;    // The closer to 0, the more discriminating
         _detectorMinHessian = 40;       // The higher the least detected points
-        _keypointRefreshFrequency = 5;  // Update the keypoint list every N calls
+        _keypointMinimumCellCoverage = 0.5;     // Detect new keypoints in the empty cells when less than this ratio of cells are tracked
+        _keypointDetectionTimeBudget = 0.010;   // Skip optional keypoint detections that would make the keypoint step last longer than this (seconds)
         _opticalFlowPyramidDepth = 5;   // depth of the optical pyramid
         _opticalFlowPyramidWindowSize = 25;
         _opticalFlowMaxError = 35;      // error in pixel after which a point is rejected
         _opticalFlowMaxDistance = 100;  // distance in pixel after which a point is rejected
         _keypointMaskDiameter = 10;     // do not detect points inside an area of this size (pixels) around existing keypoints
+        _keypointDetectionCellSize = 64;// detect keypoints independently in cells of this size (pixels), to spread them in the image
 
         // Pose Optimization
         _ransacMaximumRetroprojectionErrorForInliers = 20;   // Retroprojection error between two screen points, in pixels
         _ransacMinimumInliersProportionForEarlyStop = 0.90; // proportion of inliers in total set, to stop RANSAC early
         _ransacProbabilityOfSuccess = 0.8;   // probability of having at least one correct transformation
         _ransacInlierProportion = 0.6;       // number of inliers in data / number of points in data 
+        _ransacRandomSeed = 0;
 
         _minimumPointForOptimization = 6;   // Should be >= 6
         _optimizationMaximumIterations = 1024;
-        _optimizationErrorPrecision = 0;
         _optimizationToleranceOfSolutionVectorNorm = 1e-4;  // Smallest delta of doubles
         _optimizationToleranceOfVectorFunction = 1e-3;
         _optimizationToleranceOfErrorFunctionGradient = 0;
@@ -124,6 +128,8 @@ namespace rgbd_slam {
         _pointLossAlpha = 2;    // -infinity, infinity
         _pointLossScale = 100; // Unit: Pixel
         _pointErrorMultiplier = 0.5;  // > 0
+        _primitiveNormalErrorMultiplier = 1e-3;     // >= 0
+        _primitiveDistanceErrorMultiplier = 1e-8;   // >= 0, Unit: 1/mm²
 
         // Local map
         _pointUnmatchedCountToLoose = 10;
@@ -131,6 +137,17 @@ namespace rgbd_slam {
         _pointStagedAgeConfidence = 10;
         _pointMinimumConfidenceForMap = 0.9;
         _mapMaximumRetroprojectionError = 150;
+        _keyframeWindowSize = 10;           // The local map only keeps the points of the N most relevant keyframes
+        _keyframeMinimumOverlap = 0.6;      // Create a keyframe when the points of the last one are not tracked anymore
+        _keyframeMaximumTranslation = 300;  // millimeters
+        _keyframeMaximumRotation = 0.35;    // radians
+        _bundleAdjustmentMaximumIterations = 10;    // The keyframe window is adjusted on a background thread after each new keyframe
+        _bundleAdjustmentPixelStandardDeviation = 1.0;  // FAST corners are detected on the pixel grid, with about a pixel of jitter
+        _maximumLocalMapPointCount = 4000;
+        _maximumStagedPointCount = 1000;
+        _localMapMemoryBudget = 8 * 1024 * 1024;   // 8 MB
+        _globalMapTileSize = 4000;          // The points of the keyframes that left the window are stored on disk in tiles of this size (millimeters)
+        _globalMapPageInDelay = 30;         // A lost point is not paged in again before a second, so it does not move between the local and global maps on each turn
         _maximumPointPerFrame = 200;
 
         // Primitive extraction
@@ -160,6 +177,16 @@ namespace rgbd_slam {
             utils::log_error("Match search radius must be > 0");
             _isValid = false;
         }
+        if (_matchSearchMinimumRadius <= 0 or _matchSearchMinimumRadius > _matchSearchRadius)
+        {
+            utils::log_error("Match search minimum radius must be > 0 and <= match search radius");
+            _isValid = false;
+        }
+        if (_mapPointVoxelSize <= 0)
+        {
+            utils::log_error("Map point voxel size must be > 0");
+            _isValid = false;
+        }
         if (_matchSearchCellSize <= 0)
         {
             utils::log_error("Match search cell size must be > 0");
@@ -175,9 +202,14 @@ namespace rgbd_slam {
             utils::log_error("Keypoint detector hessian must be > 0");
             _isValid = false;
         }
-        if (_keypointRefreshFrequency <= 0)
+        if (_keypointMinimumCellCoverage < 0 or _keypointMinimumCellCoverage > 1)
         {
-            utils::log_error("Keypoint refresh frequency must be > 0");
+            utils::log_error("Keypoint minimum cell coverage must be between 0 and 1");
+            _isValid = false;
+        }
+        if (_keypointDetectionTimeBudget <= 0)
+        {
+            utils::log_error("Keypoint detection time budget must be > 0");
             _isValid = false;
         }
         if (_opticalFlowPyramidDepth <= 0)
@@ -205,6 +237,11 @@ namespace rgbd_slam {
             utils::log_error("keypoint mask diameters must be > 0");
             _isValid = false;
         }
+        if (_keypointDetectionCellSize <= _keypointMaskDiameter)
+        {
+            utils::log_error("Keypoint detection cell size must be > keypoint mask diameter");
+            _isValid = false;
+        }
         
         if (_ransacMaximumRetroprojectionErrorForInliers <= 0)
         {
@@ -237,11 +274,6 @@ namespace rgbd_slam {
             utils::log_error("Optimization maximum iterations must be > 0");
             _isValid = false;
         }
-        if (_optimizationErrorPrecision < 0)
-        {
-            utils::log_error("Optimization error precision must be >= 0");
-            _isValid = false;
-        }
         if (_optimizationToleranceOfSolutionVectorNorm < 0)
         {
             utils::log_error("The optimization tolerance for the norm of the solution vector must be >= 0");
@@ -294,6 +326,16 @@ namespace rgbd_slam {
             utils::log_error("Point error multiplier must be > 0");
             _isValid = false;
         }
+        if (_primitiveNormalErrorMultiplier < 0)
+        {
+            utils::log_error("Primitive normal error multiplier must be >= 0");
+            _isValid = false;
+        }
+        if (_primitiveDistanceErrorMultiplier < 0)
+        {
+            utils::log_error("Primitive distance error multiplier must be >= 0");
+            _isValid = false;
+        }
 
 
         if (_pointUnmatchedCountToLoose <= 0)
@@ -321,6 +363,56 @@ namespace rgbd_slam {
             utils::log_error("Maximum retroprojection must be > 0");
             _isValid = false;
         }
+        if (_keyframeWindowSize < 2)
+        {
+            utils::log_error("Keyframe window size must be >= 2");
+            _isValid = false;
+        }
+        if (_keyframeMinimumOverlap <= 0 or _keyframeMinimumOverlap > 1)
+        {
+            utils::log_error("Keyframe minimum overlap must be in ]0, 1]");
+            _isValid = false;
+        }
+        if (_keyframeMaximumTranslation <= 0)
+        {
+            utils::log_error("Keyframe maximum translation must be > 0");
+            _isValid = false;
+        }
+        if (_keyframeMaximumRotation <= 0)
+        {
+            utils::log_error("Keyframe maximum rotation must be > 0");
+            _isValid = false;
+        }
+        if (_maximumLocalMapPointCount < _minimumPointForOptimization)
+        {
+            utils::log_error("Maximum local map point count must be >= minimum point count for optimization");
+            _isValid = false;
+        }
+        if (_maximumStagedPointCount <= 0)
+        {
+            utils::log_error("Maximum staged point count must be > 0");
+            _isValid = false;
+        }
+        if (_localMapMemoryBudget <= 0)
+        {
+            utils::log_error("Local map memory budget must be > 0");
+            _isValid = false;
+        }
+        if (_bundleAdjustmentPixelStandardDeviation <= 0)
+        {
+            utils::log_error("Bundle adjustment pixel standard deviation must be > 0");
+            _isValid = false;
+        }
+        if (_globalMapTileSize == 0)
+        {
+            utils::log_error("Global map tile size must be > 0");
+            _isValid = false;
+        }
+        if (_globalMapPageInDelay == 0)
+        {
+            utils::log_error("Global map page in delay must be > 0");
+            _isValid = false;
+        }
 
 
         if (_minimumIOUToConsiderMatch <= 0)
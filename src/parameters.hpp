@@ -1,5 +1,5 @@
 #ifndef RGBDSLAM_PARAMETERS_HPP
-#define RGDBSLAM_PARAMETERS_HPP
+#define RGBDSLAM_PARAMETERS_HPP
 
 #include <string>
 
@@ -61,11 +61,11 @@ namespace rgbd_slam {
             static double get_ransac_minimum_inliers_proportion_for_early_stop() { return _ransacMinimumInliersProportionForEarlyStop; };
             static double get_ransac_probability_of_success() { return _ransacProbabilityOfSuccess; };
             static double get_ransac_inlier_proportion() { return _ransacInlierProportion; };
+            static uint get_ransac_random_seed() { return _ransacRandomSeed; };
 
             static uint get_minimum_point_count_for_optimization() { return _minimumPointForOptimization; };
             static uint get_maximum_point_count_per_frame() { return _maximumPointPerFrame; };
             static uint get_optimization_maximum_iterations() { return _optimizationMaximumIterations; };
-            static double get_optimization_error_precision() { return _optimizationErrorPrecision; };
             static double get_optimization_xtol() { return _optimizationToleranceOfSolutionVectorNorm; };
             static double get_optimization_ftol() { return _optimizationToleranceOfVectorFunction; };
             static double get_optimization_gtol() { return _optimizationToleranceOfErrorFunctionGradient; };
@@ -77,17 +77,23 @@ namespace rgbd_slam {
             static double get_point_loss_alpha() { return _pointLossAlpha; };
             static double get_point_loss_scale() { return _pointLossScale; };
             static double get_point_error_multiplier() { return _pointErrorMultiplier; };
+            static double get_primitive_normal_error_multiplier() { return _primitiveNormalErrorMultiplier; };
+            static double get_primitive_distance_error_multiplier() { return _primitiveDistanceErrorMultiplier; };
 
             static double get_search_matches_distance() { return _matchSearchRadius; };
+            static double get_search_matches_minimum_distance() { return _matchSearchMinimumRadius; };
+            static double get_map_point_voxel_size() { return _mapPointVoxelSize; };
             static double get_search_matches_cell_size() { return _matchSearchCellSize; };
             static double get_maximum_match_distance() { return _maximumMatchDistance; };
             static uint get_minimum_hessian() { return _detectorMinHessian; };
-            static uint get_keypoint_refresh_frequency() { return _keypointRefreshFrequency; };
+            static double get_keypoint_minimum_cell_coverage() { return _keypointMinimumCellCoverage; };
+            static double get_keypoint_detection_time_budget() { return _keypointDetectionTimeBudget; };
             static uint get_optical_flow_pyramid_depth() { return _opticalFlowPyramidDepth; };
             static uint get_optical_flow_pyramid_windown_size() { return _opticalFlowPyramidWindowSize; };
             static uint get_optical_flow_max_error() { return _opticalFlowMaxError; };
             static uint get_optical_flow_max_distance() { return _opticalFlowMaxDistance; };
             static uint get_keypoint_mask_diameter() { return _keypointMaskDiameter; };
+            static uint get_keypoint_detection_cell_size() { return _keypointDetectionCellSize; };
 
             static float get_maximum_plane_match_angle() { return _primitiveMaximumCosAngle; };
             static float get_maximum_merge_distance() { return _primitiveMaximumMergeDistance; };
@@ -113,6 +119,19 @@ namespace rgbd_slam {
             // Minimum point liability for the local map
             static double get_minimum_confidence_for_local_map() { return _pointMinimumConfidenceForMap; };
             static double get_maximum_map_retroprojection_error() { return _mapMaximumRetroprojectionError; };
+            // Keyframes of the local map window
+            static uint get_keyframe_window_size() { return _keyframeWindowSize; };
+            static double get_keyframe_minimum_overlap() { return _keyframeMinimumOverlap; };
+            static double get_keyframe_maximum_translation() { return _keyframeMaximumTranslation; };
+            static double get_keyframe_maximum_rotation() { return _keyframeMaximumRotation; };
+            static uint get_global_map_tile_size() { return _globalMapTileSize; };
+            static uint get_global_map_page_in_delay() { return _globalMapPageInDelay; };
+            static uint get_bundle_adjustment_maximum_iterations() { return _bundleAdjustmentMaximumIterations; };
+            static double get_bundle_adjustment_pixel_standard_deviation() { return _bundleAdjustmentPixelStandardDeviation; };
+            // Budgets of the local map
+            static uint get_maximum_local_map_point_count() { return _maximumLocalMapPointCount; };
+            static uint get_maximum_staged_point_count() { return _maximumStagedPointCount; };
+            static uint get_local_map_memory_budget() { return _localMapMemoryBudget; };
 
         private:
             // Is this set of parameters valid
@@ -159,13 +178,13 @@ namespace rgbd_slam {
             inline static double _ransacMinimumInliersProportionForEarlyStop; // Proportion of inliers to consider that a transformation is good enough to stop optimization
             inline static double _ransacProbabilityOfSuccess; // Probability that the RANSAC process finds a good transformation
             inline static double _ransacInlierProportion; // Proportion of inliers in original set
+            inline static uint _ransacRandomSeed;   // Seed of the RANSAC samples: each hypothesis draws from this seed and its index, so the pose does not depend on the thread scheduling
 
             inline static double _optimizationToleranceOfSolutionVectorNorm;    // tolerance for the norm of the solution vector
             inline static double _optimizationToleranceOfVectorFunction;        // tolerance for the norm of the vector function
 
             inline static double _optimizationToleranceOfErrorFunctionGradient; // tolerance for the norm of the gradient of the error function
             inline static double _optimizationDiagonalStepBoundShift;           // step bound for the diagonal shift
-            inline static double _optimizationErrorPrecision;                   // error precision
 
             inline static uint _optimizationMaximumIterations;              // Max iteration of the Levenberg Marquart optimisation
             inline static double _maximumRetroprojectionError;              // In pixel: maximum distance after which we can consider a retroprojection as invalid
@@ -175,18 +194,24 @@ namespace rgbd_slam {
             inline static double _pointLossAlpha;   // loss steepness (_infinity, infinity)
             inline static double _pointLossScale;   // loss scale (> 0), Unit: Pixels
             inline static double _pointErrorMultiplier; // multiplier of the final loss value (useful when  using primitives along with points)
+            inline static double _primitiveNormalErrorMultiplier;    // multiplier of the mean squared difference of the primitive normals (>= 0, 0 to ignore)
+            inline static double _primitiveDistanceErrorMultiplier;  // multiplier of the mean squared difference of the plane distances (>= 0, 0 to ignore), Unit: 1/mm²
 
             // Point Detection & matching
-            inline static double _matchSearchRadius;    // Radius of the space around a point to search match points ins
+            inline static double _matchSearchRadius;    // Maximum radius of the space around a point to search match points in (pixels)
+            inline static double _matchSearchMinimumRadius;    // Minimum radius of the space around a point to search match points in (pixels)
+            inline static double _mapPointVoxelSize;    // Size of the voxels of the map point spatial index (millimeters)
             inline static int _matchSearchCellSize;     // Size of a search space divider 
             inline static double _maximumMatchDistance; // Maximum distance between a point and his mach before refusing the match
             inline static uint _detectorMinHessian;
-            inline static uint _keypointRefreshFrequency;
+            inline static double _keypointMinimumCellCoverage;  // Minimum ratio of detection cells containing tracked keypoints, under which new keypoints are detected in the empty cells
+            inline static double _keypointDetectionTimeBudget;  // Time budget of the keypoint step for one frame (seconds)
             inline static uint _opticalFlowPyramidDepth;
             inline static uint _opticalFlowPyramidWindowSize;
             inline static uint _opticalFlowMaxError;
             inline static uint _opticalFlowMaxDistance;
             inline static uint _keypointMaskDiameter;
+            inline static uint _keypointDetectionCellSize; // Size of the image cells in which keypoints are detected independently (pixels)
 
             // Primitive extraction parameters
             inline static float _primitiveMaximumCosAngle;         // Maximum angle between two planes to consider merging
@@ -209,6 +234,17 @@ namespace rgbd_slam {
             inline static uint _pointStagedAgeConfidence;        // Minimum age of a point in staged map to consider it good 
             inline static double _pointMinimumConfidenceForMap;        // Minimum confidence of a staged point to add it to local map
             inline static double _mapMaximumRetroprojectionError;       // Maximum error between a map point retro projection and the new point position before removing it from the local map (in millimeters)
+            inline static uint _keyframeWindowSize;             // Number of keyframes whose points are kept in the local map
+            inline static double _keyframeMinimumOverlap;       // Proportion of the last keyframe points still matched, under which a new keyframe is created
+            inline static double _keyframeMaximumTranslation;   // Distance to the last keyframe over which a new keyframe is created (millimeters)
+            inline static double _keyframeMaximumRotation;      // Angle to the last keyframe over which a new keyframe is created (radians)
+            inline static uint _globalMapTileSize;              // Size of the global map tiles stored on disk (millimeters)
+            inline static uint _globalMapPageInDelay;           // Frames before a lost point, or a point left on disk by the point budget, can be paged in again
+            inline static uint _bundleAdjustmentMaximumIterations;  // Maximum iterations of the local bundle adjustment of the keyframe window (0 to disable it)
+            inline static double _bundleAdjustmentPixelStandardDeviation;   // Standard deviation of the keypoint positions in the bundle adjustment (pixels)
+            inline static uint _maximumLocalMapPointCount;      // Maximum number of points in the local map, over which the least useful points are evicted
+            inline static uint _maximumStagedPointCount;        // Maximum number of staged points, over which the least useful points are evicted
+            inline static uint _localMapMemoryBudget;           // Maximum memory used by the local map and staged points (bytes)
 
 
             /**
@@ -0,0 +1,287 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_FIXED_SIZE_LEVENBERG_MARQUARDT_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_FIXED_SIZE_LEVENBERG_MARQUARDT_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include <Eigen/Dense>
+
+namespace rgbd_slam {
+    namespace pose_optimization {
+
+        /**
+         * \brief End status of a Levenberg-Marquardt minimization
+         */
+        enum class Minimization_Status {
+            // Success
+            SmallGradient,          // The gradient of the error is under the gradient tolerance
+            SmallStep,              // The step is under the step tolerance
+            SmallErrorReduction,    // The relative reduction of the error is under the error tolerance
+            // Failure
+            TooManyIterations,      // The maximum iteration count was reached
+            InvalidStartError,      // The error of the initial state is not finite
+            SingularSystem          // The damped normal equations could not be solved
+        };
+
+        inline bool is_minimization_successful(const Minimization_Status status)
+        {
+            return status == Minimization_Status::SmallGradient or status == Minimization_Status::SmallStep or status == Minimization_Status::SmallErrorReduction;
+        }
+
+        /**
+         * \brief Use for debug.
+         * \return Returns a string with the human readable version of a minimization end status
+         */
+        const std::string get_human_readable_end_message(const Minimization_Status status);
+
+        /**
+         * \brief Stop conditions of a Levenberg-Marquardt minimization
+         */
+        struct Minimization_Settings
+        {
+            uint _maximumIterations;    // Maximum number of error evaluations
+            double _stepTolerance;      // Stop when the trust region is under this value, relative to the scaled norm of the state
+            double _errorTolerance;     // Stop when the actual and predicted relative reductions of the squared error are under this value
+            double _gradientTolerance;  // Stop when the cosine between the errors and the jacobian columns is under this value
+            double _initialStepBound;   // Initial trust region, relative to the scaled norm of the initial state
+        };
+
+        /**
+         * \brief Levenberg-Marquardt minimization of a sum of squared errors, with a parameter count known at compile time. The damping is controlled by a trust region, like in MINPACK.
+         * The model accumulates its normal equations directly, and the state is updated by the model, so it can live on a manifold. No memory is allocated during the minimization
+         *
+         * \tparam ParameterCount Number of parameters of a step
+         * \tparam Model A model providing:
+         *      - state_type: the optimized state
+         *      - double get_squared_error(const state_type&) const
+         *      - double get_normal_equations(const state_type&, parameter_matrix&, parameter_vector&) const: fills J^T.J and J^T.f, and returns the squared error
+         *      - state_type get_incremented_state(const state_type&, const parameter_vector&) const
+         *      - parameter_vector get_parameters(const state_type&) const: coordinates of a state, used to scale the trust region
+         */
+        template<int ParameterCount, class Model>
+        class Fixed_Size_Levenberg_Marquardt
+        {
+            public:
+                typedef Eigen::Matrix<double, ParameterCount, 1> parameter_vector;
+                typedef Eigen::Matrix<double, ParameterCount, ParameterCount> parameter_matrix;
+                typedef typename Model::state_type state_type;
+
+                Fixed_Size_Levenberg_Marquardt(const Model& model, const Minimization_Settings& settings) :
+                    _model(model),
+                    _settings(settings),
+                    _iterationCount(0)
+                {
+                    assert(_settings._maximumIterations > 0);
+                    assert(_settings._initialStepBound > 0);
+                }
+
+                /**
+                 * \brief Minimize the error of the model
+                 *
+                 * \param[in, out] state The initial state, replaced by the optimized state
+                 *
+                 * \return The end status of the minimization
+                 */
+                Minimization_Status minimize(state_type& state)
+                {
+                    _iterationCount = 0;
+
+                    parameter_matrix normalMatrix;
+                    parameter_vector gradient;
+                    double error = _model.get_normal_equations(state, normalMatrix, gradient);
+                    if (not std::isfinite(error))
+                        return Minimization_Status::InvalidStartError;
+                    double errorNorm = std::sqrt(error);
+
+                    // Scale of each parameter: the largest norm of its jacobian column so far
+                    parameter_vector scaling = get_column_norms(normalMatrix);
+                    for(Eigen::Index i = 0; i < ParameterCount; ++i)
+                    {
+                        if (scaling(i) <= 0)
+                            scaling(i) = 1.0;
+                    }
+
+                    double stateNorm = scaling.cwiseProduct(_model.get_parameters(state)).norm();
+                    double trustRegion = (stateNorm > 0) ? _settings._initialStepBound * stateNorm : _settings._initialStepBound;
+                    double damping = 0.0;
+
+                    while(true)
+                    {
+                        // Cosine between the errors and the jacobian columns
+                        if (errorNorm > 0)
+                        {
+                            const parameter_vector& columnNorms = get_column_norms(normalMatrix);
+                            double gradientNorm = 0.0;
+                            for(Eigen::Index i = 0; i < ParameterCount; ++i)
+                            {
+                                if (columnNorms(i) > 0)
+                                    gradientNorm = std::max(gradientNorm, std::abs(gradient(i)) / (columnNorms(i) * errorNorm));
+                            }
+                            if (gradientNorm <= _settings._gradientTolerance)
+                                return Minimization_Status::SmallGradient;
+                        }
+                        else
+                            return Minimization_Status::SmallGradient;
+
+                        // Try steps until one reduces the error
+                        double gainRatio = 0.0;
+                        do
+                        {
+                            parameter_vector step;
+                            if (not get_step(normalMatrix, gradient, scaling, trustRegion, damping, step))
+                                return Minimization_Status::SingularSystem;
+                            const double scaledStepNorm = scaling.cwiseProduct(step).norm();
+
+                            // On the first iteration, adjust the initial trust region
+                            if (_iterationCount == 0)
+                                trustRegion = std::min(trustRegion, scaledStepNorm);
+
+                            const state_type candidateState = _model.get_incremented_state(state, step);
+                            const double candidateError = _model.get_squared_error(candidateState);
+                            ++_iterationCount;
+                            const double candidateErrorNorm = std::isfinite(candidateError) ? std::sqrt(candidateError) : std::numeric_limits<double>::max();
+
+                            // Actual and predicted relative reductions of the squared error
+                            const double actualReduction = (0.1 * candidateErrorNorm < errorNorm) ? 1.0 - (candidateErrorNorm * candidateErrorNorm) / error : -1.0;
+                            const double linearReduction = std::max(0.0, step.dot(normalMatrix * step)) / error;
+                            const double dampingReduction = damping * scaledStepNorm * scaledStepNorm / error;
+                            const double predictedReduction = linearReduction + 2.0 * dampingReduction;
+                            const double directionalDerivative = -(linearReduction + dampingReduction);
+                            gainRatio = (predictedReduction > 0) ? actualReduction / predictedReduction : 0.0;
+
+                            // Update the trust region
+                            if (gainRatio <= 0.25)
+                            {
+                                double shrinkFactor = (actualReduction >= 0) ? 0.5 : 0.5 * directionalDerivative / (directionalDerivative + 0.5 * actualReduction);
+                                if (0.1 * candidateErrorNorm >= errorNorm or shrinkFactor < 0.1)
+                                    shrinkFactor = 0.1;
+                                trustRegion = shrinkFactor * std::min(trustRegion, scaledStepNorm / 0.1);
+                                damping /= shrinkFactor;
+                            }
+                            else if (damping <= 0 or gainRatio >= 0.75)
+                            {
+                                trustRegion = scaledStepNorm / 0.5;
+                                damping *= 0.5;
+                            }
+
+                            // Successful step
+                            if (gainRatio >= 1e-4)
+                            {
+                                state = candidateState;
+                                error = _model.get_normal_equations(state, normalMatrix, gradient);
+                                errorNorm = std::sqrt(error);
+                                scaling = scaling.cwiseMax(get_column_norms(normalMatrix));
+                                stateNorm = scaling.cwiseProduct(_model.get_parameters(state)).norm();
+                            }
+
+                            // Convergence tests
+                            if (std::abs(actualReduction) <= _settings._errorTolerance and predictedReduction <= _settings._errorTolerance and 0.5 * gainRatio <= 1.0)
+                                return Minimization_Status::SmallErrorReduction;
+                            if (trustRegion <= _settings._stepTolerance * stateNorm or trustRegion <= std::numeric_limits<double>::epsilon() * stateNorm)
+                                return Minimization_Status::SmallStep;
+                            if (_iterationCount >= _settings._maximumIterations)
+                                return Minimization_Status::TooManyIterations;
+                        } while (gainRatio < 1e-4);
+                    }
+                }
+
+                /**
+                 * \return The number of error evaluations of the last minimization
+                 */
+                uint get_iteration_count() const { return _iterationCount; };
+
+            private:
+                /**
+                 * \brief Compute the norms of the jacobian columns, from the normal equations
+                 */
+                static parameter_vector get_column_norms(const parameter_matrix& normalMatrix)
+                {
+                    return normalMatrix.diagonal().cwiseMax(0.0).cwiseSqrt();
+                }
+
+                /**
+                 * \brief Compute the step minimizing the linearized error inside the trust region: the Gauss-Newton step if it fits, or a damped step which scaled norm is close to the trust region
+                 *
+                 * \param[in] normalMatrix J^T.J
+                 * \param[in] gradient J^T.f
+                 * \param[in] scaling Scale of each parameter
+                 * \param[in] trustRegion Maximum scaled norm of the step
+                 * \param[in, out] damping The damping of the last step, replaced by the damping of this step
+                 * \param[out] step The step to apply to the state
+                 *
+                 * \return False if no step could be computed
+                 */
+                static bool get_step(const parameter_matrix& normalMatrix, const parameter_vector& gradient, const parameter_vector& scaling, const double trustRegion, double& damping, parameter_vector& step)
+                {
+                    static constexpr uint maximumDampingIterations = 10;
+                    const parameter_vector& squaredScaling = scaling.cwiseProduct(scaling);
+
+                    // Gauss-Newton step
+                    const Eigen::LDLT<parameter_matrix> gaussNewtonDecomposition(normalMatrix);
+                    if (gaussNewtonDecomposition.info() == Eigen::Success and gaussNewtonDecomposition.isPositive())
+                    {
+                        step = gaussNewtonDecomposition.solve(-gradient);
+                        if (step.allFinite() and scaling.cwiseProduct(step).norm() <= 1.1 * trustRegion)
+                        {
+                            damping = 0.0;
+                            return true;
+                        }
+                    }
+
+                    // Bounds of the damping: the damped step is the scaled gradient direction for high dampings
+                    double lowerBound = 0.0;
+                    double upperBound = gradient.cwiseQuotient(scaling).norm() / trustRegion;
+                    if (not (upperBound > 0))
+                        upperBound = std::numeric_limits<double>::min() / std::min(trustRegion, 0.1);
+                    damping = std::clamp(damping, lowerBound, upperBound);
+                    if (damping <= 0)
+                        damping = gradient.cwiseQuotient(scaling).norm() / trustRegion;
+
+                    // Search the damping which step fits the trust region
+                    for(uint iteration = 0; iteration < maximumDampingIterations; ++iteration)
+                    {
+                        if (damping <= 0)
+                            damping = std::max(std::numeric_limits<double>::min(), 0.001 * upperBound);
+
+                        parameter_matrix dampedMatrix = normalMatrix;
+                        dampedMatrix.diagonal() += damping * squaredScaling;
+                        const Eigen::LDLT<parameter_matrix> decomposition(dampedMatrix);
+                        if (decomposition.info() != Eigen::Success)
+                            return false;
+                        step = decomposition.solve(-gradient);
+                        if (not step.allFinite())
+                            return false;
+
+                        const double scaledStepNorm = scaling.cwiseProduct(step).norm();
+                        const double trustRegionDistance = scaledStepNorm - trustRegion;
+                        if (std::abs(trustRegionDistance) <= 0.1 * trustRegion or iteration + 1 == maximumDampingIterations)
+                            break;
+
+                        // Newton correction of the damping
+                        const parameter_vector& scaledStep = squaredScaling.cwiseProduct(step) / scaledStepNorm;
+                        const double derivative = scaledStep.dot(decomposition.solve(scaledStep));
+                        if (not (derivative > 0))
+                            break;
+                        const double correction = (trustRegionDistance / trustRegion) / derivative;
+
+                        if (trustRegionDistance > 0)
+                            lowerBound = std::max(lowerBound, damping);
+                        else
+                            upperBound = std::min(upperBound, damping);
+                        damping = std::max(lowerBound, damping + correction);
+                    }
+                    return true;
+                }
+
+                const Model& _model;
+                const Minimization_Settings _settings;
+                uint _iterationCount;
+        };
+
+    }   /* pose_optimization */
+}   /* rgbd_slam */
+
+#endif
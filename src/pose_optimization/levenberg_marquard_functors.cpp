@@ -4,6 +4,9 @@
 #include "distance_utils.hpp"
 #include "parameters.hpp"
 
+#include <cmath>
+#include <limits>
+
 namespace rgbd_slam {
     namespace pose_optimization {
 
@@ -47,6 +50,67 @@ namespace rgbd_slam {
             }
         }
 
+        /**
+         * \brief Derivative of get_generalized_loss_estimator with respect to the error
+         *
+         * \param[in] error The error passed to the loss function
+         * \param[in] alpha The steepness of the loss function
+         * \param[in] scale Standard deviation of the error, as a scale parameter
+         */
+        double get_generalized_loss_derivative(const double error, const double alpha = 1, const double scale = 1)
+        {
+            assert(scale > 0);
+
+            const double squaredScale = scale * scale;
+            const double scaledSquaredError = (error * error) / squaredScale;
+            // derivative of the scaled squared error
+            const double scaledSquaredErrorDerivative = 2.0 * error / squaredScale;
+
+            // ]2, oo[
+            if (alpha > 2)
+            {
+                const double internalTerm = scaledSquaredError / abs(alpha - 2) + 1;
+                return 0.5 * pow(internalTerm, alpha / 2.0 - 1) * scaledSquaredErrorDerivative;
+            }
+            // ]0, 2]
+            else if (alpha > 0)
+            {
+                return 0.5 * scaledSquaredErrorDerivative;
+            }
+            // ]-100, 0]
+            else if (alpha > -100)
+            {
+                return 0.5 / (1 + 0.5 * scaledSquaredError) * scaledSquaredErrorDerivative;
+            }
+            // ]-oo, -100]
+            else 
+            {
+                return 0.5 * exp( -0.5 * scaledSquaredError) * scaledSquaredErrorDerivative;
+            }
+        }
+
+        /**
+         * \brief Derivative of abs(value), smoothed around 0. The exact sign makes the steps oscillate on the kinks of the manhattan distance, and stalls the optimization near the solution
+         */
+        double get_smoothed_sign(const double value)
+        {
+            // Squared width of the smoothing, in pixels
+            static constexpr double smoothingWidth = 1e-3;
+            return value / sqrt(value * value + smoothingWidth);
+        }
+
+        /**
+         * \brief Compute the skew symmetric matrix of a vector, such as get_skew_matrix(a) * b == a.cross(b)
+         */
+        matrix33 get_skew_matrix(const vector3& vector)
+        {
+            matrix33 skewMatrix;
+            skewMatrix <<            0, -vector.z(),  vector.y(),
+                            vector.z(),           0, -vector.x(),
+                           -vector.y(),  vector.x(),           0;
+            return skewMatrix;
+        }
+
         /**
          * \brief Compute a scaled axis representation of a rotation quaternion. The scaled axis is easier to optimize for Levenberg-Marquardt algorithm
          */
@@ -81,102 +145,253 @@ namespace rgbd_slam {
         }
 
         /**
-         * GLOBAL POSE ESTIMATOR members
+         * \brief Compute the retroprojection distance of a match, as in get_3D_to_2D_distance, and optionally its jacobian with respect to a (translation, rotation) step
+         *
+         * \param[in] screenPoint The observed screen point of the match
+         * \param[in] worldPoint The world point of the match, to retroproject
+         * \param[in] worldToCameraRotation Transposed rotation of the observer
+         * \param[in] position Position of the observer
+         * \param[out] distanceJacobian If not null, receives the jacobian of the distance. It is null when the point is behind the camera
+         */
+        double get_retroprojection_distance(const vector3& screenPoint, const vector3& worldPoint, const matrix33& worldToCameraRotation, const vector3& position, Eigen::Matrix<double, 1, 6>* distanceJacobian)
+        {
+            // P_camera = R^T * (P_world - t)
+            const vector3& cameraPoint = worldToCameraRotation * (worldPoint - position);
+            if (cameraPoint.z() <= 0)
+            {
+                if (distanceJacobian != nullptr)
+                    distanceJacobian->setZero();
+                // high number, that does not depend on the pose
+                return std::numeric_limits<double>::max();
+            }
+
+            const double focalX = Parameters::get_camera_1_focal_x();
+            const double focalY = Parameters::get_camera_1_focal_y();
+            const double inverseDepth = 1.0 / cameraPoint.z();
+            const double differenceX = focalX * cameraPoint.x() * inverseDepth + Parameters::get_camera_1_center_x() - screenPoint.x();
+            const double differenceY = focalY * cameraPoint.y() * inverseDepth + Parameters::get_camera_1_center_y() - screenPoint.y();
+
+            if (distanceJacobian != nullptr)
+            {
+                // Derivative of the distance with respect to the camera point
+                const double signX = get_smoothed_sign(differenceX);
+                const double signY = get_smoothed_sign(differenceY);
+                const Eigen::Matrix<double, 1, 3> distanceToCameraPoint(
+                        signX * focalX * inverseDepth,
+                        signY * focalY * inverseDepth,
+                        -(signX * focalX * cameraPoint.x() + signY * focalY * cameraPoint.y()) * inverseDepth * inverseDepth
+                        );
+
+                // The camera point moves by -R^T * dt with a translation step, and by cameraPoint x dr with a right rotation step
+                distanceJacobian->head<3>() = -distanceToCameraPoint * worldToCameraRotation;
+                distanceJacobian->tail<3>() = distanceToCameraPoint * get_skew_matrix(cameraPoint);
+            }
+
+            // Manhattan distance, as in get_3D_to_2D_distance
+            return abs(differenceX) + abs(differenceY);
+        }
+
+        /**
+         * GLOBAL POSE MODEL members
          */
 
-        Global_Pose_Estimator::Global_Pose_Estimator(const size_t n, const matches_containers::match_point_container& points, const vector3& worldPosition, const quaternion& worldRotation) :
-            Levenberg_Marquardt_Functor<double>(n, points.size()),
+        Global_Pose_Model::Global_Pose_Model(const matches_containers::match_point_container& points, const matches_containers::match_index_view pointIndexes, const matches_containers::match_primitive_container& primitives) :
             _points(points),
-            _rotation(worldRotation),
-            _position(worldPosition),
-            _pointErrorMultiplier( sqrt(Parameters::get_point_error_multiplier() / static_cast<double>(points.size())) ),
+            _pointIndexes(pointIndexes),
+            _primitives(primitives),
+            _pointErrorMultiplier( pointIndexes.empty() ? 0.0 : sqrt(Parameters::get_point_error_multiplier() / static_cast<double>(pointIndexes.size())) ),
             _lossScale(Parameters::get_point_loss_scale()),
-            _lossAlpha(Parameters::get_point_loss_alpha())
+            _lossAlpha(Parameters::get_point_loss_alpha()),
+            _primitiveNormalErrorMultiplier( primitives.empty() ? 0.0 : sqrt(Parameters::get_primitive_normal_error_multiplier() / static_cast<double>(primitives.size())) ),
+            _primitiveDistanceErrorMultiplier( primitives.empty() ? 0.0 : sqrt(Parameters::get_primitive_distance_error_multiplier() / static_cast<double>(primitives.size())) )
         {
             assert(_lossScale > 0);
-            assert(_pointErrorMultiplier > 0);
-            assert(not _points.empty());
+            assert(_pointIndexes.empty() or _pointErrorMultiplier > 0);
+            // Without points, the primitives alone must constrain the pose
+            assert(not _pointIndexes.empty() or not _primitives.empty());
         }
 
-        // Implementation of the objective function
-        int Global_Pose_Estimator::operator()(const Eigen::VectorXd& x, Eigen::VectorXd& fvec) const 
+        double Global_Pose_Model::get_mean_of_distances(const state_type& state, Eigen::Matrix<double, 1, 6>* meanOfJacobians) const
         {
-            assert(not _points.empty());
-            assert(x.size() == 6);
-            assert(static_cast<size_t>(fvec.size()) == _points.size());
+            const matrix33& worldToCameraRotation = state._rotation.toRotationMatrix().transpose();
 
-            // Get the new estimated pose
-            const quaternion& rotation = get_quaternion_from_scale_axis_coefficients(vector3(x(3), x(4), x(5)));
-            const vector3 translation(x(0), x(1), x(2));
-
-            const matrix44& transformationMatrix = utils::compute_world_to_camera_transform(rotation, translation);
             double meanOfDistances = 0;
-            size_t pointIndex = 0;  // index of the match being treated
+            if (meanOfJacobians != nullptr)
+                meanOfJacobians->setZero();
+            if (_pointIndexes.empty())
+                return meanOfDistances;
+
+            Eigen::Matrix<double, 1, 6> distanceJacobian;
+            for(const size_t pointIndex : _pointIndexes)
+            {
+                if (meanOfJacobians != nullptr)
+                {
+                    meanOfDistances += get_retroprojection_distance(_points.get_screen_point(pointIndex), _points.get_world_point(pointIndex), worldToCameraRotation, state._position, &distanceJacobian);
+                    *meanOfJacobians += distanceJacobian;
+                }
+                else
+                    meanOfDistances += get_retroprojection_distance(_points.get_screen_point(pointIndex), _points.get_world_point(pointIndex), worldToCameraRotation, state._position, nullptr);
+            }
 
-            // Compute retroprojection distances
-            for(matches_containers::match_point_container::const_iterator pointIterator = _points.cbegin(); pointIterator != _points.cend(); ++pointIterator, ++pointIndex) {
-                // Compute retroprojected distance
-                const double distance = utils::get_3D_to_2D_distance(pointIterator->_worldPoint, pointIterator->_screenPoint, transformationMatrix);
-                assert(distance >= 0.0);
+            const double pointContainerSize = static_cast<double>(_pointIndexes.size());
+            if (meanOfJacobians != nullptr)
+                *meanOfJacobians /= pointContainerSize;
+            return meanOfDistances / pointContainerSize;
+        }
+
+        double Global_Pose_Model::add_primitive_errors(const state_type& state, matrix66* normalMatrix, vector6* gradient) const
+        {
+            assert((normalMatrix == nullptr) == (gradient == nullptr));
+
+            const matrix33& worldToCameraRotation = state._rotation.toRotationMatrix().transpose();
+            double squaredError = 0;
+            for(const matches_containers::Primitive_Match& match : _primitives)
+            {
+                const vector3& cameraNormal = match._cameraPlane.head<3>();
+                const vector3& worldNormal = match._worldPlane.head<3>();
+                // World normal seen by the camera: it moves by projectedNormal x dr with a right rotation step
+                const vector3& projectedNormal = worldToCameraRotation * worldNormal;
+
+                if (match._isAxis)
+                {
+                    // The axis sign is arbitrary: penalize the sinus of the angle between the axes
+                    const vector3& axisError = _primitiveNormalErrorMultiplier * projectedNormal.cross(cameraNormal);
+                    squaredError += axisError.squaredNorm();
+                    if (normalMatrix != nullptr)
+                    {
+                        const matrix33& rotationJacobian = -_primitiveNormalErrorMultiplier * get_skew_matrix(cameraNormal) * get_skew_matrix(projectedNormal);
+                        normalMatrix->block<3, 3>(3, 3).noalias() += rotationJacobian.transpose() * rotationJacobian;
+                        gradient->tail<3>().noalias() += rotationJacobian.transpose() * axisError;
+                    }
+                    continue;
+                }
+
+                // Plane normal, only depends on the rotation
+                const vector3& normalError = _primitiveNormalErrorMultiplier * (projectedNormal - cameraNormal);
+                // Plane distance, only depends on the position: n_w.X_w + d_w = 0 gives d_c = d_w + n_w.t
+                const double distanceError = _primitiveDistanceErrorMultiplier * (worldNormal.dot(state._position) + match._worldPlane(3) - match._cameraPlane(3));
+                squaredError += normalError.squaredNorm() + distanceError * distanceError;
+
+                if (normalMatrix != nullptr)
+                {
+                    const matrix33& rotationJacobian = _primitiveNormalErrorMultiplier * get_skew_matrix(projectedNormal);
+                    normalMatrix->block<3, 3>(3, 3).noalias() += rotationJacobian.transpose() * rotationJacobian;
+                    gradient->tail<3>().noalias() += rotationJacobian.transpose() * normalError;
 
-                meanOfDistances += distance; 
-                fvec(pointIndex) = distance;
+                    const vector3& positionJacobian = _primitiveDistanceErrorMultiplier * worldNormal;
+                    normalMatrix->block<3, 3>(0, 0).noalias() += positionJacobian * positionJacobian.transpose();
+                    gradient->head<3>().noalias() += positionJacobian * distanceError;
+                }
             }
+            return squaredError;
+        }
 
-            const size_t pointContainerSize = _points.size();
-            meanOfDistances /= static_cast<double>(pointContainerSize);
+        double Global_Pose_Model::get_squared_error(const state_type& state) const
+        {
+            assert(not _pointIndexes.empty() or not _primitives.empty());
 
-            // If the mean of distance is 0, no need to continue 
+            const double meanOfDistances = get_mean_of_distances(state, nullptr);
             assert(meanOfDistances >= 0);
-            if (meanOfDistances > 0)
+
+            const matrix33& worldToCameraRotation = state._rotation.toRotationMatrix().transpose();
+            double squaredError = 0;
+            for(const size_t pointIndex : _pointIndexes)
             {
-                // Compute distance scores
-                for(size_t i = 0; i < pointContainerSize; ++i)
+                const double distance = get_retroprojection_distance(_points.get_screen_point(pointIndex), _points.get_world_point(pointIndex), worldToCameraRotation, state._position, nullptr);
+
+                // If the mean of distance is 0, the errors are the distances themselves
+                double error = distance;
+                if (meanOfDistances > 0)
                 {
-                    // distance squared divided by mean of all distances
-                    const double distance = (fvec(i) * fvec(i)) / meanOfDistances;
+                    // distance squared divided by mean of all distances, passed to the loss function
+                    error = _pointErrorMultiplier * get_generalized_loss_estimator((distance * distance) / meanOfDistances, _lossAlpha, _lossScale);
+                }
+                squaredError += error * error;
+            }
+            return squaredError + add_primitive_errors(state, nullptr, nullptr);
+        }
+
+        double Global_Pose_Model::get_normal_equations(const state_type& state, matrix66& normalMatrix, vector6& gradient) const
+        {
+            assert(not _pointIndexes.empty() or not _primitives.empty());
+
+            Eigen::Matrix<double, 1, 6> meanOfJacobians;
+            const double meanOfDistances = get_mean_of_distances(state, &meanOfJacobians);
+            assert(meanOfDistances >= 0);
 
-                    // Pass it to loss function
-                    const double weightedLoss = get_generalized_loss_estimator(distance, _lossAlpha, _lossScale);
+            normalMatrix.setZero();
+            gradient.setZero();
 
-                    // Compute the final error
-                    fvec(i) = _pointErrorMultiplier * weightedLoss; 
+            const matrix33& worldToCameraRotation = state._rotation.toRotationMatrix().transpose();
+            Eigen::Matrix<double, 1, 6> errorJacobian;
+            double squaredError = 0;
+            for(const size_t pointIndex : _pointIndexes)
+            {
+                const double distance = get_retroprojection_distance(_points.get_screen_point(pointIndex), _points.get_world_point(pointIndex), worldToCameraRotation, state._position, &errorJacobian);
+
+                // If the mean of distance is 0, the errors are the distances themselves
+                double error = distance;
+                if (meanOfDistances > 0)
+                {
+                    // distance squared divided by mean of all distances, passed to the loss function
+                    const double normalizedDistance = (distance * distance) / meanOfDistances;
+                    error = _pointErrorMultiplier * get_generalized_loss_estimator(normalizedDistance, _lossAlpha, _lossScale);
+                    if (not std::isfinite(normalizedDistance))
+                    {
+                        // Point behind the camera: constant error
+                        squaredError += error * error;
+                        continue;
+                    }
+
+                    // chain rule through the normalization and the loss function
+                    const double lossDerivative = _pointErrorMultiplier * get_generalized_loss_derivative(normalizedDistance, _lossAlpha, _lossScale);
+                    errorJacobian = lossDerivative * (
+                            (2.0 * distance / meanOfDistances) * errorJacobian - 
+                            (normalizedDistance / meanOfDistances) * meanOfJacobians
+                            );
                 }
+
+                squaredError += error * error;
+                normalMatrix.noalias() += errorJacobian.transpose() * errorJacobian;
+                gradient.noalias() += errorJacobian.transpose() * error;
             }
-            return 0;
+            return squaredError + add_primitive_errors(state, &normalMatrix, &gradient);
+        }
+
+        Global_Pose_Model::state_type Global_Pose_Model::get_incremented_state(const state_type& state, const vector6& step) const
+        {
+            state_type incrementedState;
+            incrementedState._position = state._position + step.head<3>();
+            incrementedState._rotation = (state._rotation * get_quaternion_from_scale_axis_coefficients(step.tail<3>())).normalized();
+            return incrementedState;
+        }
+
+        Global_Pose_Model::vector6 Global_Pose_Model::get_parameters(const state_type& state) const
+        {
+            vector6 parameters;
+            parameters << state._position, get_scaled_axis_coefficients_from_quaternion(state._rotation);
+            return parameters;
         }
 
 
         /**
          * \brief Return a string corresponding to the end status of the optimization
          */
-        const std::string get_human_readable_end_message(Eigen::LevenbergMarquardtSpace::Status status) 
+        const std::string get_human_readable_end_message(const Minimization_Status status) 
         {
             switch(status) {
-                case Eigen::LevenbergMarquardtSpace::Status::NotStarted :
-                    return "not started";
-                case Eigen::LevenbergMarquardtSpace::Status::Running :
-                    return "running";
-                case Eigen::LevenbergMarquardtSpace::Status::ImproperInputParameters :
-                    return "improper input parameters";
-                case Eigen::LevenbergMarquardtSpace::Status::RelativeReductionTooSmall :
-                    return "relative reduction too small";
-                case Eigen::LevenbergMarquardtSpace::Status::RelativeErrorTooSmall :
-                    return "relative error too small";
-                case Eigen::LevenbergMarquardtSpace::Status::RelativeErrorAndReductionTooSmall :
-                    return "relative error and reduction too small";
-                case Eigen::LevenbergMarquardtSpace::Status::CosinusTooSmall :
-                    return "cosinus too small";
-                case Eigen::LevenbergMarquardtSpace::Status::TooManyFunctionEvaluation :
-                    return "too many function evaluation";
-                case Eigen::LevenbergMarquardtSpace::Status::FtolTooSmall :
-                    return "xtol too small";
-                case Eigen::LevenbergMarquardtSpace::Status::XtolTooSmall :
-                    return "ftol too small";
-                case Eigen::LevenbergMarquardtSpace::Status::GtolTooSmall :
-                    return "gtol too small";
-                case Eigen::LevenbergMarquardtSpace::Status::UserAsked :
-                    return "user asked";
+                case Minimization_Status::SmallGradient :
+                    return "gradient too small";
+                case Minimization_Status::SmallStep :
+                    return "step too small";
+                case Minimization_Status::SmallErrorReduction :
+                    return "relative error reduction too small";
+                case Minimization_Status::TooManyIterations :
+                    return "too many iterations";
+                case Minimization_Status::InvalidStartError :
+                    return "invalid start error";
+                case Minimization_Status::SingularSystem :
+                    return "singular system";
                 default:
                     return "error: empty message";
             }
@@ -4,49 +4,11 @@
 #include "types.hpp"
 #include "matches_containers.hpp"
 
-// types
-#include <unsupported/Eigen/NonLinearOptimization>
+#include "fixed_size_levenberg_marquardt.hpp"
 
 namespace rgbd_slam {
     namespace pose_optimization {
 
-        /**
-         * \brief Structure given to the Levenberg-Marquardt algorithm. It optimizes a rotation (quaternion) and a translation (vector3) using the matched features from a frame to the local map, using their distances to one another as the main metric.
-         *
-         */
-        template<typename _Scalar, int NX = Eigen::Dynamic, int NY = Eigen::Dynamic>
-            struct Levenberg_Marquardt_Functor 
-            {
-
-                //tell the called the numerical type and input/ouput size
-                typedef _Scalar Scalar;
-                enum {
-                    InputsAtCompileTime = NX,
-                    ValuesAtCompileTime = NY
-                };
-
-                // typedefs for the original functor
-                typedef Eigen::Matrix<Scalar, InputsAtCompileTime, 1> InputType;
-                typedef Eigen::Matrix<Scalar, ValuesAtCompileTime, 1> ValueType;
-                typedef Eigen::Matrix<Scalar, ValuesAtCompileTime, InputsAtCompileTime> JacobianType;
-
-                Levenberg_Marquardt_Functor(const uint inputCount, const uint outputCount) :
-                    _M(inputCount), _N(outputCount)
-                {
-                }
-
-                uint values() const {
-                    return _N;
-                }
-                uint inputs() const {
-                    return _M;
-                }
-
-                uint _M;
-                uint _N;
-            };
-
-
         /**
          * \brief Compute a Lie projection of this quaternion for optimization purposes (Scaled Axis representation)
          */
@@ -64,47 +26,87 @@ namespace rgbd_slam {
 
 
         /**
-         * \brief Implementation of the main pose and orientation optimisation, to be used by the Levenberg Marquard optimisator. 
+         * \brief Pose error model of the fixed size Levenberg-Marquardt solver. It optimizes a rotation (quaternion) and a translation (vector3) using the matched features from a frame to the local map, using their distances to one another as the main metric.
+         * The steps are (translation, rotation) increments, the rotation increment being applied on the right of the current rotation
          */
-        struct Global_Pose_Estimator :
-            Levenberg_Marquardt_Functor<double>
+        class Global_Pose_Model
         {
-            // Simple constructor
-            /**
-             * \param[in] n Number of input parameters 
-             * \param[in,out] points Matched 2D (screen) to 3D (world) points
-             * \param[in] worldPosition Position of the observer in the world
-             * \param[in] worldRotation Orientation of the observer in the world
-             */
-            Global_Pose_Estimator(const size_t n, const matches_containers::match_point_container& points, const vector3& worldPosition, const quaternion& worldRotation);
-
-            /**
-             * \brief Implementation of the objective function
-             *
-             * \param[in] x The vector of parameters to optimize (Size M)
-             * \param[out] fvec The vector of errors, of size N (N the number of points) 
-             */
-            int operator()(const Eigen::VectorXd& x, Eigen::VectorXd& fvec) const;
-
-            private:
-            const matches_containers::match_point_container& _points; 
-            const quaternion _rotation;
-            const vector3 _position;
-
-            // Error function parameters
-            const double _pointErrorMultiplier;
-            const double _lossScale;
-            const double _lossAlpha;
-        };
+            public:
+                typedef Eigen::Matrix<double, 6, 1> vector6;
+                typedef Eigen::Matrix<double, 6, 6> matrix66;
+
+                /**
+                 * \brief Pose of the observer in the world
+                 */
+                struct state_type
+                {
+                    vector3 _position;
+                    quaternion _rotation;
 
-        struct Global_Pose_Functor : Eigen::NumericalDiff<Global_Pose_Estimator> {};
+                    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+                };
 
+                /**
+                 * \param[in] points Matched 2D (screen) to 3D (world) points. Must outlive this model
+                 * \param[in] pointIndexes Indexes of the matches of points to use, empty only if the primitives constrain the pose. Must outlive this model
+                 * \param[in] primitives Matched camera to world primitives, constraining the orientation and the plane distances. Must outlive this model
+                 */
+                Global_Pose_Model(const matches_containers::match_point_container& points, const matches_containers::match_index_view pointIndexes, const matches_containers::match_primitive_container& primitives);
+
+                /**
+                 * \brief Compute the sum of the squared errors of all matches
+                 */
+                double get_squared_error(const state_type& state) const;
+
+                /**
+                 * \brief Accumulate the normal equations of the errors, match by match
+                 *
+                 * \param[in] state The pose at which the errors are linearized
+                 * \param[out] normalMatrix J^T.J, with J the jacobian of the errors with respect to a step
+                 * \param[out] gradient J^T.f, with f the vector of errors
+                 *
+                 * \return The sum of the squared errors
+                 */
+                double get_normal_equations(const state_type& state, matrix66& normalMatrix, vector6& gradient) const;
+
+                /**
+                 * \brief Apply a (translation, rotation) step to a pose
+                 */
+                state_type get_incremented_state(const state_type& state, const vector6& step) const;
+
+                /**
+                 * \brief Coordinates of a pose, used to scale the trust region: the position, and the scaled axis of the rotation
+                 */
+                vector6 get_parameters(const state_type& state) const;
 
-        /**
-         * \brief Use for debug.
-         * \return Returns a string with the human readable version of Eigen LevenbergMarquardt output status
-         */
-        const std::string get_human_readable_end_message(Eigen::LevenbergMarquardtSpace::Status status);
+            private:
+                /**
+                 * \brief Compute the mean of the retroprojection distances, and optionally the mean of their jacobians
+                 */
+                double get_mean_of_distances(const state_type& state, Eigen::Matrix<double, 1, 6>* meanOfJacobians) const;
+
+                /**
+                 * \brief Add the errors of the primitive matches to the squared error, and optionally their normal equations
+                 *
+                 * \param[in] state The pose at which the errors are computed
+                 * \param[in, out] normalMatrix If not null, J^T.J of the primitive errors is added to it
+                 * \param[in, out] gradient If not null, J^T.f of the primitive errors is added to it
+                 *
+                 * \return The sum of the squared errors of the primitive matches
+                 */
+                double add_primitive_errors(const state_type& state, matrix66* normalMatrix, vector6* gradient) const;
+
+                const matches_containers::match_point_container& _points; 
+                const matches_containers::match_index_view _pointIndexes;
+                const matches_containers::match_primitive_container& _primitives;
+
+                // Error function parameters
+                const double _pointErrorMultiplier;
+                const double _lossScale;
+                const double _lossAlpha;
+                const double _primitiveNormalErrorMultiplier;
+                const double _primitiveDistanceErrorMultiplier;
+        };
 
     }       /* pose_optimization*/
 }   /* rgbd_slam */
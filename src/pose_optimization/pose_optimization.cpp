@@ -12,93 +12,232 @@
 #include "ransac.hpp"
 
 #include <Eigen/StdVector>
+#include <Eigen/Geometry>
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <random>
+
+#include <opencv2/core/utility.hpp>
 
 namespace rgbd_slam {
     namespace pose_optimization {
 
-        bool Pose_Optimization::compute_pose_with_ransac(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& finalPose, matches_containers::match_point_container& outlierMatchedPoints) 
+        // Sample size of the minimal pose solvers (P3P and Umeyama)
+        const uint MINIMAL_SAMPLE_SIZE = 3;
+        // Smallest eigenvalue of the sum of n.n^T over the matched plane normals for the planes to constrain the pose. 1 for three orthogonal planes
+        const double MINIMUM_PLANE_NORMALS_EIGENVALUE = 0.1;
+
+        typedef Eigen::Array<double, 1, Eigen::Dynamic> distance_array;
+
+        /**
+         * \brief Scratch space of a RANSAC worker thread, allocated on its first hypothesis and reused afterward
+         */
+        struct Ransac_Scratch
+        {
+            Ransac_Scratch()
+            {
+                // A minimal solver returns up to four poses
+                _candidatePoses.reserve(4);
+            }
+
+            std::array<size_t, MINIMAL_SAMPLE_SIZE> _sampleRanks;
+            std::array<size_t, MINIMAL_SAMPLE_SIZE> _sampleIndexes;
+            utils::pose_array _candidatePoses;
+            Eigen::Matrix<double, 3, Eigen::Dynamic> _projectedPoints;
+            distance_array _distances;
+        };
+
+        /**
+         * \brief Compute the retroprojection distances of all matches at once, with a single 3x4 projection matrix. Matches are retroprojected as in get_3D_to_2D_distance
+         *
+         * \param[in] pose The pose of the observer
+         * \param[in] matchedPoints The matches to retroproject
+         * \param[out] projectedPoints Scratch space for the homogeneous projections of the world points
+         * \param[out] distances The manhattan distance between each retroprojected world point and its screen point. Infinite for points behind the camera
+         */
+        void get_retroprojection_distances(const utils::Pose& pose, const matches_containers::match_point_container& matchedPoints, Eigen::Matrix<double, 3, Eigen::Dynamic>& projectedPoints, distance_array& distances)
+        {
+            matrix33 cameraMatrix;
+            cameraMatrix << 
+                Parameters::get_camera_1_focal_x(), 0, Parameters::get_camera_1_center_x(),
+                0, Parameters::get_camera_1_focal_y(), Parameters::get_camera_1_center_y(),
+                0, 0, 1;
+            const matrix34& projectionMatrix = cameraMatrix * utils::compute_world_to_camera_transform(pose.get_orientation_quaternion(), pose.get_position()).topRows<3>();
+
+            projectedPoints.noalias() = projectionMatrix.leftCols<3>() * matchedPoints.get_world_points();
+            projectedPoints.colwise() += projectionMatrix.col(3);
+
+            const auto& depths = projectedPoints.row(2).array();
+            const auto& screenPoints = matchedPoints.get_screen_points();
+            distances = (depths > 0).select(
+                    (projectedPoints.row(0).array() / depths - screenPoints.row(0).array()).abs() + (projectedPoints.row(1).array() / depths - screenPoints.row(1).array()).abs(),
+                    std::numeric_limits<double>::infinity()
+                    );
+        }
+
+        bool Pose_Optimization::compute_pose_with_ransac(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& finalPose, matches_containers::match_index_container& outlierIndexes) 
         {
             const size_t matchedPointSize = matchedPoints.size();
             assert(matchedPointSize > 0);
 
-            const uint minimumPointsForOptimization = Parameters::get_minimum_point_count_for_optimization();    // Number of random points to select, minimum number of points to compute a pose
+            const uint minimumPointsForOptimization = Parameters::get_minimum_point_count_for_optimization();    // Minimum number of inliers to optimize the final pose
             const double maximumRetroprojectionThreshold = Parameters::get_ransac_maximum_retroprojection_error_for_inliers(); // maximum inlier threshold, in pixels 
             const double acceptableInliersForEarlyStop = matchedPointSize * Parameters::get_ransac_minimum_inliers_proportion_for_early_stop(); // RANSAC will stop early if this inlier count is reached
 
             assert(minimumPointsForOptimization > 0);
             assert(maximumRetroprojectionThreshold > 0);
             assert(acceptableInliersForEarlyStop > 0);
+
+            if (matchedPointSize < std::max(minimumPointsForOptimization, MINIMAL_SAMPLE_SIZE))
+            {
+                utils::log_error("Not enough matches to compute a pose");
+                return false;
+            }
             
             // Compute maximum iteration with the original RANSAC formula
-            const uint maximumIterations = log(1.0 - Parameters::get_ransac_probability_of_success()) / log(1.0 - pow(Parameters::get_ransac_inlier_proportion(), minimumPointsForOptimization));
+            const uint maximumIterations = std::max(1.0, log(1.0 - Parameters::get_ransac_probability_of_success()) / log(1.0 - pow(Parameters::get_ransac_inlier_proportion(), MINIMAL_SAMPLE_SIZE)));
             assert(maximumIterations > 0);
 
-            // set the start score to the maximum score
-            double minScore = matchedPointSize * maximumRetroprojectionThreshold;
-            utils::Pose bestPose = currentPose;
-            matches_containers::match_point_container inlierMatchedPoints;  // Contains the best pose inliers
-            for(uint iteration = 0; iteration < maximumIterations; ++iteration)
+            // Guided sampling: rank the matches by decreasing score, and draw the first hypotheses among the best ranked matches only
+            matches_containers::match_index_container rankedIndexes(matchedPointSize);
+            std::iota(rankedIndexes.begin(), rankedIndexes.end(), 0);
+            std::stable_sort(rankedIndexes.begin(), rankedIndexes.end(), [&matchedPoints](const size_t indexA, const size_t indexB) {
+                    return matchedPoints.get_match_score(indexA) > matchedPoints.get_match_score(indexB);
+                    });
+            std::vector<size_t> sampleLimits;
+            get_progressive_sampling_limits(MINIMAL_SAMPLE_SIZE, matchedPointSize, maximumIterations, sampleLimits);
+
+            // Each hypothesis keeps its own best candidate, so the selected pose does not depend on the order in which the threads finish them
+            struct Hypothesis
             {
-                const matches_containers::match_point_container& selectedMatches = get_random_subset(matchedPoints, minimumPointsForOptimization);
-                assert(selectedMatches.size() == minimumPointsForOptimization);
-                utils::Pose pose; 
-                const bool isPoseValid = Pose_Optimization::get_optimized_global_pose(currentPose, selectedMatches, pose);
-                //const bool isPoseValid = Pose_Optimization::compute_p3p_pose(currentPose, selectedMatches, pose);
-                if (not isPoseValid)
-                    continue;
-
-                const matrix44& transformationMatrix = utils::compute_world_to_camera_transform(pose.get_orientation_quaternion(), pose.get_position());
-
-                // Select inliers by retroprojection threshold
-                matches_containers::match_point_container potentialInliersContainer;
-                matches_containers::match_point_container potentialOutliersContainer;
-                double score = 0.0;
-                for (const matches_containers::Match& match : matchedPoints)
-                {
-                    // Retroproject world point to screen, and compute screen distance
-                    const double distance = utils::get_3D_to_2D_distance(match._worldPoint, match._screenPoint, transformationMatrix);
-                    assert(distance >= 0);
-                    if (distance < maximumRetroprojectionThreshold)
-                    {
-                        potentialInliersContainer.insert(potentialInliersContainer.end(), match);
-                        score += distance;
-                    }
-                    else
+                utils::Pose _pose;
+                double _score = std::numeric_limits<double>::max();
+                size_t _inlierCount = 0;
+
+                EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            };
+            std::vector<Hypothesis, Eigen::aligned_allocator<Hypothesis>> hypotheses(maximumIterations);
+            const uint randomSeed = Parameters::get_ransac_random_seed();
+            // Index of the first hypothesis that reached the early stop inlier count: the hypotheses after it are skipped, the ones before it are all scored
+            std::atomic<size_t> earlyStopIndex(maximumIterations);
+
+            // Generate and score the hypotheses in parallel
+            cv::parallel_for_(cv::Range(0, static_cast<int>(maximumIterations)), [&](const cv::Range& hypothesisRange) {
+                    thread_local Ransac_Scratch scratch;
+
+                    for (size_t hypothesisIndex = static_cast<size_t>(hypothesisRange.start); hypothesisIndex < static_cast<size_t>(hypothesisRange.end); ++hypothesisIndex)
                     {
-                        potentialOutliersContainer.insert(potentialOutliersContainer.end(), match);
-                        score += maximumRetroprojectionThreshold;
+                        // An earlier hypothesis is good enough: skip the remaining ones
+                        if (hypothesisIndex > earlyStopIndex.load(std::memory_order_relaxed))
+                            return;
+
+                        // The sample only depends on the seed and the hypothesis index
+                        std::mt19937 randomGenerator(get_hypothesis_seed(randomSeed, hypothesisIndex));
+
+                        // When the sample limit grows, the newly eligible match is always in the sample, like in PROSAC
+                        const size_t sampleLimit = sampleLimits[hypothesisIndex];
+                        if (hypothesisIndex > 0 and sampleLimit != sampleLimits[hypothesisIndex - 1])
+                        {
+                            get_random_subset(sampleLimit - 1, std::span<size_t>(scratch._sampleRanks.data(), MINIMAL_SAMPLE_SIZE - 1), randomGenerator);
+                            scratch._sampleRanks.back() = sampleLimit - 1;
+                        }
+                        else
+                            get_random_subset(sampleLimit, scratch._sampleRanks, randomGenerator);
+
+                        for (uint i = 0; i < MINIMAL_SAMPLE_SIZE; ++i)
+                            scratch._sampleIndexes[i] = rankedIndexes[scratch._sampleRanks[i]];
+                        const matches_containers::match_index_view selectedMatches(scratch._sampleIndexes);
+
+                        // Minimal solvers: closed form alignment if the three matches have a depth, P3P if not
+                        scratch._candidatePoses.clear();
+                        const bool isSample3D = std::all_of(selectedMatches.begin(), selectedMatches.end(), [&matchedPoints](const size_t matchIndex) {
+                                return matchedPoints.get_screen_point(matchIndex).z() > 0;
+                                });
+                        if (isSample3D)
+                        {
+                            utils::Pose pose;
+                            if (Pose_Optimization::compute_umeyama_pose(matchedPoints, selectedMatches, pose))
+                                scratch._candidatePoses.push_back(pose);
+                        }
+                        else
+                            Pose_Optimization::compute_p3p_poses(matchedPoints, selectedMatches, scratch._candidatePoses);
+
+                        Hypothesis& hypothesis = hypotheses[hypothesisIndex];
+                        for (const utils::Pose& pose : scratch._candidatePoses)
+                        {
+                            // Inliers are under the retroprojection threshold, outliers count as the threshold
+                            get_retroprojection_distances(pose, matchedPoints, scratch._projectedPoints, scratch._distances);
+                            const auto& isInlier = scratch._distances < maximumRetroprojectionThreshold;
+                            const double score = isInlier.select(scratch._distances, maximumRetroprojectionThreshold).sum();
+
+                            if (score < hypothesis._score)
+                            {
+                                hypothesis._pose = pose;
+                                hypothesis._score = score;
+                                hypothesis._inlierCount = isInlier.count();
+                            }
+                        }
+
+                        if (hypothesis._inlierCount >= acceptableInliersForEarlyStop)
+                        {
+                            // The optimization is good enough: keep the lowest early stop index
+                            size_t stopIndex = earlyStopIndex.load(std::memory_order_relaxed);
+                            while (hypothesisIndex < stopIndex and not earlyStopIndex.compare_exchange_weak(stopIndex, hypothesisIndex, std::memory_order_relaxed));
+                        }
                     }
-                }
+                    });
 
-                // We have a better score than the previous best one
-                if (score < minScore)
+            // Select the best hypothesis up to the early stop, the first one in case of equal scores
+            const size_t lastHypothesisIndex = std::min(earlyStopIndex.load(), static_cast<size_t>(maximumIterations - 1));
+            utils::Pose bestPose = currentPose;
+            double minScore = matchedPointSize * maximumRetroprojectionThreshold;   // set the start score to the maximum score
+            size_t bestInlierCount = 0;
+            for (size_t hypothesisIndex = 0; hypothesisIndex <= lastHypothesisIndex; ++hypothesisIndex)
+            {
+                const Hypothesis& hypothesis = hypotheses[hypothesisIndex];
+                if (hypothesis._score < minScore)
                 {
-                    minScore = score;
-                    bestPose = pose;
-                    inlierMatchedPoints.swap(potentialInliersContainer);
-                    outlierMatchedPoints.swap(potentialOutliersContainer);
-
-                    if (inlierMatchedPoints.size() >= acceptableInliersForEarlyStop)
-                    {
-                        // We can stop here, the optimization is good enough
-                        break;
-                    }
+                    minScore = hypothesis._score;
+                    bestPose = hypothesis._pose;
+                    bestInlierCount = hypothesis._inlierCount;
                 }
             }
 
-            if (inlierMatchedPoints.size() < minimumPointsForOptimization)
+            if (bestInlierCount < minimumPointsForOptimization)
             {
                 utils::log_error("Could not find a transformation with enough inliers");
                 // error case
                 return false;
             }
 
-            const bool isPoseValid = Pose_Optimization::get_optimized_global_pose(bestPose, inlierMatchedPoints, finalPose);
+            // Split the matches with the inlier mask of the best pose only. The nonlinear optimization only runs on the final inliers
+            Eigen::Matrix<double, 3, Eigen::Dynamic> projectedPoints;
+            distance_array distances;
+            get_retroprojection_distances(bestPose, matchedPoints, projectedPoints, distances);
+
+            matches_containers::match_index_container inlierIndexes;
+            inlierIndexes.reserve(bestInlierCount);
+            outlierIndexes.clear();
+            outlierIndexes.reserve(matchedPointSize - bestInlierCount);
+            for (size_t matchIndex = 0; matchIndex < matchedPointSize; ++matchIndex)
+            {
+                if (distances(matchIndex) < maximumRetroprojectionThreshold)
+                    inlierIndexes.push_back(matchIndex);
+                else
+                    outlierIndexes.push_back(matchIndex);
+            }
+            assert(inlierIndexes.size() == bestInlierCount);
+
+            const bool isPoseValid = Pose_Optimization::get_optimized_global_pose(bestPose, matchedPoints, inlierIndexes, matchedPrimitives, finalPose);
             // Compute pose variance
             if (isPoseValid)
             {
                 vector3 estimatedPoseVariance;
-                if (utils::compute_pose_variance(finalPose, inlierMatchedPoints, estimatedPoseVariance))
+                if (utils::compute_pose_variance(finalPose, matchedPoints, inlierIndexes, estimatedPoseVariance))
                 {
                     finalPose.set_position_variance( estimatedPoseVariance + currentPose.get_position_variance());
                     return true;
@@ -110,10 +249,49 @@ namespace rgbd_slam {
             return false;
         }
 
-        bool Pose_Optimization::compute_optimized_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose, matches_containers::match_point_container& outlierMatchedPoints) 
+        bool Pose_Optimization::compute_optimized_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& optimizedPose, matches_containers::match_index_container& outlierIndexes) 
         {
+            const size_t matchedPointSize = matchedPoints.size();
+            if (matchedPointSize < std::max(Parameters::get_minimum_point_count_for_optimization(), MINIMAL_SAMPLE_SIZE) and is_pose_constrained_by_primitives(matchedPrimitives))
+            {
+                // Too few points for RANSAC, but the planes constrain the pose: optimize it from the current pose with the planes alone
+                outlierIndexes.clear();
+                const matches_containers::match_index_container noPointIndexes;
+                utils::Pose primitivePose;
+                if (not get_optimized_global_pose(currentPose, matchedPoints, noPointIndexes, matchedPrimitives, primitivePose))
+                    return false;
+
+                // Split the matches with the RANSAC inlier threshold at this pose, so a wrong match cannot bias it, then optimize again with the inliers
+                Eigen::Matrix<double, 3, Eigen::Dynamic> projectedPoints;
+                distance_array distances;
+                get_retroprojection_distances(primitivePose, matchedPoints, projectedPoints, distances);
+
+                const double maximumRetroprojectionThreshold = Parameters::get_ransac_maximum_retroprojection_error_for_inliers();
+                matches_containers::match_index_container inlierIndexes;
+                inlierIndexes.reserve(matchedPointSize);
+                for (size_t matchIndex = 0; matchIndex < matchedPointSize; ++matchIndex)
+                {
+                    if (distances(matchIndex) < maximumRetroprojectionThreshold)
+                        inlierIndexes.push_back(matchIndex);
+                    else
+                        outlierIndexes.push_back(matchIndex);
+                }
+                utils::Pose newPose = primitivePose;
+                if (not inlierIndexes.empty() and not get_optimized_global_pose(primitivePose, matchedPoints, inlierIndexes, matchedPrimitives, newPose))
+                    return false;
+
+                // The position variance can only be estimated with 3D points: keep the current one otherwise
+                vector3 estimatedPoseVariance = vector3::Zero();
+                if (not inlierIndexes.empty())
+                    utils::compute_pose_variance(newPose, matchedPoints, inlierIndexes, estimatedPoseVariance);
+                newPose.set_position_variance(estimatedPoseVariance + currentPose.get_position_variance());
+
+                optimizedPose = newPose;
+                return true;
+            }
+
             utils::Pose newPose;
-            const bool isPoseValid = compute_pose_with_ransac(currentPose, matchedPoints, newPose, outlierMatchedPoints);
+            const bool isPoseValid = compute_pose_with_ransac(currentPose, matchedPoints, matchedPrimitives, newPose, outlierIndexes);
 
             if (isPoseValid)
             {
@@ -127,126 +305,138 @@ namespace rgbd_slam {
         }
 
 
-        bool Pose_Optimization::get_optimized_global_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose) 
+        bool Pose_Optimization::is_pose_constrained_by_primitives(const matches_containers::match_primitive_container& matchedPrimitives)
         {
-            assert(matchedPoints.size() >= 6);
-
-            const vector3& position = currentPose.get_position();    // Work in millimeters
-            const quaternion& rotation = currentPose.get_orientation_quaternion();
-
-            // Vector to optimize: (0, 1, 2) is position,
-            // Vector (3, 4, 5) is a rotation parametrization, representing a delta in rotation in the tangential hyperplane -From Using Quaternions for Parametrizing 3-D Rotation in Unconstrained Nonlinear Optimization)
-            Eigen::VectorXd input(6);
-            // 3D pose
-            input[0] = position.x();
-            input[1] = position.y();
-            input[2] = position.z();
-            // X Y Z of a quaternion representation. (0, 0, 0) corresponds to the quaternion itself
-            const vector3& rotationCoefficients = get_scaled_axis_coefficients_from_quaternion(rotation);
-            input[3] = rotationCoefficients.x();
-            input[4] = rotationCoefficients.y();
-            input[5] = rotationCoefficients.z();
-
-            // Optimization function 
-            Global_Pose_Functor pose_optimisation_functor(
-                    Global_Pose_Estimator(
-                        input.size(), 
-                        matchedPoints, 
-                        currentPose.get_position(),
-                        currentPose.get_orientation_quaternion()
-                        )
-                    );
+            matrix33 normalsMatrix = matrix33::Zero();
+            for (const matches_containers::Primitive_Match& match : matchedPrimitives)
+            {
+                // Cylinder axes only constrain the rotation
+                if (match._isAxis)
+                    continue;
+                const vector3& worldNormal = match._worldPlane.head<3>();
+                normalsMatrix.noalias() += worldNormal * worldNormal.transpose();
+            }
+
+            const Eigen::SelfAdjointEigenSolver<matrix33> eigenSolver(normalsMatrix, Eigen::EigenvaluesOnly);
+            return eigenSolver.eigenvalues().minCoeff() >= MINIMUM_PLANE_NORMALS_EIGENVALUE;
+        }
+
+        bool Pose_Optimization::get_optimized_global_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& optimizedPose) 
+        {
+            assert(matchIndexes.size() >= Parameters::get_minimum_point_count_for_optimization() or is_pose_constrained_by_primitives(matchedPrimitives));
+
+            // Work in millimeters
+            Global_Pose_Model::state_type pose;
+            pose._position = currentPose.get_position();
+            pose._rotation = currentPose.get_orientation_quaternion();
+
+            Minimization_Settings settings;
+            // maximum number of function evaluation
+            settings._maximumIterations = Parameters::get_optimization_maximum_iterations();
+            // tolerance for the norm of the solution vector
+            settings._stepTolerance = Parameters::get_optimization_xtol();
+            // tolerance for the norm of the vector function
+            settings._errorTolerance = Parameters::get_optimization_ftol();
+            // tolerance for the norm of the gradient of the error function
+            settings._gradientTolerance = Parameters::get_optimization_gtol();
+            // step bound for the diagonal shift
+            settings._initialStepBound = Parameters::get_optimization_factor();
+
+            // Optimization function, with 6 parameters: the position, and a rotation increment in the tangential hyperplane. The primitives constrain the pose along with the points
+            const Global_Pose_Model poseModel(matchedPoints, matchIndexes, matchedPrimitives);
             // Optimization algorithm
-            Eigen::LevenbergMarquardt<Global_Pose_Functor, double> poseOptimizator( pose_optimisation_functor );
-
-            // maxfev   : maximum number of function evaluation
-            poseOptimizator.parameters.maxfev = Parameters::get_optimization_maximum_iterations();
-            // epsfcn   : error precision
-            poseOptimizator.parameters.epsfcn = Parameters::get_optimization_error_precision();
-            // xtol     : tolerance for the norm of the solution vector
-            poseOptimizator.parameters.xtol = Parameters::get_optimization_xtol();
-            // ftol     : tolerance for the norm of the vector function
-            poseOptimizator.parameters.ftol = Parameters::get_optimization_ftol();
-            // gtol     : tolerance for the norm of the gradient of the error function
-            poseOptimizator.parameters.gtol = Parameters::get_optimization_gtol();
-            // factor   : step bound for the diagonal shift
-            poseOptimizator.parameters.factor = Parameters::get_optimization_factor();
+            Fixed_Size_Levenberg_Marquardt<6, Global_Pose_Model> poseOptimizator(poseModel, settings);
 
             // Start optimization
-            const Eigen::LevenbergMarquardtSpace::Status endStatus = poseOptimizator.minimize(input);
-
-            // Get result
-            const quaternion& endRotation = get_quaternion_from_scale_axis_coefficients(
-                    vector3(
-                        input[3],
-                        input[4],
-                        input[5]
-                        )
-                    ); 
-            const vector3 endPosition(
-                    input[0],
-                    input[1],
-                    input[2]
-                    );
+            const Minimization_Status endStatus = poseOptimizator.minimize(pose);
 
-            if (endStatus <= 0) 
+            if (not is_minimization_successful(endStatus)) 
             {
                 // Error while optimizing 
                 const std::string message = get_human_readable_end_message(endStatus);
-                utils::log("Failed to converge with " + std::to_string(matchedPoints.size()) + " points | Status " + message);
+                utils::log("Failed to converge with " + std::to_string(matchIndexes.size()) + " points | Status " + message);
                 return false;
             }
 
             // Update refined pose with optimized pose
-            optimizedPose.set_parameters(endPosition, endRotation);
+            optimizedPose.set_parameters(pose._position, pose._rotation);
             return true;
         }
 
-        bool Pose_Optimization::compute_p3p_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose)
+        bool Pose_Optimization::compute_p3p_poses(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, utils::pose_array& candidatePoses)
         {
-            assert(matchedPoints.size() == 3);
+            assert(matchIndexes.size() == 3);
             // Do all operations on meters, while this SLAM uses millimeters
             const double multiplier = 1000.0;
 
-            std::vector<vector3> cameraPoints;
-            std::vector<vector3> worldPoints;
-
-            for (const matches_containers::Match& match : matchedPoints)
+            // Fixed size buffers: this runs for each RANSAC hypothesis, and must not allocate
+            std::array<vector3, 3> cameraPoints;
+            std::array<vector3, 3> worldPoints;
+            for (size_t i = 0; i < 3; ++i)
             {
+                const size_t matchIndex = matchIndexes[i];
+                const vector3& screenPoint = matchedPoints.get_screen_point(matchIndex);
                 const vector3 cameraPoint (
-                        (match._screenPoint.x() - Parameters::get_camera_1_center_x()) / Parameters::get_camera_1_focal_x(),
-                        (match._screenPoint.y() - Parameters::get_camera_1_center_y()) / Parameters::get_camera_1_focal_y(),
+                        (screenPoint.x() - Parameters::get_camera_1_center_x()) / Parameters::get_camera_1_focal_x(),
+                        (screenPoint.y() - Parameters::get_camera_1_center_y()) / Parameters::get_camera_1_focal_y(),
                         1
                         );
 
-                cameraPoints.push_back(cameraPoint.normalized());
-                worldPoints.push_back(match._worldPoint / multiplier);
+                cameraPoints[i] = cameraPoint.normalized();
+                worldPoints[i] = matchedPoints.get_world_point(matchIndex) / multiplier;
             }
 
-            const std::vector<lambdatwist::CameraPose>& finalCameraPoses = lambdatwist::p3p(cameraPoints, worldPoints);
-            assert(finalCameraPoses.size() <= 4);
+            std::array<lambdatwist::CameraPose, 4> finalCameraPoses;
+            const int finalCameraPoseCount = lambdatwist::p3p(cameraPoints, worldPoints, finalCameraPoses);
+            assert(finalCameraPoseCount >= 0 and finalCameraPoseCount <= 4);
 
-            const vector3& posePosition = currentPose.get_position();
-            const matrix33& poseRotation = currentPose.get_orientation_matrix();
-
-            double closestPoseDistance = std::numeric_limits<double>::max();
-            for(const lambdatwist::CameraPose& cameraPose : finalCameraPoses)
+            bool isPoseFound = false;
+            for(int i = 0; i < finalCameraPoseCount; ++i)
             {
-                const double rotationDistance = (cameraPose.R - poseRotation).norm();
-                const double positionDistance = (cameraPose.t * multiplier - posePosition).norm();
+                const lambdatwist::CameraPose& cameraPose = finalCameraPoses[i];
+                if (not cameraPose.R.allFinite() or not cameraPose.t.allFinite())
+                    continue;
 
-                assert(rotationDistance >= 0 and not std::isnan(rotationDistance));
-                assert(positionDistance >= 0 and not std::isnan(positionDistance));
-                const double distance = rotationDistance + positionDistance;
+                // The solver computes P_camera = R * P_world + t, while our poses are the camera to world transformation
+                const matrix33& cameraToWorldRotation = cameraPose.R.transpose();
+                candidatePoses.emplace_back(-cameraToWorldRotation * cameraPose.t * multiplier, quaternion(cameraToWorldRotation));
+                isPoseFound = true;
+            }
+            return isPoseFound;
+        }
 
-                if (distance < closestPoseDistance)
-                {
-                    closestPoseDistance = distance;
-                    optimizedPose.set_parameters(cameraPose.t * multiplier, quaternion(cameraPose.R));
-                }
+        bool Pose_Optimization::compute_umeyama_pose(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, utils::Pose& pose)
+        {
+            assert(matchIndexes.size() == 3);
+
+            const double focalX = Parameters::get_camera_1_focal_x();
+            const double focalY = Parameters::get_camera_1_focal_y();
+            const double centerX = Parameters::get_camera_1_center_x();
+            const double centerY = Parameters::get_camera_1_center_y();
+
+            matrix33 cameraPoints;
+            matrix33 worldPoints;
+            for (Eigen::Index i = 0; i < 3; ++i)
+            {
+                const size_t matchIndex = matchIndexes[i];
+                const vector3& screenPoint = matchedPoints.get_screen_point(matchIndex);
+                assert(screenPoint.z() > 0);
+
+                // Back project the screen point with its measured depth
+                cameraPoints.col(i) << 
+                    (screenPoint.x() - centerX) * screenPoint.z() / focalX, 
+                    (screenPoint.y() - centerY) * screenPoint.z() / focalY, 
+                    screenPoint.z();
+                worldPoints.col(i) = matchedPoints.get_world_point(matchIndex);
             }
-            // At least one valid pose found
-            return closestPoseDistance < std::numeric_limits<double>::max();
+
+            // Rigid transformation (no scaling) from camera to world coordinates
+            const matrix44& cameraToWorld = Eigen::umeyama(cameraPoints, worldPoints, false);
+            if (not cameraToWorld.allFinite())
+                return false;
+
+            pose.set_parameters(cameraToWorld.block<3, 1>(0, 3), quaternion(matrix33(cameraToWorld.block<3, 3>(0, 0))));
+            return true;
         }
 
     }   /* pose_optimization*/
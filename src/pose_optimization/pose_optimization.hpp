@@ -16,12 +16,22 @@ namespace rgbd_slam {
                  *
                  * \param[in] currentPose Last observer optimized pose
                  * \param[in] matchedPoints Object containing the match between observed screen points and reliable map & futur map points 
+                 * \param[in] matchedPrimitives Object containing the match between observed primitives and map primitives
                  * \param[out] optimizedPose The estimated world translation & rotation of the camera pose, if the function returned true
-                 * \param[out] outlierMatchedPoints The outliers matched point for the finalPose. Valid if the function returned true
+                 * \param[out] outlierIndexes The indexes of the outlier matches for the finalPose. Valid if the function returned true
                  *
                  * \return True if a valid pose was computed 
                  */
-                static bool compute_optimized_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose, matches_containers::match_point_container& outlierMatchedPoints); 
+                static bool compute_optimized_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& optimizedPose, matches_containers::match_index_container& outlierIndexes); 
+
+                /**
+                 * \brief Check if the matched planes constrain the full pose, so it can be optimized with less point matches than get_minimum_point_count_for_optimization
+                 *
+                 * \param[in] matchedPrimitives Object containing the match between observed primitives and map primitives
+                 *
+                 * \return True if the normals of the matched planes span the three dimensions: they constrain the rotation and the three position coordinates
+                 */
+                static bool is_pose_constrained_by_primitives(const matches_containers::match_primitive_container& matchedPrimitives);
 
             private:
                 /**
@@ -29,11 +39,13 @@ namespace rgbd_slam {
                  *
                  * \param[in] currentPose Last observer optimized pose
                  * \param[in] matchedPoints Object containing the match between observed screen points and reliable map & futur map points 
+                 * \param[in] matchIndexes The indexes of the matches to use
+                 * \param[in] matchedPrimitives Object containing the match between observed primitives and map primitives
                  * \param[out] optimizedPose The estimated world translation & rotation of the camera pose, if the function returned true
                  *
                  * \return True if a valid pose was computed 
                  */
-                static bool get_optimized_global_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose);
+                static bool get_optimized_global_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& optimizedPose);
 
 
                 /**
@@ -41,14 +53,35 @@ namespace rgbd_slam {
                  *
                  * \param[in] currentPose The current pose of the observer
                  * \param[in] matchedPoints Object container the match between observed screen points and local map points 
+                 * \param[in] matchedPrimitives Object containing the match between observed primitives and map primitives. They are not used to select the inliers, only to optimize the final pose
                  * \param[out] finalPose The optimized pose, valid if the function returned true
-                 * \param[out] outlierMatchedPoints The outliers matched point for the finalPose. Valid if the function returned true
+                 * \param[out] outlierIndexes The indexes of the outlier matches for the finalPose. Valid if the function returned true
                  *
                  * \return True if a valid pose and inliers were found
                  */
-                static bool compute_pose_with_ransac(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& finalPose, matches_containers::match_point_container& outlierMatchedPoints); 
+                static bool compute_pose_with_ransac(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_primitive_container& matchedPrimitives, utils::Pose& finalPose, matches_containers::match_index_container& outlierIndexes); 
+
+                /**
+                 * \brief Compute the poses retroprojecting three matches exactly, with the lambdatwist P3P solver. Only the screen coordinates of the matches are used, so it works with 2D matches
+                 *
+                 * \param[in] matchedPoints Object containing the match between observed screen points and local map points
+                 * \param[in] matchIndexes The indexes of the three matches to use
+                 * \param[out] candidatePoses The candidate poses (up to four) are added to this container
+                 *
+                 * \return True if at least one pose was found
+                 */
+                static bool compute_p3p_poses(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, utils::pose_array& candidatePoses);
 
-                static bool compute_p3p_pose(const utils::Pose& currentPose, const matches_containers::match_point_container& matchedPoints, utils::Pose& optimizedPose);
+                /**
+                 * \brief Compute the pose aligning three matches with a valid depth to their world points, with the closed form absolute orientation of Umeyama
+                 *
+                 * \param[in] matchedPoints Object containing the match between observed screen points and local map points
+                 * \param[in] matchIndexes The indexes of the three matches to use. They must all have a valid depth
+                 * \param[out] pose The computed pose, valid if the function returned true
+                 *
+                 * \return True if a valid pose was computed
+                 */
+                static bool compute_umeyama_pose(const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view matchIndexes, utils::Pose& pose);
         };
 
     }   /* pose_optimization */
@@ -1,32 +1,92 @@
 #ifndef RGBDSLAM_POSEOPTIMIZATION_RANSAC_HPP
 #define RGBDSLAM_POSEOPTIMIZATION_RANSAC_HPP
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
 
 namespace rgbd_slam {
     namespace pose_optimization {
 
         /**
-         * \brief Return a random subset of unique elements, of size n. It is inefficient if n is very inferior to inContainer.size
-         * \param[in] inContainer A container of size > numberOfElementsToChoose, in which this function will pick elements
-         * \param[in] numberOfElementsToChoose The number of elements we which to find in the final container
-         * \return A container of size numberOfElementsToChoose, with no duplicated elements.
+         * \brief Select a random subset of unique values in [0, candidateCount), with the algorithm of Floyd: one random draw by selected value, and no memory allocated
+         * \param[in] candidateCount The number of values to choose from, superior or equal to subset.size()
+         * \param[out] subset Receives the selected values, in no particular order
+         * \param[in, out] randomGenerator The random generator used to pick the values
          */
-        template< template<typename> class Container, typename T>
-            Container<T> get_random_subset(const Container<T>& inContainer, const uint numberOfElementsToChoose)
+        template<class RandomGenerator>
+            void get_random_subset(const size_t candidateCount, std::span<size_t> subset, RandomGenerator& randomGenerator)
             {
-                assert(numberOfElementsToChoose <= inContainer.size());
-
-                // get a vector of references and shuffle it
-                std::vector<std::reference_wrapper<const T>> copyVector(inContainer.cbegin(), inContainer.cend());
-                std::random_shuffle(copyVector.begin(), copyVector.end());
-                assert(copyVector.size() == inContainer.size());
-
-                // copy the first matches, they will be randoms
-                Container<T> outContainer;
-                for(uint i = 0; i < numberOfElementsToChoose; ++i)
-                    outContainer.insert(outContainer.begin(), copyVector[i]);
-                return outContainer;
+                const size_t subsetSize = subset.size();
+                assert(subsetSize <= candidateCount);
+
+                for(size_t i = 0; i < subsetSize; ++i)
+                {
+                    const size_t upperBound = candidateCount - subsetSize + i;
+                    std::uniform_int_distribution<size_t> distribution(0, upperBound);
+                    const size_t value = distribution(randomGenerator);
+
+                    // If the value is already selected, the upper bound cannot be
+                    const auto selectedEnd = subset.begin() + i;
+                    subset[i] = (std::find(subset.begin(), selectedEnd, value) == selectedEnd) ? value : upperBound;
+                }
+            }
+
+        /**
+         * \brief Compute the random seed of a hypothesis from the seed of the RANSAC call, with the splitmix64 finalizer, so close hypothesis indexes get unrelated random sequences
+         * \param[in] seed The seed of the RANSAC call
+         * \param[in] hypothesisIndex The index of the hypothesis
+         * \return A seed that only depends on the two parameters, whichever thread draws the hypothesis
+         */
+        inline uint32_t get_hypothesis_seed(const uint32_t seed, const size_t hypothesisIndex)
+        {
+            uint64_t value = (static_cast<uint64_t>(seed) << 32) + static_cast<uint64_t>(hypothesisIndex) + 0x9e3779b97f4a7c15ULL;
+            value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+            return static_cast<uint32_t>(value ^ (value >> 31));
+        }
+
+        /**
+         * \brief Compute the progressive sampling schedule of PROSAC (Chum & Matas, 2005): each hypothesis draws its sample among the best ranked candidates only, and the number of candidates grows with the hypothesis count, so the likely inliers are tried first
+         * \param[in] sampleSize The number of candidates in a sample
+         * \param[in] candidateCount The total number of candidates, superior or equal to sampleSize
+         * \param[in] iterationCount The number of hypotheses. The number of candidates grows at least geometrically, so the last hypothesis samples among all the candidates, like RANSAC
+         * \param[out] sampleLimits For each hypothesis, the number of best ranked candidates to draw from
+         */
+        inline void get_progressive_sampling_limits(const size_t sampleSize, const size_t candidateCount, const size_t iterationCount, std::vector<size_t>& sampleLimits)
+        {
+            assert(sampleSize > 0);
+            assert(sampleSize <= candidateCount);
+            sampleLimits.resize(iterationCount);
+
+            // Mean number of samples drawn only from the best sampleSize candidates, out of iterationCount uniform samples
+            double meanSampleCount = static_cast<double>(iterationCount);
+            for(size_t i = 0; i < sampleSize; ++i)
+                meanSampleCount *= static_cast<double>(sampleSize - i) / static_cast<double>(candidateCount - i);
+
+            // Growth function: the sample limit is the smallest limit for which the progressive sample count reaches the hypothesis count.
+            // PROSAC adds at most one candidate by hypothesis, which is too slow for the few hypotheses of a minimal solver
+            size_t sampleLimit = sampleSize;
+            double progressiveSampleCount = 1.0;
+            for(size_t iteration = 0; iteration < iterationCount; ++iteration)
+            {
+                const double progress = (iterationCount > 1) ? static_cast<double>(iteration) / static_cast<double>(iterationCount - 1) : 1.0;
+                const size_t minimumSampleLimit = static_cast<size_t>(std::ceil(static_cast<double>(sampleSize) * std::pow(static_cast<double>(candidateCount) / static_cast<double>(sampleSize), progress) - 1e-9));
+
+                while ((progressiveSampleCount < static_cast<double>(iteration + 1) or sampleLimit < minimumSampleLimit) and sampleLimit < candidateCount)
+                {
+                    const double nextMeanSampleCount = meanSampleCount * static_cast<double>(sampleLimit + 1) / static_cast<double>(sampleLimit + 1 - sampleSize);
+                    progressiveSampleCount += std::ceil(nextMeanSampleCount - meanSampleCount);
+                    meanSampleCount = nextMeanSampleCount;
+                    ++sampleLimit;
+                }
+                sampleLimits[iteration] = sampleLimit;
             }
+        }
 
     }   /* pose_optimization */
 }   /* rgbd_slam */
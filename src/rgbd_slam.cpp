@@ -45,6 +45,9 @@ namespace rgbd_slam {
 
             //local map
             _localMap = new map_management::Local_Map();
+            const size_t maximumMatchCount = Parameters::get_maximum_local_map_point_count() + Parameters::get_maximum_staged_point_count();
+            _matchedPoints.reserve(maximumMatchCount);
+            _outlierIndexes.reserve(maximumMatchCount);
 
             //plane/cylinder finder
             _primitiveDetector = new features::primitives::Primitive_Detection(
@@ -74,7 +77,7 @@ namespace rgbd_slam {
                 exit(-1);
             }
 
-            _computeKeypointCount = 0;
+            _shouldDetectAllKeypoints = true;
             _currentPose = startPose;
 
             // init motion model
@@ -156,14 +159,22 @@ namespace rgbd_slam {
 
     const utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage, const cv::Mat& depthImage, const Eigen::MatrixXf& cloudArrayOrganized) 
     {
+        // Apply the last local bundle adjustment, if it is done. The observer moves with the newest adjusted keyframe, so it tracks against the corrected map
+        quaternion rotationCorrection;
+        vector3 translationCorrection;
+        if (_localMap->merge_bundle_adjustment(rotationCorrection, translationCorrection))
+        {
+            _currentPose.set_parameters(rotationCorrection * _currentPose.get_position() + translationCorrection, (rotationCorrection * _currentPose.get_orientation_quaternion()).normalized());
+            _motionModel.apply_correction(rotationCorrection, translationCorrection);
+        }
+
         //get a pose with the motion model
         utils::Pose refinedPose = _motionModel.predict_next_pose(_currentPose);
 
-        // Detect and match key points with local map points
-        const bool shouldRecomputeKeypoints = (_computeKeypointCount % Parameters::get_keypoint_refresh_frequency())== 0;
-
+        // Detect and match key points with local map points. Keypoints are detected in the whole image on the first frame and after a snapshot load, then the detector decides when to refresh them
         const features::keypoints::KeypointsWithIdStruct& trackedKeypointContainer = _localMap->get_tracked_keypoints_features();
-        const features::keypoints::Keypoint_Handler& keypointObject = _pointDetector->compute_keypoints(grayImage, depthImage, trackedKeypointContainer, shouldRecomputeKeypoints);
+        const features::keypoints::Keypoint_Handler& keypointObject = _pointDetector->compute_keypoints(grayImage, depthImage, trackedKeypointContainer, _shouldDetectAllKeypoints);
+        _shouldDetectAllKeypoints = false;
 
         // Run primitive detection 
         double t1 = cv::getTickCount();
@@ -172,20 +183,20 @@ namespace rgbd_slam {
         double time_elapsed = (cv::getTickCount() - t1) / static_cast<double>(cv::getTickFrequency());
         _meanTreatmentTime += time_elapsed;
 
-        const matches_containers::match_point_container& matchedPoints = _localMap->find_keypoint_matches(refinedPose, keypointObject);
+        _localMap->find_keypoint_matches(refinedPose, keypointObject, _matchedPoints);
         const matches_containers::match_primitive_container& matchedPrimitives = _localMap->find_primitive_matches(refinedPose, detectedPrimitives);
 
-        matches_containers::match_point_container outlierMatchedPoints;
+        _outlierIndexes.clear();
 
         // the map will be updated only if a valid pose is found
         bool shouldUpdateMap = true;
-        if (_computeKeypointCount != 0)
+        if (not _localMap->is_empty())
         {
-            if (matchedPoints.size() >= Parameters::get_minimum_point_count_for_optimization()) {
-                // Enough matches to optimize
+            if (_matchedPoints.size() >= Parameters::get_minimum_point_count_for_optimization() or pose_optimization::Pose_Optimization::is_pose_constrained_by_primitives(matchedPrimitives)) {
+                // Enough matches to optimize: enough points, or planes constraining the pose
                 // Optimize refined pose
                 utils::Pose optimizedPose;
-                shouldUpdateMap = pose_optimization::Pose_Optimization::compute_optimized_pose(refinedPose, matchedPoints, optimizedPose, outlierMatchedPoints);
+                shouldUpdateMap = pose_optimization::Pose_Optimization::compute_optimized_pose(refinedPose, _matchedPoints, matchedPrimitives, optimizedPose, _outlierIndexes);
                 if (shouldUpdateMap)
                 {
                     refinedPose = optimizedPose;
@@ -195,21 +206,15 @@ namespace rgbd_slam {
             else
             {
                 // Not enough matches
-                utils::log("Not enough points match for pose estimation: " + std::to_string(matchedPoints.size()) + " matches with " + std::to_string(keypointObject.get_keypoint_count()) + " detected or tracked points");
+                utils::log("Not enough points match for pose estimation: " + std::to_string(_matchedPoints.size()) + " matches with " + std::to_string(keypointObject.get_keypoint_count()) + " detected or tracked points");
             }
         }
-        //else: first call: no optimization
-
-        if (shouldRecomputeKeypoints) {
-            // reset the counter to not overflow
-            _computeKeypointCount = 0; 
-        }
-        _computeKeypointCount += 1;
+        //else: empty map on the first call: no optimization
 
         // Update local map if a valid transformation was found
         if (shouldUpdateMap)
         {
-            _localMap->update(_currentPose, refinedPose, keypointObject, detectedPrimitives, outlierMatchedPoints);
+            _localMap->update(_currentPose, refinedPose, keypointObject, detectedPrimitives, _matchedPoints, _outlierIndexes);
         }
 
         return refinedPose;
@@ -225,6 +230,21 @@ namespace rgbd_slam {
     }
 
 
+    bool RGBD_SLAM::save_map_snapshot(const std::string& directory)
+    {
+        return _localMap->save_snapshot(directory, _currentPose, _motionModel);
+    }
+
+    bool RGBD_SLAM::load_map_snapshot(const std::string& directory)
+    {
+        if (not _localMap->load_snapshot(directory, _currentPose, _motionModel))
+            return false;
+
+        // Detect keypoints in the whole next image. The pose is still optimized against the loaded points
+        _shouldDetectAllKeypoints = true;
+        return true;
+    }
+
     void RGBD_SLAM::show_statistics(const double meanFrameTreatmentTime) const 
     {
         if (_totalFrameTreated > 0)
@@ -53,6 +53,24 @@ namespace rgbd_slam {
              */
             void get_debug_image(const utils::Pose& camPose, const cv::Mat originalRGB, cv::Mat& debugImage, const double elapsedTime, const bool showStagedPoints = false, const bool showPrimitiveMasks = false);
 
+            /**
+             * \brief Save the map, the current pose and the motion model in a snapshot directory, to warm start a later session
+             *
+             * \param[in] directory The snapshot directory, created if needed
+             *
+             * \return True if the snapshot was saved
+             */
+            bool save_map_snapshot(const std::string& directory);
+
+            /**
+             * \brief Restart from a map snapshot: restore the pose and motion model, and use the saved map. Only the map tiles around the saved pose are read now
+             *
+             * \param[in] directory The snapshot directory
+             *
+             * \return True if the snapshot was loaded
+             */
+            bool load_map_snapshot(const std::string& directory);
+
             /**
              * \brief Show the time statistics for certain parts of the program. Kind of a basic profiler
              */
@@ -81,7 +99,8 @@ namespace rgbd_slam {
 
             features::primitives::Depth_Map_Transformation* _depthOps;
 
-            size_t _computeKeypointCount;
+            // Detect keypoints in the whole next image: on the first frame, and after a map snapshot load
+            bool _shouldDetectAllKeypoints;
 
             /* Detectors */
             features::primitives::Primitive_Detection* _primitiveDetector;
@@ -90,6 +109,10 @@ namespace rgbd_slam {
             map_management::Local_Map* _localMap;
             features::keypoints::Key_Point_Extraction* _pointDetector;
 
+            // Point matches of the current frame, and the indexes of their outliers. Reserved once, and reused for each frame
+            matches_containers::match_point_container _matchedPoints;
+            matches_containers::match_index_container _outlierIndexes;
+
             cv::Mat _kernel;
 
             utils::Pose _currentPose;
@@ -59,6 +59,39 @@ namespace rgbd_slam {
             return false;
         }
 
+        void world_to_screen_coordinates(const vector3_vector& positions3D, const matrix44& worldToScreenMatrix, vector2_vector& screenCoordinates, std::vector<bool>& isScreenCoordinatesValid)
+        {
+            const size_t pointCount = positions3D.size();
+            screenCoordinates.resize(pointCount);
+            isScreenCoordinatesValid.assign(pointCount, false);
+            if (pointCount == 0)
+                return;
+
+            // Transform all points to camera space at once
+            Eigen::Matrix<double, 3, Eigen::Dynamic> points(3, pointCount);
+            for (size_t pointIndex = 0; pointIndex < pointCount; ++pointIndex)
+                points.col(pointIndex) = positions3D[pointIndex];
+            const Eigen::Matrix<double, 3, Eigen::Dynamic> cameraPoints = (worldToScreenMatrix.block<3, 3>(0, 0) * points).colwise() + worldToScreenMatrix.block<3, 1>(0, 3);
+
+            const double cameraFX = Parameters::get_camera_1_focal_x();
+            const double cameraFY = Parameters::get_camera_1_focal_y();
+            const double cameraCX = Parameters::get_camera_1_center_x();
+            const double cameraCY = Parameters::get_camera_1_center_y();
+            for (size_t pointIndex = 0; pointIndex < pointCount; ++pointIndex)
+            {
+                const double depth = cameraPoints(2, pointIndex);
+                if (depth <= 0)
+                    continue;
+
+                const double inverseDepth = 1.0 / depth;
+                screenCoordinates[pointIndex] = vector2(
+                        cameraFX * cameraPoints(0, pointIndex) * inverseDepth + cameraCX,
+                        cameraFY * cameraPoints(1, pointIndex) * inverseDepth + cameraCY
+                        );
+                isScreenCoordinatesValid[pointIndex] = not std::isnan(screenCoordinates[pointIndex].x()) and not std::isnan(screenCoordinates[pointIndex].y());
+            }
+        }
+
         const vector4 world_to_screen_coordinates(const vector4& worldVector4, const matrix44& worldToScreenMatrix)
         {
             return worldToScreenMatrix * worldVector4;
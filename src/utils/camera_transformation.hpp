@@ -45,6 +45,16 @@ namespace rgbd_slam {
          */
         bool world_to_screen_coordinates(const vector3& position3D, const matrix44& worldToScreenMatrix, vector2& screenCoordinates);
 
+        /**
+         * \brief Transform a batch of points from world to screen coordinate system
+         *
+         * \param[in] positions3D Coordinates of the points (world coordinates)
+         * \param[in] worldToScreenMatrix Matrix to transform the world to a local coordinate system
+         * \param[out] screenCoordinates The screen coordinates of each point
+         * \param[out] isScreenCoordinatesValid For each point, true if the screen position is valid
+         */
+        void world_to_screen_coordinates(const vector3_vector& positions3D, const matrix44& worldToScreenMatrix, vector2_vector& screenCoordinates, std::vector<bool>& isScreenCoordinatesValid);
+
         /**
          * \brief Transform a vector in world space to a vector in screen space
          *
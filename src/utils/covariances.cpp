@@ -6,14 +6,19 @@
 namespace rgbd_slam {
     namespace utils {
 
-        const matrix33 get_screen_point_covariance(const vector2& screenCoordinates, const double depth) 
+        double get_depth_standard_deviation(const double depth)
         {
-            // Quadratic error model (uses depth as meters)
+            // Quadratic error model (uses depth as meters, gives millimeters)
             const double depthMeters = depth / 1000.0;
-            // If depth is less than the min distance, covariance is set to a high value
-            const double depthVariance = std::max(0.0001, utils::is_depth_valid(depth) ? (-0.58 + 0.74 * depthMeters + 2.73 * pow(depthMeters, 2.0)) : 1000.0);
+            // If depth is less than the min distance, the deviation is set to a high value
+            return std::max(0.0001, utils::is_depth_valid(depth) ? (-0.58 + 0.74 * depthMeters + 2.73 * pow(depthMeters, 2.0)) : 1000.0);
+        }
+
+        const matrix33 get_screen_point_covariance(const vector2& screenCoordinates, const double depth) 
+        {
+            const double depthStandardDeviation = get_depth_standard_deviation(depth);
             // a zero variance will break the kalman gain
-            assert(depthVariance > 0);
+            assert(depthStandardDeviation > 0);
 
             // TODO xy variance should also depend on the placement of the pixel in x and y
             const double xyVariance = pow(0.1, 2.0);
@@ -21,7 +26,7 @@ namespace rgbd_slam {
             matrix33 screenPointCovariance {
                 {xyVariance, 0,          0},
                     {0,          xyVariance, 0},
-                    {0,          0,          depthVariance * depthVariance},
+                    {0,          0,          depthStandardDeviation * depthStandardDeviation},
             };
             return screenPointCovariance;
         }
@@ -35,20 +40,60 @@ namespace rgbd_slam {
             const double cameraCX = Parameters::get_camera_1_center_x();
             const double cameraCY = Parameters::get_camera_1_center_y();
 
-            // Jacobian of the screen to world function. Use absolutes to prevent negative variances
-            const matrix33 jacobian {
-                {depth / cameraFX, 0.0,              abs(screenPoint.x() - cameraCX) / cameraFX },
-                    {0.0,              depth / cameraFY, abs(screenPoint.y() - cameraCY) / cameraFY },
-                    {0.0,              0.0,              1}
+            // Jacobian of the screen to world function is J = [[z/fx, 0, |u-cx|/fx], [0, z/fy, |v-cy|/fy], [0, 0, 1]] (absolutes prevent negative variances).
+            // It is upper triangular, so (J^T J)^-1 = J^-1 J^-T has a closed form
+            const double inverseScaleX = cameraFX / depth;
+            const double inverseScaleY = cameraFY / depth;
+            const double offsetX = std::abs(screenPoint.x() - cameraCX) / cameraFX;
+            const double offsetY = std::abs(screenPoint.y() - cameraCY) / cameraFY;
+
+            const double xy = offsetX * offsetY * inverseScaleX * inverseScaleY;
+            const double xz = -offsetX * inverseScaleX;
+            const double yz = -offsetY * inverseScaleY;
+            const matrix33 inverseJacobianProduct {
+                {(1.0 + offsetX * offsetX) * inverseScaleX * inverseScaleX, xy, xz},
+                    {xy, (1.0 + offsetY * offsetY) * inverseScaleY * inverseScaleY, yz},
+                    {xz, yz, 1.0}
             };
-            const matrix33& worldPointCovariance = (jacobian.transpose() * jacobian).inverse() * screenPointCovariance;
+            const matrix33& worldPointCovariance = inverseJacobianProduct * screenPointCovariance;
             return worldPointCovariance;
         }
 
 
-        bool compute_pose_variance(const utils::Pose& pose, const matches_containers::match_point_container& matchedPoints, vector3& poseVariance)
+        const matrix22 get_projected_point_covariance(const vector3& worldPoint, const matrix33& worldPointCovariance, const utils::Pose& pose)
+        {
+            const double cameraFX = Parameters::get_camera_1_focal_x();
+            const double cameraFY = Parameters::get_camera_1_focal_y();
+
+            // camera to world rotation
+            const matrix33& rotation = pose.get_orientation_matrix();
+            const vector3& cameraPoint = rotation.transpose() * (worldPoint - pose.get_position());
+
+            // Uncertainty of the point in camera space: point and camera position uncertainties are rotated in camera space, orientation uncertainty moves the point around the camera center
+            const matrix33& positionCovariance = compute_pose_covariance(pose);
+            const vector3& orientationVariance = pose.get_orientation_variance();
+            matrix33 cameraPointCrossProduct;
+            cameraPointCrossProduct <<
+                0.0,             -cameraPoint.z(), cameraPoint.y(),
+                cameraPoint.z(), 0.0,              -cameraPoint.x(),
+                -cameraPoint.y(), cameraPoint.x(), 0.0;
+            const matrix33& cameraPointCovariance = 
+                rotation.transpose() * (worldPointCovariance + positionCovariance) * rotation +
+                cameraPointCrossProduct * orientationVariance.asDiagonal() * cameraPointCrossProduct.transpose();
+
+            // Jacobian of the camera to screen projection
+            const double inverseDepth = 1.0 / std::max(cameraPoint.z(), 1.0);
+            const Eigen::Matrix<double, 2, 3> jacobian {
+                {cameraFX * inverseDepth, 0.0,                     -cameraFX * cameraPoint.x() * inverseDepth * inverseDepth},
+                    {0.0,                     cameraFY * inverseDepth, -cameraFY * cameraPoint.y() * inverseDepth * inverseDepth}
+            };
+            return jacobian * cameraPointCovariance * jacobian.transpose();
+        }
+
+
+        bool compute_pose_variance(const utils::Pose& pose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view inlierIndexes, vector3& poseVariance)
         {
-            assert(not matchedPoints.empty());
+            assert(not inlierIndexes.empty());
 
             const matrix44& transformationMatrix = utils::compute_camera_to_world_transform(pose.get_orientation_quaternion(), pose.get_position());
 
@@ -57,17 +102,18 @@ namespace rgbd_slam {
             size_t numberOf3Dpoints = 0; 
 
             // For each pair of points
-            for (const matches_containers::Match& match : matchedPoints)
+            for (const size_t inlierIndex : inlierIndexes)
             {
                 // We only evaluate 3D points because 2D points cannot evaluate position
-                if (match._screenPoint.z() <= 0)
+                const vector3& screenPoint = matchedPoints.get_screen_point(inlierIndex);
+                if (screenPoint.z() <= 0)
                     continue;
 
                 // Convert to world coordinates
-                const vector3& matchedPoint3d = utils::screen_to_world_coordinates(match._screenPoint.x(), match._screenPoint.y(), match._screenPoint.z(), transformationMatrix);
+                const vector3& matchedPoint3d = utils::screen_to_world_coordinates(screenPoint.x(), screenPoint.y(), screenPoint.z(), transformationMatrix);
 
                 // absolute of (world map Point - new world point)
-                const vector3& matchError = (match._worldPoint - matchedPoint3d).cwiseAbs();
+                const vector3& matchError = (matchedPoints.get_world_point(inlierIndex) - matchedPoint3d).cwiseAbs();
                 sumOfErrors += matchError;
                 sumOfSquaredErrors += matchError.cwiseAbs2();
                 ++numberOf3Dpoints;
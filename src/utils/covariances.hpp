@@ -8,6 +8,15 @@
 namespace rgbd_slam {
     namespace utils {
 
+        /**
+         * \brief Compute the standard deviation of a depth measurement, with the quadratic error model of the depth sensor
+         *
+         * \param[in] depth The measured depth, in millimeters
+         *
+         * \return The standard deviation of this measurement, in millimeters. High for an invalid depth
+         */
+        double get_depth_standard_deviation(const double depth);
+
         /**
          * \brief compute a covariance matrix for a screen point associated with a depth measurement
          *
@@ -29,16 +38,28 @@ namespace rgbd_slam {
          */
         const matrix33 get_world_point_covariance(const vector2& screenPoint, const double depth, const matrix33& screenPointCovariance);
 
+        /**
+         * \brief Compute the covariance of a world point projected in screen space, using the uncertainty of this point and of the camera pose
+         *
+         * \param[in] worldPoint The 3D point in world coordinates
+         * \param[in] worldPointCovariance The covariance of this world point
+         * \param[in] pose The camera pose, with its position and orientation variances
+         *
+         * \return A 2x2 covariance matrix of the projected point, in pixels
+         */
+        const matrix22 get_projected_point_covariance(const vector3& worldPoint, const matrix33& worldPointCovariance, const utils::Pose& pose);
+
         /**
          * \brief Compute the variance of the final pose in X Y Z
          *
          * \param[in] pose The pose to compute the variance of
-         * \param[in] matchedPoints A container of matched features (inliers)
+         * \param[in] matchedPoints A container of matched features
+         * \param[in] inlierIndexes The indexes of the inliers in matchedPoints
          * \param[out] poseVariance If the function returns true, then this is the estimated position variance estimated from matched points
          *
          * \return True if the variance was estimated 
          */
-        bool compute_pose_variance(const utils::Pose& pose, const matches_containers::match_point_container& matchedPoints, vector3& poseVariance);
+        bool compute_pose_variance(const utils::Pose& pose, const matches_containers::match_point_container& matchedPoints, const matches_containers::match_index_view inlierIndexes, vector3& poseVariance);
 
         /**
          * \brief Compute a pose covariance matrix from a pose
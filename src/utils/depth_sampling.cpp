@@ -0,0 +1,63 @@
+#include "depth_sampling.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace rgbd_slam {
+    namespace utils {
+
+        void get_depth_approximations(const cv::Mat& depthImage, const std::vector<cv::Point2f>& points, std::span<double> depths)
+        {
+            assert(depthImage.type() == CV_32FC1);
+            assert(depthImage.cols >= DEPTH_SAMPLING_WINDOW_SIZE and depthImage.rows >= DEPTH_SAMPLING_WINDOW_SIZE);
+            assert(depths.size() == points.size());
+
+            const int halfWindowSize = DEPTH_SAMPLING_WINDOW_SIZE / 2;
+            const int maxWindowX = depthImage.cols - DEPTH_SAMPLING_WINDOW_SIZE;
+            const int maxWindowY = depthImage.rows - DEPTH_SAMPLING_WINDOW_SIZE;
+            // Invalid depths are replaced by this value, so they are never the window minimum
+            const float invalidDepth = std::numeric_limits<float>::max();
+
+#if CV_SIMD128
+            static_assert(DEPTH_SAMPLING_WINDOW_SIZE == 4, "The vectorized depth sampling reads windows of 4 floats");
+            const cv::v_float32x4 zero = cv::v_setzero_f32();
+            const cv::v_float32x4 invalidDepths = cv::v_setall_f32(invalidDepth);
+#endif
+
+            const size_t pointCount = points.size();
+            for (size_t pointIndex = 0; pointIndex < pointCount; ++pointIndex)
+            {
+                const cv::Point2f& point = points[pointIndex];
+                const bool isInImage = point.x >= 0 and point.y >= 0 and point.x < depthImage.cols and point.y < depthImage.rows;
+
+                // Clamp the window in the image, so it can be read without bound checks
+                const int windowX = std::clamp(static_cast<int>(point.x) - halfWindowSize, 0, maxWindowX);
+                const int windowY = std::clamp(static_cast<int>(point.y) - halfWindowSize, 0, maxWindowY);
+
+#if CV_SIMD128
+                cv::v_float32x4 windowMinimums = invalidDepths;
+                for (int row = 0; row < DEPTH_SAMPLING_WINDOW_SIZE; ++row)
+                {
+                    const cv::v_float32x4 rowDepths = cv::v_load(depthImage.ptr<float>(windowY + row) + windowX);
+                    windowMinimums = cv::v_min(windowMinimums, cv::v_select(rowDepths > zero, rowDepths, invalidDepths));
+                }
+                const float windowMinimum = cv::v_reduce_min(windowMinimums);
+#else
+                float windowMinimum = invalidDepth;
+                for (int row = 0; row < DEPTH_SAMPLING_WINDOW_SIZE; ++row)
+                {
+                    const float* rowDepths = depthImage.ptr<float>(windowY + row) + windowX;
+                    for (int column = 0; column < DEPTH_SAMPLING_WINDOW_SIZE; ++column)
+                        windowMinimum = std::min(windowMinimum, rowDepths[column] > 0 ? rowDepths[column] : invalidDepth);
+                }
+#endif
+
+                depths[pointIndex] = (isInImage and windowMinimum < invalidDepth) ? windowMinimum : 0.0;
+            }
+        }
+
+    }   // utils
+}       // rgbd_slam
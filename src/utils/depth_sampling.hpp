@@ -0,0 +1,26 @@
+#ifndef RGBDSLAM_UTILS_DEPTH_SAMPLING_HPP
+#define RGBDSLAM_UTILS_DEPTH_SAMPLING_HPP
+
+#include <vector>
+#include <span>
+#include <opencv2/opencv.hpp>
+
+namespace rgbd_slam {
+    namespace utils {
+
+        // Size of the square window in which the depth of a point is approximated (pixels)
+        const int DEPTH_SAMPLING_WINDOW_SIZE = 4;
+
+        /**
+         * \brief Approximate the depth of a batch of image points, as the minimum valid depth in a small window around each point. This prevents invalid depth on edges
+         * \param[in] depthImage A depth image of type CV_32F (millimeters), with invalid depth as 0
+         * \param[in] points The image points to sample. Points out of the image get an invalid depth
+         * \param[out] depths The approximated depths, one for each point, or 0 if no valid depth was found around the point
+         */
+        void get_depth_approximations(const cv::Mat& depthImage, const std::vector<cv::Point2f>& points, std::span<double> depths);
+
+    }   // utils
+}       // rgbd_slam
+
+
+#endif
@@ -1,32 +1,101 @@
 #ifndef RGBDSLAM_UTILS_MATCHESCONTAINERS_HPP
 #define RGBDSLAM_UTILS_MATCHESCONTAINERS_HPP
 
+#include <cassert>
+#include <span>
+#include <vector>
+
 #include "types.hpp"
 
 namespace rgbd_slam {
     namespace matches_containers {
 
-        // KeyPoint matching: contains :
-        //      - the coordinates of the detected point in screen space
-        //      - the coordinates of the matched point in world space
-        struct Match {
-            Match(const vector3& screenPoint, const vector3& worldPoint, const size_t mapId) :
-                _worldPoint(worldPoint),
-                _screenPoint(screenPoint),
-                _mapPointId(mapId)
-            {};
-
-            vector3 _worldPoint;    // coordinates of the local world point
-            vector3 _screenPoint;   // Coordinates of the detected screen point
-            size_t _mapPointId;     // Id of the world point in the local map 
+        /**
+         * \brief KeyPoint matches, stored contiguously with one array by member so they can be streamed by the pose optimization. A match contains:
+         *      - the coordinates of the detected point in screen space
+         *      - the coordinates of the matched point in world space
+         *      - the slot of the matched point in the local map
+         *      - a score of the match, used to try the likely inliers first
+         * Reserve it once, and clear it for each frame: no memory is allocated when adding matches
+         */
+        class Match_Point_Container
+        {
+            public:
+                void reserve(const size_t matchCount)
+                {
+                    _screenPoints.reserve(matchCount);
+                    _worldPoints.reserve(matchCount);
+                    _mapPointSlots.reserve(matchCount);
+                    _matchScores.reserve(matchCount);
+                }
+
+                void clear()
+                {
+                    _screenPoints.clear();
+                    _worldPoints.clear();
+                    _mapPointSlots.clear();
+                    _matchScores.clear();
+                }
+
+                /**
+                 * \brief Add a match to this container
+                 *
+                 * \param[in] screenPoint Coordinates of the detected screen point
+                 * \param[in] worldPoint Coordinates of the local world point
+                 * \param[in] mapSlot Slot of the world point in the local map
+                 * \param[in] matchScore Estimated quality of the match, higher is better
+                 */
+                void add(const vector3& screenPoint, const vector3& worldPoint, const size_t mapSlot, const double matchScore)
+                {
+                    _screenPoints.push_back(screenPoint);
+                    _worldPoints.push_back(worldPoint);
+                    _mapPointSlots.push_back(mapSlot);
+                    _matchScores.push_back(matchScore);
+                }
+
+                size_t size() const { return _mapPointSlots.size(); };
+                bool empty() const { return _mapPointSlots.empty(); };
+
+                const vector3& get_screen_point(const size_t index) const { assert(index < size()); return _screenPoints[index]; };
+                const vector3& get_world_point(const size_t index) const { assert(index < size()); return _worldPoints[index]; };
+                size_t get_map_point_slot(const size_t index) const { assert(index < size()); return _mapPointSlots[index]; };
+                double get_match_score(const size_t index) const { assert(index < size()); return _matchScores[index]; };
+
+                // All the coordinates at once, one match by column
+                typedef Eigen::Map<const Eigen::Matrix<double, 3, Eigen::Dynamic>> coordinates_view;
+                coordinates_view get_screen_points() const { return coordinates_view(reinterpret_cast<const double*>(_screenPoints.data()), 3, size()); };
+                coordinates_view get_world_points() const { return coordinates_view(reinterpret_cast<const double*>(_worldPoints.data()), 3, size()); };
+
+            private:
+                // The coordinate views rely on the coordinates being packed
+                static_assert(sizeof(vector3) == 3 * sizeof(double));
+
+                vector3_vector _screenPoints;
+                vector3_vector _worldPoints;
+                std::vector<size_t> _mapPointSlots;
+                std::vector<double> _matchScores;
         };
-        typedef std::list<Match> match_point_container;
+        typedef Match_Point_Container match_point_container;
+
+        // Indexes of matches in a match_point_container, used as views of its inliers, outliers or random subsets
+        typedef std::vector<size_t> match_index_container;
+        typedef std::span<const size_t> match_index_view;
 
-        // Primitive matching: contains :
-        //      - the normal vector of the primitive in screen space
-        //      - the normal vector of the primitive in world space
-        typedef std::pair<vector3, vector3> primitive_pair;
-        typedef std::list<primitive_pair> match_primitive_container;
+        /**
+         * \brief Primitive matching: contains :
+         *      - the plane of the detected primitive in camera space
+         *      - the plane of the map primitive in world space
+         * Planes are stored as (normal, d), with normal.dot(point) + d = 0. Cylinders only constrain the orientation: their normal is their axis, which sign is arbitrary, and their d is not used
+         */
+        struct Primitive_Match
+        {
+            vector4 _cameraPlane;
+            vector4 _worldPlane;
+            bool _isAxis;   // True for cylinders
+
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        };
+        typedef std::vector<Primitive_Match, Eigen::aligned_allocator<Primitive_Match>> match_primitive_container;
     }
 }
 
@@ -3,6 +3,8 @@
 namespace rgbd_slam {
 namespace utils {
 
+    // Standard deviation of the motion model prediction error, as a ratio of the predicted motion
+    const double MOTION_PREDICTION_ERROR_RATIO = 0.5;
 
     Motion_Model::Motion_Model() {
         this->reset();
@@ -27,6 +29,29 @@ namespace utils {
 
 
 
+    void Motion_Model::get_state(quaternion& lastRotation, quaternion& angularVelocity, vector3& lastPosition, vector3& linearVelocity) const {
+        lastRotation = _lastQ;
+        angularVelocity = _angularVelocity;
+        lastPosition = _lastPosition;
+        linearVelocity = _linearVelocity;
+    }
+
+    void Motion_Model::set_state(const quaternion& lastRotation, const quaternion& angularVelocity, const vector3& lastPosition, const vector3& linearVelocity) {
+        _lastQ = lastRotation;
+        _angularVelocity = angularVelocity;
+        _lastPosition = lastPosition;
+        _linearVelocity = linearVelocity;
+    }
+
+    void Motion_Model::apply_correction(const quaternion& rotationCorrection, const vector3& translationCorrection) {
+        _lastQ = (rotationCorrection * _lastQ).normalized();
+        _lastPosition = rotationCorrection * _lastPosition + translationCorrection;
+
+        // The velocities are differences of world poses: only the rotation applies
+        _angularVelocity = (rotationCorrection * _angularVelocity * rotationCorrection.conjugate()).normalized();
+        _linearVelocity = rotationCorrection * _linearVelocity;
+    }
+
     const Pose Motion_Model::predict_next_pose(const Pose& currentPose) const {
         //compute next linear velocity
         vector3 newLinVelocity = currentPose.get_position() - _lastPosition;
@@ -43,8 +68,13 @@ namespace utils {
         quaternion integralQ = currentQ * newAngVel;
         integralQ.normalize();
 
-        // TODO: predict variance instead of copying ? 
-        return Pose(integralPos, integralQ, currentPose.get_position_variance());
+        // The prediction error grows with the motion: the faster the camera, the less certain the prediction
+        const vector3& positionPredictionError = (newLinVelocity * MOTION_PREDICTION_ERROR_RATIO).cwiseAbs2();
+        const double rotationPredictionError = pow(Eigen::AngleAxisd(newAngVel).angle() * MOTION_PREDICTION_ERROR_RATIO, 2.0);
+
+        Pose predictedPose(integralPos, integralQ, currentPose.get_position_variance() + positionPredictionError);
+        predictedPose.set_orientation_variance(currentPose.get_orientation_variance() + vector3::Constant(rotationPredictionError));
+        return predictedPose;
     }
 
 
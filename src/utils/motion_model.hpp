@@ -31,6 +31,24 @@ namespace utils {
              */
             void update_model(const Pose& pose);
 
+            /**
+             * \brief Get the internal state of the motion model, to save it
+             */
+            void get_state(quaternion& lastRotation, quaternion& angularVelocity, vector3& lastPosition, vector3& linearVelocity) const;
+
+            /**
+             * \brief Restore a saved motion model state
+             */
+            void set_state(const quaternion& lastRotation, const quaternion& angularVelocity, const vector3& lastPosition, const vector3& linearVelocity);
+
+            /**
+             * \brief Move the motion model state with a rigid transformation of the world, when the map is corrected
+             *
+             * \param[in] rotationCorrection Rotation of the world correction
+             * \param[in] translationCorrection Translation of the world correction, applied after the rotation
+             */
+            void apply_correction(const quaternion& rotationCorrection, const vector3& translationCorrection);
+
             EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
         protected:
@@ -48,18 +48,21 @@ namespace rgbd_slam {
             PoseBase()
         {
             _positionVariance.setZero();
+            _orientationVariance.setZero();
         }
 
         Pose::Pose(const vector3& position, const quaternion& orientation) :
             PoseBase(position, orientation)
         {
             _positionVariance.setZero();
+            _orientationVariance.setZero();
         }
 
         Pose::Pose(const vector3& position, const quaternion& orientation, const vector3& poseVariance) :
             PoseBase(position, orientation),
             _positionVariance(poseVariance)
         {
+            _orientationVariance.setZero();
         }
 
         void Pose::display(std::ostream& os) const {
@@ -49,6 +49,12 @@ namespace rgbd_slam {
                 void set_position_variance(const vector3& variance) { _positionVariance = variance; };
                 const vector3 get_position_variance() const { return _positionVariance; };
 
+                /**
+                 * \brief Variance of the rotation around the camera axis, as a small rotation vector (radians squared)
+                 */
+                void set_orientation_variance(const vector3& variance) { _orientationVariance = variance; };
+                const vector3 get_orientation_variance() const { return _orientationVariance; };
+
                 /**
                  * \brief A display function, to avoid a friend operator function
                  */
@@ -56,6 +62,7 @@ namespace rgbd_slam {
 
             private:
                 vector3 _positionVariance;
+                vector3 _orientationVariance;
         };
 
         std::ostream& operator<<(std::ostream& os, const PoseBase& pose);
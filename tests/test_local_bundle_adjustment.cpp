@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "map_management/edge_screen_point.hpp"
+#include "map_management/local_bundle_adjuster.hpp"
+#include "parameters.hpp"
+#include "types.hpp"
+
+namespace rgbd_slam {
+
+    /**
+     * Return the screen coordinates (u, v, depth) of a world point seen from a camera pose
+     */
+    vector3 get_screen_point(const vector3& worldPoint, const vector3& position, const quaternion& orientation)
+    {
+        const vector3& cameraPoint = orientation.conjugate() * (worldPoint - position);
+        return vector3(
+                Parameters::get_camera_1_focal_x() * cameraPoint.x() / cameraPoint.z() + Parameters::get_camera_1_center_x(),
+                Parameters::get_camera_1_focal_y() * cameraPoint.y() / cameraPoint.z() + Parameters::get_camera_1_center_y(),
+                cameraPoint.z()
+                );
+    }
+
+    /*
+     * Compare the analytic jacobians of the screen point edge with a numerical differentiation of its error
+     */
+    TEST(LocalBundleAdjustmentTests, edgeJacobianMatchesNumericalJacobian)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        g2o::VertexPointXYZ point;
+        point.setEstimate(vector3(150, -80, 1200));
+        g2o::VertexSE3Expmap pose;
+        const quaternion worldToCameraRotation(Eigen::AngleAxisd(0.2, vector3(1, -2, 0.5).normalized()));
+        pose.setEstimate(g2o::SE3Quat(worldToCameraRotation, vector3(30, 20, -100)));
+
+        map_management::Edge_Screen_Point edge;
+        edge.setVertex(0, &point);
+        edge.setVertex(1, &pose);
+        edge.setMeasurement(vector3(300, 200, 1000));
+        edge.linearizeOplus();
+        const Eigen::Matrix<double, 3, 3> pointJacobian = edge.jacobianOplusXi();
+        const Eigen::Matrix<double, 3, 6> poseJacobian = edge.jacobianOplusXj();
+
+        // The steps are applied like the oplus of the vertices, without their update signature that changed between g2o versions:
+        // a point moves by the step, a pose is left multiplied by the exponential of the (rotation, translation) step
+        const double stepSize = 1e-6;
+        const vector3 pointEstimate = point.estimate();
+        for (int parameter = 0; parameter < 3; ++parameter)
+        {
+            const vector3& step = stepSize * vector3::Unit(parameter);
+            point.setEstimate(pointEstimate + step);
+            edge.computeError();
+            const vector3 positiveError = edge.error();
+
+            point.setEstimate(pointEstimate - step);
+            edge.computeError();
+            const vector3 negativeError = edge.error();
+
+            const vector3& numericalDerivative = (positiveError - negativeError) / (2.0 * stepSize);
+            EXPECT_TRUE(numericalDerivative.isApprox(pointJacobian.col(parameter), 1e-5)) << "Point parameter " << parameter;
+        }
+        point.setEstimate(pointEstimate);
+
+        typedef Eigen::Matrix<double, 6, 1> vector6;
+        const g2o::SE3Quat poseEstimate = pose.estimate();
+        for (int parameter = 0; parameter < 6; ++parameter)
+        {
+            const vector6& step = stepSize * vector6::Unit(parameter);
+            pose.setEstimate(g2o::SE3Quat::exp(step) * poseEstimate);
+            edge.computeError();
+            const vector3 positiveError = edge.error();
+
+            pose.setEstimate(g2o::SE3Quat::exp(-step) * poseEstimate);
+            edge.computeError();
+            const vector3 negativeError = edge.error();
+
+            const vector3& numericalDerivative = (positiveError - negativeError) / (2.0 * stepSize);
+            EXPECT_TRUE(numericalDerivative.isApprox(poseJacobian.col(parameter), 1e-5)) << "Pose parameter " << parameter;
+        }
+    }
+
+    /*
+     * Adjust a synthetic problem with perturbed keyframes and points: the adjustment brings the keyframes back to their true poses
+     */
+    TEST(LocalBundleAdjustmentTests, adjustmentConvergesToTruePoses)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        std::mt19937 randomEngine(0);
+        std::uniform_real_distribution<double> pointDistribution(-500, 500);
+        std::uniform_real_distribution<double> depthDistribution(1500, 2500);
+        std::normal_distribution<double> positionNoise(0, 20);
+        std::normal_distribution<double> rotationNoise(0, 1.0 * EulerToRadian);
+
+        // True keyframes along a line, looking along z
+        const size_t keyframeCount = 4;
+        map_management::Bundle_Adjustment_Problem problem;
+        std::vector<vector3> truePositions;
+        std::vector<quaternion, Eigen::aligned_allocator<quaternion>> trueOrientations;
+        for (size_t keyframeIndex = 0; keyframeIndex < keyframeCount; ++keyframeIndex)
+        {
+            const vector3 position(100.0 * keyframeIndex, 20.0 * keyframeIndex, 0);
+            const quaternion orientation(Eigen::AngleAxisd(2.0 * EulerToRadian * keyframeIndex, vector3::UnitY()));
+            truePositions.push_back(position);
+            trueOrientations.push_back(orientation);
+
+            // The first keyframe is fixed: only perturb the others
+            map_management::Bundle_Adjustment_Problem::Keyframe_Pose keyframe;
+            keyframe._id = keyframeIndex;
+            keyframe._position = position;
+            keyframe._orientation = orientation;
+            if (keyframeIndex > 0)
+            {
+                keyframe._position += vector3(positionNoise(randomEngine), positionNoise(randomEngine), positionNoise(randomEngine));
+                keyframe._orientation = (orientation * quaternion(Eigen::AngleAxisd(rotationNoise(randomEngine), vector3::UnitX())) * quaternion(Eigen::AngleAxisd(rotationNoise(randomEngine), vector3::UnitY()))).normalized();
+            }
+            problem._keyframes.push_back(keyframe);
+        }
+
+        // Points in front of all the keyframes, observed from all of them, with perturbed coordinates
+        const size_t pointCount = 100;
+        for (size_t pointIndex = 0; pointIndex < pointCount; ++pointIndex)
+        {
+            const vector3 truePoint(pointDistribution(randomEngine), pointDistribution(randomEngine), depthDistribution(randomEngine));
+            problem._points.push_back({pointIndex, pointIndex, truePoint + vector3(positionNoise(randomEngine), positionNoise(randomEngine), positionNoise(randomEngine))});
+
+            for (size_t keyframeIndex = 0; keyframeIndex < keyframeCount; ++keyframeIndex)
+            {
+                // One observation out of five has no depth, like a 2D keypoint
+                vector3 screenPoint = get_screen_point(truePoint, truePositions[keyframeIndex], trueOrientations[keyframeIndex]);
+                if ((pointIndex + keyframeIndex) % 5 == 0)
+                    screenPoint.z() = 0.0;
+                problem._observations.push_back({keyframeIndex, pointIndex, screenPoint});
+            }
+        }
+
+        map_management::Bundle_Adjustment_Result result;
+        ASSERT_TRUE(map_management::Local_Bundle_Adjuster::adjust(problem, result));
+        ASSERT_EQ(result._keyframes.size(), keyframeCount);
+        ASSERT_EQ(result._points.size(), pointCount);
+
+        for (size_t keyframeIndex = 0; keyframeIndex < keyframeCount; ++keyframeIndex)
+        {
+            const map_management::Bundle_Adjustment_Problem::Keyframe_Pose& keyframe = result._keyframes[keyframeIndex];
+            EXPECT_EQ(keyframe._id, keyframeIndex);
+            EXPECT_LT((keyframe._position - truePositions[keyframeIndex]).norm(), 1.0) << "Keyframe " << keyframeIndex;
+            EXPECT_LT(keyframe._orientation.angularDistance(trueOrientations[keyframeIndex]), 0.05 * EulerToRadian) << "Keyframe " << keyframeIndex;
+        }
+    }
+
+}
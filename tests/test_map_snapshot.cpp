@@ -0,0 +1,322 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <vector>
+
+#include "map_management/global_map.hpp"
+#include "map_management/local_map.hpp"
+#include "map_management/map_point.hpp"
+#include "map_management/map_snapshot.hpp"
+#include "motion_model.hpp"
+#include "parameters.hpp"
+
+namespace rgbd_slam {
+
+    const size_t POINTS_PER_TILE = 20;
+
+    typedef std::map<uint64_t, map_management::Global_Point_Record> record_map;
+
+    /**
+     * Add points in front of the camera and behind it, and return their records by id
+     */
+    void add_points(map_management::Global_Map& globalMap, const vector3& cameraPosition, record_map& frontPoints, record_map& backPoints)
+    {
+        const double tileSize = static_cast<double>(globalMap.get_tile_size());
+        for(size_t i = 0; i < 2 * POINTS_PER_TILE; ++i)
+        {
+            // One tile in front of the camera along z, and one tile behind it
+            const bool isInFront = i < POINTS_PER_TILE;
+            const double offset = static_cast<double>(i % POINTS_PER_TILE) / POINTS_PER_TILE * 0.5 * tileSize;
+            const vector3 coordinates = cameraPosition + vector3(offset - 0.25 * tileSize, 0.1 * offset, isInFront ? tileSize : -tileSize);
+
+            const matrix33 covariance = vector3(1.0 + i, 2.0 + i, 3.0 + i).asDiagonal();
+            const int age = static_cast<int>(i) - 5;
+            const map_management::Map_Point point(coordinates, covariance, i, 1000 + i, age);
+
+            features::keypoints::Keypoint_Descriptor descriptor;
+            for(size_t wordIndex = 0; wordIndex < descriptor._words.size(); ++wordIndex)
+                descriptor._words[wordIndex] = (i + 1) * 0x9e3779b97f4a7c15ULL + wordIndex;
+            globalMap.add_point(point, descriptor);
+
+            map_management::Global_Point_Record record {};
+            for (int j = 0; j < 3; ++j)
+            {
+                record._coordinates[j] = coordinates[j];
+                for (int k = 0; k < 3; ++k)
+                    record._covariance[j * 3 + k] = covariance(j, k);
+            }
+            record._descriptor = descriptor;
+            record._id = point._id;
+            record._age = age;
+            (isInFront ? frontPoints : backPoints)[record._id] = record;
+        }
+        globalMap.flush();
+    }
+
+    /**
+     * Check that the paged in points are the expected ones, unchanged
+     */
+    void expect_same_points(const std::vector<map_management::Global_Point_Record>& pagedInPoints, const record_map& expectedPoints)
+    {
+        ASSERT_EQ(pagedInPoints.size(), expectedPoints.size());
+        for(const map_management::Global_Point_Record& record : pagedInPoints)
+        {
+            const auto expectedIterator = expectedPoints.find(record._id);
+            ASSERT_NE(expectedIterator, expectedPoints.end());
+            const map_management::Global_Point_Record& expectedRecord = expectedIterator->second;
+
+            for (int j = 0; j < 3; ++j)
+                EXPECT_DOUBLE_EQ(record._coordinates[j], expectedRecord._coordinates[j]);
+            for (int j = 0; j < 9; ++j)
+                EXPECT_DOUBLE_EQ(record._covariance[j], expectedRecord._covariance[j]);
+            EXPECT_EQ(record._descriptor._words, expectedRecord._descriptor._words);
+            EXPECT_EQ(record._age, expectedRecord._age);
+        }
+    }
+
+    /**
+     * Expect two motion models to have the same state
+     */
+    void expect_same_motion_model(const utils::Motion_Model& motionModel, const utils::Motion_Model& expectedMotionModel)
+    {
+        quaternion lastRotation, angularVelocity, expectedLastRotation, expectedAngularVelocity;
+        vector3 lastPosition, linearVelocity, expectedLastPosition, expectedLinearVelocity;
+        motionModel.get_state(lastRotation, angularVelocity, lastPosition, linearVelocity);
+        expectedMotionModel.get_state(expectedLastRotation, expectedAngularVelocity, expectedLastPosition, expectedLinearVelocity);
+        EXPECT_EQ(lastRotation.coeffs(), expectedLastRotation.coeffs());
+        EXPECT_EQ(angularVelocity.coeffs(), expectedAngularVelocity.coeffs());
+        EXPECT_EQ(lastPosition, expectedLastPosition);
+        EXPECT_EQ(linearVelocity, expectedLinearVelocity);
+    }
+
+    /*
+     * Load a snapshot in a local map, save it again with a new observer state, and load this new snapshot in another local map: the points, pose and motion model come back unchanged
+     */
+    TEST(MapSnapshotTests, saveAndLoadRoundTrip)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        const std::filesystem::path testDirectory = std::filesystem::temp_directory_path() / "rgbd_slam_snapshot_test";
+        std::filesystem::remove_all(testDirectory);
+        const std::string sourceDirectory = testDirectory / "source";
+        const std::string snapshotDirectory = testDirectory / "snapshot";
+        const uint tileSize = Parameters::get_global_map_tile_size();
+
+        // Camera in the middle of a tile, looking along z
+        const vector3 cameraPosition = vector3::Constant(0.5 * tileSize);
+        const double halfViewAngle = 0.6;
+
+        // Snapshot of a previous session, as test data: points in front of the camera and behind it, with ids past the ids of this session
+        record_map frontPoints;
+        record_map backPoints;
+        {
+            map_management::Global_Map sourceMap(sourceDirectory, tileSize);
+            add_points(sourceMap, cameraPosition, frontPoints, backPoints);
+        }
+        // A plane and a cylinder axis, in world space
+        std::vector<map_management::Global_Primitive_Record> sourcePrimitives(2);
+        const vector4 sourcePlane(0.0, 0.6, 0.8, -1500.0);
+        const vector4 sourceAxis(1.0, 0.0, 0.0, 0.0);
+        std::copy(sourcePlane.data(), sourcePlane.data() + 4, sourcePrimitives[0]._worldPlane);
+        std::copy(sourceAxis.data(), sourceAxis.data() + 4, sourcePrimitives[1]._worldPlane);
+        sourcePrimitives[0]._id = map_management::Primitive::get_next_id() + 100;
+        sourcePrimitives[1]._id = map_management::Primitive::get_next_id() + 101;
+        sourcePrimitives[0]._isAxis = 0;
+        sourcePrimitives[1]._isAxis = 1;
+        ASSERT_TRUE(map_management::write_map_snapshot_primitives(sourceDirectory, sourcePrimitives));
+
+        map_management::Map_Snapshot_Header sourceHeader {};
+        sourceHeader._tileSize = tileSize;
+        sourceHeader._nextPointId = map_management::Point::get_next_id() + 5000;
+        sourceHeader._nextPrimitiveId = map_management::Primitive::get_next_id() + 200;
+        const quaternion identity = quaternion::Identity();
+        std::copy(cameraPosition.data(), cameraPosition.data() + 3, sourceHeader._position);
+        std::copy(identity.coeffs().data(), identity.coeffs().data() + 4, sourceHeader._orientation);
+        std::copy(identity.coeffs().data(), identity.coeffs().data() + 4, sourceHeader._motionModelLastOrientation);
+        std::copy(identity.coeffs().data(), identity.coeffs().data() + 4, sourceHeader._motionModelAngularVelocity);
+        ASSERT_TRUE(map_management::write_map_snapshot_header(sourceDirectory, sourceHeader));
+
+        // Save a new observer state, different from the source one
+        const utils::Pose savedPose(cameraPosition + vector3(10, -20, 30), quaternion(Eigen::AngleAxisd(0.1, vector3::UnitY())));
+        utils::Motion_Model savedMotionModel;
+        savedMotionModel.set_state(
+                quaternion(0.9, 0.1, 0.3, -0.2).normalized(), quaternion(1.0, 0.01, -0.02, 0.03).normalized(),
+                vector3(10, -20, 30), vector3(1, 2, -3)
+                );
+        {
+            // Load twice: the first load leaves nothing behind
+            map_management::Local_Map localMap;
+            utils::Pose loadedPose;
+            utils::Motion_Model loadedMotionModel;
+            ASSERT_TRUE(localMap.load_snapshot(sourceDirectory, loadedPose, loadedMotionModel));
+            ASSERT_TRUE(localMap.load_snapshot(sourceDirectory, loadedPose, loadedMotionModel));
+            EXPECT_EQ(loadedPose.get_position(), cameraPosition);
+            EXPECT_GE(map_management::Point::get_next_id(), sourceHeader._nextPointId);
+            EXPECT_GE(map_management::Primitive::get_next_id(), sourceHeader._nextPrimitiveId);
+
+            // The points in view were paged in the local map
+            EXPECT_FALSE(localMap.is_empty());
+
+            // A snapshot cannot be saved in the directory it was loaded from
+            EXPECT_FALSE(localMap.save_snapshot(sourceDirectory, savedPose, savedMotionModel));
+            map_management::Map_Snapshot_Header header;
+            EXPECT_TRUE(map_management::read_map_snapshot_header(sourceDirectory, header));
+
+            ASSERT_TRUE(localMap.save_snapshot(snapshotDirectory, savedPose, savedMotionModel));
+        }
+
+        // Load the new snapshot in another local map: the observer state comes back unchanged
+        map_management::Local_Map otherLocalMap;
+        utils::Pose loadedPose;
+        utils::Motion_Model loadedMotionModel;
+        ASSERT_TRUE(otherLocalMap.load_snapshot(snapshotDirectory, loadedPose, loadedMotionModel));
+        EXPECT_EQ(loadedPose.get_position(), savedPose.get_position());
+        EXPECT_EQ(loadedPose.get_orientation_quaternion().coeffs(), savedPose.get_orientation_quaternion().coeffs());
+        expect_same_motion_model(loadedMotionModel, savedMotionModel);
+        EXPECT_FALSE(otherLocalMap.is_empty());
+
+        // The paged in points and the global map points were all saved once, with their ids, descriptors and ages
+        map_management::Global_Map savedMap(tileSize);
+        ASSERT_TRUE(savedMap.load_snapshot_tiles(snapshotDirectory));
+        EXPECT_EQ(savedMap.get_point_count(), frontPoints.size() + backPoints.size());
+
+        std::vector<map_management::Global_Point_Record> pagedInPoints;
+        ASSERT_TRUE(savedMap.page_in_points_around(cameraPosition, vector3::UnitZ(), halfViewAngle, 0, frontPoints.size(), pagedInPoints));
+        expect_same_points(pagedInPoints, frontPoints);
+        ASSERT_TRUE(savedMap.page_in_points_around(cameraPosition, -vector3::UnitZ(), halfViewAngle, 0, backPoints.size(), pagedInPoints));
+        expect_same_points(pagedInPoints, backPoints);
+
+        // The primitives waiting in the global map were saved once, with their ids and world planes
+        std::vector<map_management::Global_Primitive_Record> savedPrimitives;
+        ASSERT_TRUE(map_management::read_map_snapshot_primitives(snapshotDirectory, savedPrimitives));
+        ASSERT_EQ(savedPrimitives.size(), sourcePrimitives.size());
+        for (size_t i = 0; i < sourcePrimitives.size(); ++i)
+        {
+            EXPECT_EQ(savedPrimitives[i]._id, sourcePrimitives[i]._id);
+            EXPECT_EQ(savedPrimitives[i]._isAxis, sourcePrimitives[i]._isAxis);
+            for (int j = 0; j < 4; ++j)
+                EXPECT_DOUBLE_EQ(savedPrimitives[i]._worldPlane[j], sourcePrimitives[i]._worldPlane[j]);
+        }
+
+        // The snapshot files are never modified by a load
+        map_management::Global_Map otherSavedMap(tileSize);
+        ASSERT_TRUE(otherSavedMap.load_snapshot_tiles(snapshotDirectory));
+        EXPECT_EQ(otherSavedMap.get_point_count(), frontPoints.size() + backPoints.size());
+
+        // Overwriting a snapshot starts by removing its header, its primitives and its tiles
+        ASSERT_TRUE(map_management::remove_map_snapshot(snapshotDirectory));
+        map_management::Map_Snapshot_Header header;
+        EXPECT_FALSE(map_management::read_map_snapshot_header(snapshotDirectory, header));
+        EXPECT_FALSE(map_management::Global_Map::has_tile_files(snapshotDirectory));
+        EXPECT_FALSE(map_management::read_map_snapshot_primitives(snapshotDirectory, savedPrimitives));
+
+        std::filesystem::remove_all(testDirectory);
+    }
+
+    /*
+     * Page in only the closest points that fit in the budget, and keep the lost points in the global map until their page in frame
+     */
+    TEST(MapSnapshotTests, pageInKeepsBudgetAndDelay)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        const uint tileSize = Parameters::get_global_map_tile_size();
+        const vector3 cameraPosition = vector3::Constant(0.5 * tileSize);
+        const vector3 viewDirection = vector3::UnitZ();
+        const double halfViewAngle = 0.6;
+
+        map_management::Global_Map globalMap(tileSize);
+        record_map frontPoints;
+        record_map backPoints;
+        add_points(globalMap, cameraPosition, frontPoints, backPoints);
+
+        // A point lost right in front of the camera
+        const uint64_t lostPointId = 5000;
+        const uint64_t lostPointPageInFrame = 10;
+        const map_management::Map_Point lostPoint(cameraPosition + vector3(0, 0, 0.3 * tileSize), matrix33::Identity(), 0, lostPointId, 1);
+        globalMap.add_point(lostPoint, features::keypoints::Keypoint_Descriptor(), lostPointPageInFrame);
+        globalMap.flush();
+
+        // The closest points in the budget, without the lost point
+        const size_t budget = 5;
+        std::vector<map_management::Global_Point_Record> pagedInPoints;
+        ASSERT_TRUE(globalMap.page_in_points_around(cameraPosition, viewDirection, halfViewAngle, 0, budget, pagedInPoints));
+        ASSERT_EQ(pagedInPoints.size(), budget);
+
+        std::vector<double> frontDistances;
+        for (const auto& [id, record] : frontPoints)
+            frontDistances.push_back((vector3(record._coordinates[0], record._coordinates[1], record._coordinates[2]) - cameraPosition).norm());
+        std::sort(frontDistances.begin(), frontDistances.end());
+        for (const map_management::Global_Point_Record& record : pagedInPoints)
+        {
+            EXPECT_NE(frontPoints.find(record._id), frontPoints.end());
+            EXPECT_LE((vector3(record._coordinates[0], record._coordinates[1], record._coordinates[2]) - cameraPosition).norm(), frontDistances[budget - 1]);
+        }
+        EXPECT_EQ(globalMap.get_point_count(), frontPoints.size() + backPoints.size() + 1 - budget);
+
+        // Nothing changes before the lost point can be paged in
+        EXPECT_FALSE(globalMap.page_in_points_around(cameraPosition, viewDirection, halfViewAngle, lostPointPageInFrame - 1, frontPoints.size(), pagedInPoints));
+
+        // Then the lost point and the points left by the budget come back
+        ASSERT_TRUE(globalMap.page_in_points_around(cameraPosition, viewDirection, halfViewAngle, lostPointPageInFrame, frontPoints.size(), pagedInPoints));
+        EXPECT_EQ(pagedInPoints.size(), frontPoints.size() - budget + 1);
+        EXPECT_TRUE(std::any_of(pagedInPoints.begin(), pagedInPoints.end(), [lostPointId](const map_management::Global_Point_Record& record) { return record._id == lostPointId; }));
+        EXPECT_EQ(globalMap.get_point_count(), backPoints.size());
+    }
+
+    /*
+     * Working global maps use their own directory and remove it, and the tiles that were not written by a snapshot are never removed
+     */
+    TEST(MapSnapshotTests, onlyOwnFilesAreRemoved)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        const std::filesystem::path testDirectory = std::filesystem::temp_directory_path() / "rgbd_slam_global_map_test";
+        std::filesystem::remove_all(testDirectory);
+        const uint tileSize = Parameters::get_global_map_tile_size();
+
+        // Tiles of another program, in a directory without snapshot header
+        const std::string otherDirectory = testDirectory / "other";
+        record_map frontPoints;
+        record_map backPoints;
+        {
+            map_management::Global_Map otherMap(otherDirectory, tileSize);
+            add_points(otherMap, vector3::Zero(), frontPoints, backPoints);
+        }
+        ASSERT_TRUE(map_management::Global_Map::has_tile_files(otherDirectory));
+
+        std::string firstWorkingDirectory;
+        {
+            map_management::Global_Map firstMap(tileSize);
+            map_management::Global_Map secondMap(tileSize);
+            firstWorkingDirectory = firstMap.get_directory();
+            ASSERT_FALSE(firstWorkingDirectory.empty());
+            EXPECT_NE(firstWorkingDirectory, secondMap.get_directory());
+
+            // Two maps in the same process do not share their tiles
+            add_points(firstMap, vector3::Zero(), frontPoints, backPoints);
+            EXPECT_TRUE(map_management::Global_Map::has_tile_files(firstWorkingDirectory));
+            EXPECT_FALSE(map_management::Global_Map::has_tile_files(secondMap.get_directory()));
+            EXPECT_EQ(secondMap.get_point_count(), 0u);
+
+            // A directory of unknown tiles cannot receive a snapshot
+            EXPECT_FALSE(map_management::remove_map_snapshot(otherDirectory));
+        }
+        EXPECT_FALSE(std::filesystem::exists(firstWorkingDirectory));
+        EXPECT_TRUE(map_management::Global_Map::has_tile_files(otherDirectory));
+
+        std::filesystem::remove_all(testDirectory);
+    }
+
+}
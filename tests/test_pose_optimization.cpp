@@ -1,7 +1,12 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <numeric>
 #include <random>
 
 #include "pose_optimization/pose_optimization.hpp"
+#include "pose_optimization/levenberg_marquard_functors.hpp"
+#include "pose_optimization/ransac.hpp"
 #include "pose.hpp"
 #include "camera_transformation.hpp"
 #include "logger.hpp"
@@ -67,7 +72,11 @@ namespace rgbd_slam {
         return pointContainer;
     }
 
-    const matches_containers::match_point_container get_matched_points(const utils::Pose& endPose, const double error = 0.0)
+    /**
+     * Return the matches of the cube points, seen from endPose
+     * \param[in] shouldAlternate2DPoints If true, one match out of two has no depth, like a 2D keypoint
+     */
+    const matches_containers::match_point_container get_matched_points(const utils::Pose& endPose, const double error = 0.0, const bool shouldAlternate2DPoints = false)
     {
         assert(error >= 0);
         const matrix44& W2CtransformationMatrix = utils::compute_world_to_camera_transform(endPose.get_orientation_quaternion(), endPose.get_position());
@@ -83,10 +92,12 @@ namespace rgbd_slam {
             const bool isScreenCoordinatesValid = utils::world_to_screen_coordinates(worldPointStart, W2CtransformationMatrix, transformedPoint);
             if (isScreenCoordinatesValid)
             {
-                // screen coordinates
-                const vector3 screenPointEnd(transformedPoint.x(), transformedPoint.y(), worldPointStart.z());
-                // Dont care about the map id
-                matchedPoints.emplace(matchedPoints.end(), screenPointEnd, worldPointStart, 0);
+                // screen coordinates, with the depth of the point in camera space
+                const bool is2DPoint = shouldAlternate2DPoints and (matchedPoints.size() % 2 == 1);
+                const double depth = is2DPoint ? 0.0 : (W2CtransformationMatrix * worldPointStart.homogeneous()).z();
+                const vector3 screenPointEnd(transformedPoint.x(), transformedPoint.y(), depth);
+                // Dont care about the map id nor the match score
+                matchedPoints.add(screenPointEnd, worldPointStart, 0, 0.0);
             }
             else
             {
@@ -100,6 +111,36 @@ namespace rgbd_slam {
         return matchedPoints;
     }
 
+    /**
+     * Return plane and cylinder matches seen from the end pose
+     */
+    const matches_containers::match_primitive_container get_matched_primitives(const utils::Pose& endPose)
+    {
+        const matrix33& worldToCameraRotation = endPose.get_orientation_matrix().transpose();
+        const vector3& position = endPose.get_position();
+
+        matches_containers::match_primitive_container matchedPrimitives;
+        const vector4_vector worldPlanes {
+            vector4(1, 0, 0, -CUBE_START_X),
+            vector4(0, 1, 0, -CUBE_START_Y),
+            vector4(0, 0, 1, -(CUBE_START_Z + CUBE_SIDE_SIZE))
+        };
+        for(const vector4& worldPlane : worldPlanes)
+        {
+            // n_w.X_w + d_w = 0, with X_w = R.X_c + t
+            vector4 cameraPlane;
+            cameraPlane << worldToCameraRotation * worldPlane.head<3>(), worldPlane(3) + worldPlane.head<3>().dot(position);
+            matchedPrimitives.push_back({cameraPlane, worldPlane, false});
+        }
+
+        // Cylinder: the detected axis has the opposite sign of the map axis
+        const vector3 worldAxis = vector3(1, 1, 0).normalized();
+        vector4 cameraAxis;
+        cameraAxis << -(worldToCameraRotation * worldAxis), 0.0;
+        matchedPrimitives.push_back({cameraAxis, vector4(worldAxis.x(), worldAxis.y(), worldAxis.z(), 0.0), true});
+        return matchedPrimitives;
+    }
+
     /**
      * Return the distance between two angles, in radians
      */
@@ -109,12 +150,12 @@ namespace rgbd_slam {
         return std::min(diff, abs(diff - 2.0 * M_PI));
     }
 
-    void run_test_optimization(const matches_containers::match_point_container& matchedPoints, const utils::Pose& trueEndPose, const utils::Pose& initialPoseGuess)
+    void run_test_optimization(const matches_containers::match_point_container& matchedPoints, const utils::Pose& trueEndPose, const utils::Pose& initialPoseGuess, const matches_containers::match_primitive_container& matchedPrimitives = matches_containers::match_primitive_container())
     {
         // Compute end pose
         utils::Pose endPose; 
-        matches_containers::match_point_container outlierMatchedPoints;
-        const bool isPoseValid = pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPoints, endPose, outlierMatchedPoints);
+        matches_containers::match_index_container outlierIndexes;
+        const bool isPoseValid = pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPoints, matchedPrimitives, endPose, outlierIndexes);
 
         if (not isPoseValid)
             FAIL();
@@ -684,4 +725,305 @@ namespace rgbd_slam {
     }
 
 
+    /*
+     * Run a test with a medium initial guess, where half of the matches have no depth: the minimal samples mix 2D and 3D matches
+     */
+    TEST(PoseOptimizationTests, mixed2DAnd3DMatches) 
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        // True End pose
+        const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+        const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+        const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+        const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+        const matches_containers::match_point_container& matchedPoints = get_matched_points(trueEndPose, POINTS_ERROR, true);
+
+
+        // Estimated pose base
+        const vector3 initialPositionGuess(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+        const EulerAngles initialEulerAnglesGuess(END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+        const quaternion initialQuaternionGuess(utils::get_quaternion_from_euler_angles(initialEulerAnglesGuess));
+        const utils::Pose initialPoseGuess(initialPositionGuess, initialQuaternionGuess);
+
+        run_test_optimization(matchedPoints, trueEndPose, initialPoseGuess);
+    }
+
+    /*
+     * Run a test with a medium initial guess, with plane and cylinder matches along with the points
+     */
+    TEST(PoseOptimizationTests, pointsAndPrimitives) 
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        // True End pose
+        const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+        const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+        const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+        const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+        const matches_containers::match_point_container& matchedPoints = get_matched_points(trueEndPose, POINTS_ERROR);
+        const matches_containers::match_primitive_container& matchedPrimitives = get_matched_primitives(trueEndPose);
+
+
+        // Estimated pose base
+        const vector3 initialPositionGuess(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+        const EulerAngles initialEulerAnglesGuess(END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+        const quaternion initialQuaternionGuess(utils::get_quaternion_from_euler_angles(initialEulerAnglesGuess));
+        const utils::Pose initialPoseGuess(initialPositionGuess, initialQuaternionGuess);
+
+        run_test_optimization(matchedPoints, trueEndPose, initialPoseGuess, matchedPrimitives);
+    }
+
+    /*
+     * Run a test with a medium initial guess, with too few points for RANSAC: the three matched planes constrain the pose
+     */
+    TEST(PoseOptimizationTests, fewPointsAndPrimitives) 
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        // True End pose
+        const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+        const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+        const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+        const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+        // Keep two points only, under the RANSAC minimum
+        const matches_containers::match_point_container& allMatchedPoints = get_matched_points(trueEndPose, POINTS_ERROR);
+        matches_containers::match_point_container matchedPoints;
+        for(size_t matchIndex = 0; matchIndex < 2; ++matchIndex)
+            matchedPoints.add(allMatchedPoints.get_screen_point(matchIndex), allMatchedPoints.get_world_point(matchIndex), 0, 0.0);
+        const matches_containers::match_primitive_container& matchedPrimitives = get_matched_primitives(trueEndPose);
+
+        // Two planes do not constrain the position along their intersection line
+        const matches_containers::match_primitive_container twoPlanes(matchedPrimitives.begin(), matchedPrimitives.begin() + 2);
+        EXPECT_FALSE(pose_optimization::Pose_Optimization::is_pose_constrained_by_primitives(twoPlanes));
+        EXPECT_TRUE(pose_optimization::Pose_Optimization::is_pose_constrained_by_primitives(matchedPrimitives));
+
+        // Estimated pose base
+        const vector3 initialPositionGuess(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+        const EulerAngles initialEulerAnglesGuess(END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+        const quaternion initialQuaternionGuess(utils::get_quaternion_from_euler_angles(initialEulerAnglesGuess));
+        const utils::Pose initialPoseGuess(initialPositionGuess, initialQuaternionGuess);
+
+        // Without the planes, there are not enough matches
+        utils::Pose endPose;
+        matches_containers::match_index_container outlierIndexes;
+        EXPECT_FALSE(pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPoints, twoPlanes, endPose, outlierIndexes));
+
+        run_test_optimization(matchedPoints, trueEndPose, initialPoseGuess, matchedPrimitives);
+        // The planes alone are enough
+        run_test_optimization(matches_containers::match_point_container(), trueEndPose, initialPoseGuess, matchedPrimitives);
+
+        // A wrong match is returned as an outlier, and does not bias the pose
+        matches_containers::match_point_container matchedPointsWithOutlier = matchedPoints;
+        matchedPointsWithOutlier.add(allMatchedPoints.get_screen_point(2), allMatchedPoints.get_world_point(2) + vector3(300, -200, 100), 0, 0.0);
+        ASSERT_TRUE(pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPointsWithOutlier, matchedPrimitives, endPose, outlierIndexes));
+        ASSERT_EQ(outlierIndexes.size(), 1u);
+        EXPECT_EQ(outlierIndexes[0], 2u);
+        EXPECT_LT((endPose.get_position() - truePosition).norm(), 2.0 * (1 + POINTS_ERROR));
+        EXPECT_LT(endPose.get_orientation_quaternion().angularDistance(trueQuaternion), 0.1 * EulerToRadian);
+    }
+
+
+    /**
+     *          JACOBIAN TESTS
+     */
+
+    /*
+     * Compare the gradient of the normal equations of the pose model with a numerical differentiation of its error
+     */
+    TEST(JacobianTests, analyticGradientMatchesNumericalGradient) 
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        // True End pose
+        const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+        const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+        const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+        const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+        const matches_containers::match_point_container& matchedPoints = get_matched_points(trueEndPose, POINTS_ERROR);
+
+        // Evaluate the gradient away from the solution
+        const EulerAngles initialEulerAnglesGuess(END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+        pose_optimization::Global_Pose_Model::state_type state;
+        state._position = vector3(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+        state._rotation = utils::get_quaternion_from_euler_angles(initialEulerAnglesGuess);
+
+        matches_containers::match_index_container matchIndexes(matchedPoints.size());
+        std::iota(matchIndexes.begin(), matchIndexes.end(), 0);
+        const matches_containers::match_primitive_container noPrimitives;
+        const pose_optimization::Global_Pose_Model model(matchedPoints, matchIndexes, noPrimitives);
+        pose_optimization::Global_Pose_Model::matrix66 normalMatrix;
+        pose_optimization::Global_Pose_Model::vector6 gradient;
+        const double squaredError = model.get_normal_equations(state, normalMatrix, gradient);
+        EXPECT_NEAR(squaredError, model.get_squared_error(state), 1e-9 * squaredError);
+
+        // The gradient of the squared error is 2 * J^T.f
+        const double stepSize = 1e-6;
+        for(int parameter = 0; parameter < 6; ++parameter)
+        {
+            pose_optimization::Global_Pose_Model::vector6 step = pose_optimization::Global_Pose_Model::vector6::Zero();
+            step(parameter) = stepSize;
+            const double numericalDerivative = (model.get_squared_error(model.get_incremented_state(state, step)) - model.get_squared_error(model.get_incremented_state(state, -step))) / (2.0 * stepSize);
+
+            EXPECT_NEAR(2.0 * gradient(parameter), numericalDerivative, 1e-3 * gradient.norm());
+        }
+    }
+
+    /*
+     * Compare the gradient of the primitive errors with a numerical differentiation: they are isolated by removing the point errors
+     */
+    TEST(JacobianTests, analyticPrimitiveGradientMatchesNumericalGradient) 
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        // True End pose
+        const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+        const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+        const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+        const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+        const matches_containers::match_point_container& matchedPoints = get_matched_points(trueEndPose, POINTS_ERROR);
+        const matches_containers::match_primitive_container& matchedPrimitives = get_matched_primitives(trueEndPose);
+
+        // Evaluate the gradient away from the solution
+        const EulerAngles initialEulerAnglesGuess(END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+        pose_optimization::Global_Pose_Model::state_type state;
+        state._position = vector3(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+        state._rotation = utils::get_quaternion_from_euler_angles(initialEulerAnglesGuess);
+
+        matches_containers::match_index_container matchIndexes(matchedPoints.size());
+        std::iota(matchIndexes.begin(), matchIndexes.end(), 0);
+        const matches_containers::match_primitive_container noPrimitives;
+        const pose_optimization::Global_Pose_Model pointModel(matchedPoints, matchIndexes, noPrimitives);
+        const pose_optimization::Global_Pose_Model model(matchedPoints, matchIndexes, matchedPrimitives);
+
+        pose_optimization::Global_Pose_Model::matrix66 normalMatrix;
+        pose_optimization::Global_Pose_Model::vector6 pointGradient;
+        pose_optimization::Global_Pose_Model::vector6 gradient;
+        pointModel.get_normal_equations(state, normalMatrix, pointGradient);
+        model.get_normal_equations(state, normalMatrix, gradient);
+        const pose_optimization::Global_Pose_Model::vector6 primitiveGradient = gradient - pointGradient;
+        ASSERT_GT(primitiveGradient.norm(), 0.0);
+
+        const auto get_primitive_squared_error = [&](const pose_optimization::Global_Pose_Model::state_type& evaluatedState) {
+            return model.get_squared_error(evaluatedState) - pointModel.get_squared_error(evaluatedState);
+        };
+
+        // The gradient of the squared error is 2 * J^T.f
+        const double stepSize = 1e-6;
+        for(int parameter = 0; parameter < 6; ++parameter)
+        {
+            pose_optimization::Global_Pose_Model::vector6 step = pose_optimization::Global_Pose_Model::vector6::Zero();
+            step(parameter) = stepSize;
+            const double numericalDerivative = (get_primitive_squared_error(model.get_incremented_state(state, step)) - get_primitive_squared_error(model.get_incremented_state(state, -step))) / (2.0 * stepSize);
+
+            EXPECT_NEAR(2.0 * primitiveGradient(parameter), numericalDerivative, 1e-3 * primitiveGradient.norm());
+        }
+    }
+
+
+    /**
+     *          RANSAC SAMPLING TESTS
+     */
+
+    /*
+     * The random subsets contain unique values, all in the candidate range
+     */
+    TEST(RansacTests, randomSubsetIsUniqueAndInRange)
+    {
+        std::mt19937 generator(0);
+        for(size_t candidateCount = 3; candidateCount < 50; ++candidateCount)
+        {
+            for(size_t subsetSize = 1; subsetSize <= 3; ++subsetSize)
+            {
+                for(uint draw = 0; draw < 100; ++draw)
+                {
+                    std::array<size_t, 3> subset;
+                    const std::span<size_t> subsetView(subset.data(), subsetSize);
+                    pose_optimization::get_random_subset(candidateCount, subsetView, generator);
+
+                    std::sort(subsetView.begin(), subsetView.end());
+                    EXPECT_EQ(std::adjacent_find(subsetView.begin(), subsetView.end()), subsetView.end());
+                    EXPECT_LT(subsetView.back(), candidateCount);
+                }
+            }
+        }
+
+        // A subset as large as the candidates is a permutation
+        std::array<size_t, 3> subset;
+        pose_optimization::get_random_subset(3, subset, generator);
+        std::sort(subset.begin(), subset.end());
+        EXPECT_EQ(subset, (std::array<size_t, 3>{0, 1, 2}));
+    }
+
+    /*
+     * The progressive sampling limits grow from the sample size to all the candidates
+     */
+    TEST(RansacTests, progressiveSamplingLimitsGrowToAllCandidates)
+    {
+        const size_t sampleSize = 3;
+        for(size_t candidateCount = sampleSize; candidateCount < 500; candidateCount += 7)
+        {
+            for(size_t iterationCount = 1; iterationCount < 30; ++iterationCount)
+            {
+                std::vector<size_t> sampleLimits;
+                pose_optimization::get_progressive_sampling_limits(sampleSize, candidateCount, iterationCount, sampleLimits);
+
+                ASSERT_EQ(sampleLimits.size(), iterationCount);
+                EXPECT_GE(sampleLimits.front(), sampleSize);
+                EXPECT_TRUE(std::is_sorted(sampleLimits.begin(), sampleLimits.end()));
+                EXPECT_EQ(sampleLimits.back(), candidateCount);
+            }
+        }
+    }
+
+    /*
+     * With the same seed, the pose does not depend on the thread scheduling
+     */
+    TEST(RansacTests, sameSeedGivesSamePose)
+    {
+        if (not Parameters::is_valid())
+        {
+            Parameters::load_defaut();
+        }
+
+        const utils::Pose trueEndPose(vector3(END_POSITION, END_POSITION, END_POSITION), utils::get_quaternion_from_euler_angles(EulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL)));
+        const utils::Pose initialPoseGuess(vector3::Zero(), quaternion::Identity());
+        const matches_containers::match_point_container& matchedPoints = get_matched_points(trueEndPose, POINTS_ERROR, true);
+        const matches_containers::match_primitive_container noPrimitives;
+
+        utils::Pose firstPose;
+        matches_containers::match_index_container firstOutliers;
+        ASSERT_TRUE(pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPoints, noPrimitives, firstPose, firstOutliers));
+        for(uint run = 0; run < 10; ++run)
+        {
+            utils::Pose pose;
+            matches_containers::match_index_container outliers;
+            ASSERT_TRUE(pose_optimization::Pose_Optimization::compute_optimized_pose(initialPoseGuess, matchedPoints, noPrimitives, pose, outliers));
+
+            EXPECT_EQ(outliers, firstOutliers);
+            EXPECT_TRUE(pose.get_position().isApprox(firstPose.get_position(), 0.0));
+            EXPECT_TRUE(pose.get_orientation_quaternion().coeffs().isApprox(firstPose.get_orientation_quaternion().coeffs(), 0.0));
+        }
+    }
+
 }
@@ -85,18 +85,14 @@ namespace lambdatwist {
 
 
     // Solves for camera pose such that: lambda*x = R*X+t  with positive lambda.
-    const std::vector<CameraPose> p3p(const std::vector<Eigen::Vector3d> &x, const std::vector<Eigen::Vector3d> &X) 
+    int p3p(const std::array<Eigen::Vector3d, 3> &x, const std::array<Eigen::Vector3d, 3> &X, std::array<CameraPose, 4> &output) 
     {
-        assert(x.size() == X.size());
-        assert(x.size() == 3);
-        assert(X.size() == 3);
-        
         // Must be 3 different points
         assert(X[0] != X[1]);
         assert(X[0] != X[2]);
         assert(X[1] != X[2]);
 
-        std::vector<CameraPose> output;
+        int n_sols = 0;
 
         const Eigen::Vector3d dX12 = X[0] - X[1];
         const Eigen::Vector3d dX13 = X[0] - X[2];
@@ -227,7 +223,7 @@ namespace lambdatwist {
                         YY << v1, v2, v1.cross(v2);
                         pose.R = YY * XX;
                         pose.t = lambda1*x[0] - pose.R*X[0];
-                        output.push_back(pose);
+                        output[n_sols++] = pose;
                     }
 
                     if(b2m4ac < TOL_DOUBLE_ROOT) {
@@ -265,7 +261,7 @@ namespace lambdatwist {
                         YY << v1, v2, v1.cross(v2);
                         pose.R = YY * XX;
                         pose.t = lambda1*x[0] - pose.R*X[0];
-                        output.push_back(pose);
+                        output[n_sols++] = pose;
                     }
                     if(b2m4ac < TOL_DOUBLE_ROOT) {
                         break;
@@ -273,7 +269,18 @@ namespace lambdatwist {
                 }
             }           
         }
-        return output;
+        return n_sols;
+    }
+
+    const std::vector<CameraPose> p3p(const std::vector<Eigen::Vector3d> &x, const std::vector<Eigen::Vector3d> &X) 
+    {
+        assert(x.size() == X.size());
+        assert(x.size() == 3);
+        assert(X.size() == 3);
+
+        std::array<CameraPose, 4> poses;
+        const int n_sols = p3p({x[0], x[1], x[2]}, {X[0], X[1], X[2]}, poses);
+        return std::vector<CameraPose>(poses.begin(), poses.begin() + n_sols);
     }
 
 }
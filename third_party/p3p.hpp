@@ -29,6 +29,7 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <array>
 #include <vector>
 
 namespace lambdatwist {
@@ -48,4 +49,8 @@ namespace lambdatwist {
     // Returns Solution vector (size from 0 to 4) 
     const std::vector<CameraPose> p3p(const std::vector<Eigen::Vector3d> &x, const std::vector<Eigen::Vector3d> &X);
 
+    // Same as above, without allocation: the solutions are written at the start of output.
+    // Returns the number of solutions (from 0 to 4)
+    int p3p(const std::array<Eigen::Vector3d, 3> &x, const std::array<Eigen::Vector3d, 3> &X, std::array<CameraPose, 4> &output);
+
 }